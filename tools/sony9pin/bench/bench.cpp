@@ -0,0 +1,435 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QProcess>
+#include <QTimer>
+#include <QUrl>
+#include <QWebSocket>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "fakedeck.h"
+#include "format.h"
+#include "frame.h"
+#include "link.h"
+#include "memoryport.h"
+#include "poller.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "stream.h"
+#include "timecode.h"
+
+using namespace std;
+
+extern void device_make_model(uint16_t device_type, string& device_make, string& device_model);
+
+namespace {
+
+struct Result {
+  string name;
+  uint64_t iterations;
+  double ns_per_op;
+  double mb_per_s;
+};
+
+vector<Result> results;
+volatile uint64_t sink;
+
+int64_t now() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Doubles the iteration count until a run lasts at least 200 ms
+template <typename Function>
+void bench(const char* name, Function function) {
+  for (uint64_t iterations = 1;; iterations *= 2) {
+    const auto start = now();
+    for (uint64_t i = 0; i < iterations; i++)
+      function(i);
+    const auto elapsed = now() - start;
+    if (elapsed >= 200000000 || iterations >= (1ULL << 40)) {
+      results.push_back({ name, iterations, (double)elapsed / iterations, 0 });
+      cerr << "Info: " << name << " " << (double)elapsed / iterations << " ns/op.\n";
+      return;
+    }
+  }
+}
+
+Sony9PinRemote::TimeCode make_timecode(uint64_t i) {
+  Sony9PinRemote::TimeCode tc = {};
+  tc.frame = i % 30;
+  tc.second = i / 30 % 60;
+  tc.minute = i / 1800 % 60;
+  tc.hour = i / 108000 % 24;
+  tc.is_df = true;
+  return tc;
+}
+
+void micro_benchmarks() {
+  bench("bcd/to_bcd", [](uint64_t i) { sink += to_bcd(i % 100); });
+  bench("bcd/from_bcd", [](uint64_t i) { sink += from_bcd(to_bcd(i % 100)); });
+  bench("timecode/from_deck_df", [](uint64_t i) { sink += Timecode::from_deck(make_timecode(i), 30).frames(); });
+  bench("timecode/format_df", [](uint64_t i) {
+    char text[Timecode::format_size];
+    Timecode(i % 2589408, 30, true).format(text);
+    sink += text[10];
+  });
+  bench("timecode/parse_df", [](uint64_t i) {
+    Timecode tc;
+    sink += Timecode::parse(i & 1 ? "01:02:03;04" : "23:59:59;29", 11, 30, tc) + tc.frames();
+  });
+  bench("timecode/add_compare", [](uint64_t i) {
+    const Timecode tc(i, 30, true);
+    sink += tc + 1800 > Timecode::from_fields(0, 1, 0, 2, 30, true);
+  });
+
+  ostringstream out;
+  bench("format/timecode_userbits", [&](uint64_t i) {
+    const Sony9PinRemote::UserBits ub = { { (uint8_t)i, 0x12, 0x34, 0x56 } };
+    out.str(string());
+    format_timecode_userbits(out, make_timecode(i), &ub);
+    sink += out.tellp();
+  });
+
+  State state = {}, last = {};
+  bench("format/state_first", [&](uint64_t i) {
+    state.tc = make_timecode(i);
+    out.str(string());
+    sink += format_state(out, state, last, true);
+  });
+  bench("format/state_timecode_changed", [&](uint64_t i) {
+    state.tc = make_timecode(i);
+    out.str(string());
+    sink += format_state(out, state, last, false);
+    last = state;
+  });
+  bench("format/state_status_changed", [&](uint64_t i) {
+    state.st.b_play = i & 1;
+    state.st.b_servo_lock = i & 1;
+    out.str(string());
+    sink += format_state(out, state, last, false);
+    last = state;
+  });
+
+  bench("devices/known", [](uint64_t i) {
+    string make, model;
+    device_make_model(i & 1 ? 0xf01d : 0x0010, make, model);
+    sink += model.size();
+  });
+  bench("devices/unknown", [](uint64_t) {
+    string make, model;
+    device_make_model(0xabcd, make, model);
+    sink += model.size();
+  });
+}
+
+// Whole reply streams through the frame decoder, one op is one stream
+void parse_throughput(const char* name, const vector<uint8_t>& stream) {
+  FrameDecoder decoder;
+  bench(name, [&](uint64_t) {
+    decoder.reset();
+    for (const auto byte : stream) {
+      if (decoder.feed(byte))
+        sink += decoder.size();
+    }
+  });
+  auto& result = results.back();
+  result.mb_per_s = stream.size() / result.ns_per_op * 1000;
+  cerr << "Info: " << name << " " << result.mb_per_s << " MB/s.\n";
+}
+
+vector<uint8_t> synthesize_stream(size_t size, size_t noise_period) {
+  vector<uint8_t> stream;
+  uint8_t frame[FrameDecoder::max_size];
+  const uint8_t status[10] = { 0x00, 0x01, 0x80 };
+  for (uint64_t i = 0; stream.size() < size; i++) {
+    const auto tc = make_timecode(i);
+    const uint8_t time[4] = { to_bcd(tc.frame), to_bcd(tc.second), to_bcd(tc.minute), to_bcd(tc.hour) };
+    size_t length;
+    switch (i % 3) {
+      case 0: length = encode_frame(frame, 0x10, 0x01, nullptr, 0); break;
+      case 1: length = encode_frame(frame, 0x70, 0x20, status, sizeof(status)); break;
+      default: length = encode_frame(frame, 0x70, 0x04, time, sizeof(time)); break;
+    }
+    stream.insert(stream.end(), frame, frame + length);
+  }
+  if (noise_period) {
+    for (size_t i = noise_period / 2; i < stream.size(); i += noise_period)
+      stream[i] ^= 0x5A;
+  }
+  return stream;
+}
+
+void parse_benchmarks(const string& recorded) {
+  parse_throughput("parse/clean", synthesize_stream(1 << 20, 0));
+  parse_throughput("parse/noisy_1_in_97", synthesize_stream(1 << 20, 97));
+  if (!recorded.empty()) {
+    ifstream file(recorded, ios::binary);
+    const vector<uint8_t> stream((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (!stream.empty())
+      parse_throughput("parse/recorded", stream);
+    else
+      cerr << "Error: can not read " << recorded << ".\n";
+  }
+}
+
+// Continuous mode polls through Poller::run() on the in-memory port, with
+// what the CLI gives it: the scheduler, an eot rule, on_reply. That it
+// does not allocate is checked by sony9pin_tests.
+void poll_benchmarks() {
+  VirtualClock clock;
+  set_clock(&clock);
+  MemoryPort port;
+  Link<MemoryPort> link(port);
+  Poller<MemoryPort> poller(port, link);
+  poller.set_timing(1000, 2, 0);
+  uint64_t replies = 0;
+  poller.on_reply = [&](bool received, bool) { replies += received; };
+  const Rules::Transport transport = [&](char command) {
+    return poller.query(*transport_frame(command)) && is_ack(link.frame()) ? 0 : 1;
+  };
+  Rules rules;
+  string error;
+  rules.add("eot:rewind", 30, error);
+  PollScheduler scheduler;
+  scheduler.start(30000, 1001, 1, false, 2);
+
+  bench("poll/run", [&](uint64_t) {
+    poller.run(scheduler, rules, transport, [](const State&, const State&, const Poll&, bool) { return true; });
+  });
+  sink += replies;
+  set_clock(nullptr);
+}
+
+// Dashboards on the WebSocket stream while states are published back to
+// back, the raw status data toggling so every message carries all the
+// extended bits. A quarter of the clients stall (their event loop stops)
+// until the stream holds updates back for them or 10 s passed. publish()
+// must not wait on any client, a backlog must stay bounded, and every
+// client must end up on the final state.
+int stream_load(int client_count) {
+  const char* name = "stream/publish";
+  StateStream stream;
+  string error;
+  if (!stream.open("127.0.0.1", 0, error)) {
+    cerr << "Error: " << name << ", can not listen, " << error << ".\n";
+    return 1;
+  }
+  const QUrl url("ws://127.0.0.1:" + QString::number((long long)stream.port()));
+
+  State last = {};
+  last.tc = make_timecode(107999);
+  last.st.b_play = true;
+  last.data_size = status_data_size;
+  stringstream lastText;
+  format_state(lastText, last, last, false);
+  const auto lastTc = QString::fromStdString(lastText.str());
+
+  struct Dashboard {
+    QWebSocket socket;
+    bool play = false;
+    bool done = false;
+  };
+  const int stalled_count = client_count / 4;
+  atomic<int> connected { 0 }, converged { 0 };
+  atomic<bool> publishing { true }, stop { false };
+  const auto dashboards = [&](int count, bool stall) {
+    QEventLoop loop;
+    QTimer tick;
+    tick.start(10);
+    vector<unique_ptr<Dashboard>> clients;
+    for (int i = 0; i < count; i++) {
+      clients.emplace_back(new Dashboard);
+      auto client = clients.back().get();
+      QObject::connect(&client->socket, &QWebSocket::connected, &client->socket, [&] { connected++; });
+      // Fields are only sent when they change
+      QObject::connect(&client->socket, &QWebSocket::textMessageReceived, &client->socket, [&, client](const QString& message) {
+        if (message.contains(" play=1"))
+          client->play = true;
+        else if (message.contains(" play=0"))
+          client->play = false;
+        if (!client->done && client->play && message.contains(lastTc)) {
+          client->done = true;
+          converged++;
+        }
+      });
+      client->socket.open(url);
+    }
+    while (!stop && (!stall || connected < client_count))
+      loop.processEvents(QEventLoop::WaitForMoreEvents);
+    while (stall && publishing)
+      this_thread::sleep_for(chrono::milliseconds(10));
+    while (!stop)
+      loop.processEvents(QEventLoop::WaitForMoreEvents);
+  };
+  thread fast(dashboards, client_count - stalled_count, false);
+  thread stalled(dashboards, stalled_count, true);
+  const auto finish = [&]() {
+    publishing = false;
+    stop = true;
+    fast.join();
+    stalled.join();
+    stream.close();
+  };
+
+  for (const auto deadline = now() + 10000000000LL; connected < client_count && now() < deadline;)
+    this_thread::sleep_for(chrono::milliseconds(10));
+  if (connected < client_count) {
+    finish();
+    cerr << "Error: " << name << " FAILED, " << connected << " of " << client_count << " clients connected.\n";
+    return 1;
+  }
+
+  State state = {};
+  state.data_size = status_data_size;
+  uint64_t published = 0;
+  int64_t slowest = 0;
+  const auto start = now();
+  for (const auto deadline = start + 10000000000LL; !stream.stats().backlogged && now() < deadline;) {
+    for (int i = 0; i < 1000; i++, published++) {
+      state.tc = make_timecode(published);
+      memset(state.data, published % 2 ? 0xFF : 0, sizeof(state.data));
+      const auto before = now();
+      stream.publish(state, 1700000000000LL + published);
+      slowest = max(slowest, now() - before);
+    }
+  }
+  stream.publish(last, 1700000000000LL + published);
+  const auto elapsed = now() - start;
+  publishing = false;
+
+  for (const auto deadline = now() + 10000000000LL; converged < client_count && now() < deadline;)
+    this_thread::sleep_for(chrono::milliseconds(10));
+  const auto ended = converged.load();
+  finish();
+
+  const auto stats = stream.stats();
+  cerr << "Info: " << name << ", " << client_count << " clients (" << stalled_count << " stalled), " << published
+       << " states, slowest publish " << slowest / 1000 << " us, " << stats.messages << " messages, " << stats.coalesced
+       << " updates coalesced, " << stats.backlogged << " held back, largest backlog " << stats.max_backlog << " bytes.\n";
+  if (!stats.backlogged)
+    cerr << "Info: " << name << ", no backlog in 10 s, socket buffers absorbed the stalled clients.\n";
+  // A publish waiting on a stalled client would take until it resumes
+  if (ended < client_count || slowest > 100000000 || stats.max_backlog > (uint64_t)StateStream::backlog_bytes * 2) {
+    cerr << "Error: " << name << " FAILED, " << ended << " of " << client_count << " clients on the final state.\n";
+    return 1;
+  }
+  cerr << "Info: " << name << " PASSED.\n";
+  results.push_back({ name, published, (double)elapsed / published, 0 });
+  return 0;
+}
+
+// Full CLI invocations, process start included, against a fake deck
+int end_to_end(const QString& program, int iterations, uint32_t delay_us) {
+  FakeDeck deck;
+  if (!deck.start(delay_us)) {
+    cerr << "Error: can not create fake deck.\n";
+    return 1;
+  }
+
+  const vector<QStringList> commands = {
+    { "0" }, { "1" }, { "2" }, { "3" }, { "4" }, { "5" },
+    { "e" }, { "f" }, { "x" }, { "w" }, { "p" }, { "r" }, { "s" },
+    { "c", "00:01:00:00" },
+    { "0", "1", "2", "p", "2", "s" },
+  };
+  for (const auto& command : commands) {
+    string name = "cli/" + command.join(" ").toStdString() + "/delay_us=" + to_string(delay_us);
+    int64_t total = 0;
+    for (int i = 0; i < iterations; i++) {
+      QProcess process;
+      QStringList arguments;
+      arguments << QString::fromStdString(deck.port_name()) << command;
+      const auto start = now();
+      process.start(program, arguments);
+      if (!process.waitForFinished(30000) || process.exitCode()) {
+        cerr << "Error: " << name << " failed.\n";
+        return 1;
+      }
+      total += now() - start;
+    }
+    results.push_back({ name, (uint64_t)iterations, (double)total / iterations, 0 });
+    cerr << "Info: " << name << " " << total / iterations / 1000 << " us/op.\n";
+  }
+  return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  QCoreApplication coreApplication(argc, argv);
+  QStringList argumentList = QCoreApplication::arguments();
+  if (!argumentList.isEmpty())
+    argumentList.takeFirst();
+
+  QString program;
+  string recorded;
+  int iterations = 10;
+  vector<uint32_t> delays = { 0, 5000 };
+  int clients = 64;
+  while (!argumentList.isEmpty()) {
+    const auto argument = argumentList.takeFirst();
+    if (argument.startsWith("--sony9pin=")) {
+      program = argument.mid(11);
+    } else if (argument.startsWith("--iterations=")) {
+      iterations = argument.mid(13).toInt();
+    } else if (argument.startsWith("--stream=")) {
+      recorded = argument.mid(9).toStdString();
+    } else if (argument.startsWith("--delay-us=")) {
+      delays = { argument.mid(11).toUInt() };
+    } else if (argument.startsWith("--clients=")) {
+      clients = argument.mid(10).toInt();
+    } else {
+      cerr << "Usage: sony9pin_bench [--sony9pin=<path to sony9pin>] [--iterations=<n>] [--delay-us=<deck response delay>]\n"
+           << "       [--stream=<recorded 9-pin reply bytes>]\n"
+           << "       [--clients=<WebSocket clients of the stream load test, default 64, 0 to skip>]\n"
+           << "Micro-benchmarks and the stream load test always run, CLI end-to-end benchmarks only with --sony9pin.\n"
+           << "The deterministic checks are sony9pin_tests.\n"
+           << "Results are written to stdout as JSON.\n";
+      return 1;
+    }
+  }
+
+  micro_benchmarks();
+  poll_benchmarks();
+  parse_benchmarks(recorded);
+  if (clients > 0) {
+    if (auto result = stream_load(clients))
+      return result;
+  }
+  if (!program.isEmpty()) {
+    for (const auto delay : delays) {
+      if (auto result = end_to_end(program, iterations, delay))
+        return result;
+    }
+  }
+
+  cout << "{\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    cout << "    { \"name\": \"" << results[i].name << "\", \"iterations\": " << results[i].iterations
+         << ", \"ns_per_op\": " << results[i].ns_per_op;
+    if (results[i].mb_per_s)
+      cout << ", \"mb_per_s\": " << results[i].mb_per_s;
+    cout << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  cout << "  ]\n}\n";
+
+  return 0;
+}
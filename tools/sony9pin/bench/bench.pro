@@ -0,0 +1,37 @@
+TEMPLATE = app
+TARGET = sony9pin_bench
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QT -= gui
+QT += websockets
+
+# Lib
+INCLUDEPATH += . .. ../tests
+
+# Input
+HEADERS += fakedeck.h \
+           ../tests/memoryport.h \
+           ../clock.h \
+           ../format.h \
+           ../frame.h \
+           ../link.h \
+           ../poller.h \
+           ../rules.h \
+           ../scheduler.h \
+           ../stream.h \
+           ../timecode.h \
+           ../timeline.h \
+           ../trace.h
+
+SOURCES += bench.cpp \
+           fakedeck.cpp \
+           ../clock.cpp \
+           ../devices.cpp \
+           ../format.cpp \
+           ../frame.cpp \
+           ../link.cpp \
+           ../rules.cpp \
+           ../scheduler.cpp \
+           ../stream.cpp \
+           ../timeline.cpp \
+           ../trace.cpp
@@ -0,0 +1,128 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "fakedeck.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "frame.h"
+#include "timecode.h"
+
+using namespace std;
+
+FakeDeck::~FakeDeck() {
+  stop();
+}
+
+bool FakeDeck::start(uint32_t delay, uint16_t type) {
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master))
+    return false;
+  name = ptsname(master);
+
+  termios tio;
+  tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master, TCSANOW, &tio);
+
+  delay_us = delay;
+  device_type = type;
+  running = true;
+  thread = std::thread(&FakeDeck::run, this);
+  return true;
+}
+
+void FakeDeck::stop() {
+  running = false;
+  if (thread.joinable())
+    thread.join();
+  if (master >= 0)
+    close(master);
+  master = -1;
+}
+
+void FakeDeck::run() {
+  FrameDecoder decoder;
+  uint8_t buffer[64];
+  while (running) {
+    pollfd fd = { master, POLLIN, 0 };
+    if (poll(&fd, 1, 50) <= 0)
+      continue;
+    const auto count = read(master, buffer, sizeof(buffer));
+    for (ssize_t i = 0; i < count; i++) {
+      if (!decoder.feed(buffer[i]))
+        continue;
+      do {
+        reply(decoder.data(), decoder.size());
+      } while (decoder.next());
+    }
+  }
+}
+
+void FakeDeck::send(uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t size) {
+  uint8_t frame[FrameDecoder::max_size];
+  const auto length = encode_frame(frame, cmd1, cmd2, data, size);
+  if (delay_us)
+    this_thread::sleep_for(chrono::microseconds(delay_us));
+  if (write(master, frame, length) < 0)
+    running = false;
+}
+
+void FakeDeck::reply(const uint8_t* command, size_t size) {
+  const uint8_t cmd1 = command[0] & 0xF0;
+  const uint8_t cmd2 = command[1];
+  if (playing)
+    frames += 1;
+
+  if (cmd1 == 0x00 && cmd2 == 0x11) {
+    const uint8_t data[] = { (uint8_t)(device_type >> 8), (uint8_t)device_type };
+    send(0x10, 0x11, data, 2);
+    return;
+  }
+  if (cmd1 == 0x20) {
+    playing = cmd2 == 0x01;
+    send(0x10, 0x01, nullptr, 0);
+    return;
+  }
+  if (cmd1 == 0x60 && cmd2 == 0x20 && size > 3) {
+    // Remote, media in, stop or play, servo locked while playing
+    uint8_t status[16] = {};
+    status[1] = playing ? 0x01 : 0x20;
+    status[2] = playing ? 0x80 : 0x00;
+    const uint8_t start = command[2] >> 4;
+    uint8_t count = command[2] & 0x0F;
+    if (start + count > 16)
+      count = 16 - start;
+    send(0x70, 0x20, status + start, count);
+    return;
+  }
+  if (cmd1 == 0x60 && cmd2 == 0x0C && size > 3) {
+    const uint8_t tc[] = {
+      to_bcd(frames % 30), to_bcd(frames / 30 % 60), to_bcd(frames / 1800 % 60), to_bcd(frames / 108000 % 24),
+      0x00, 0x00, 0x00, 0x00,
+    };
+    switch (command[2]) {
+      case 0x01: send(0x70, 0x04, tc, 4); return;
+      case 0x02: send(0x70, 0x05, tc, 4); return;
+      case 0x04: send(0x70, 0x00, tc, 4); return;  // timer1
+      case 0x08: send(0x70, 0x01, tc, 4); return;  // timer2
+      case 0x10: // LTC TC & UB
+      case 0x11: send(0x70, 0x05, tc, 8); return;
+      case 0x20: // VITC TC & UB
+      case 0x22: send(0x70, 0x06, tc, 8); return;
+    }
+  }
+
+  // NAK, unknown command
+  const uint8_t nak = 0x01;
+  send(0x10, 0x12, &nak, 1);
+}
@@ -0,0 +1,45 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef FAKEDECK_H
+#define FAKEDECK_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Pseudo-terminal backed Sony 9-pin deck answering the commands sony9pin
+// sends, after a fixed response delay, with a tape that is always in remote
+// and whose timecode runs while playing. The default device type is one
+// whose profile has every timecode source (timer2, LTC, VITC), so no
+// command of the benchmarks is refused by the profile.
+class FakeDeck {
+public:
+  ~FakeDeck();
+
+  bool start(uint32_t delay_us, uint16_t device_type = 0x00e0);
+  void stop();
+
+  // Serial port name to give to sony9pin
+  const std::string& port_name() const { return name; }
+
+private:
+  void run();
+  void reply(const uint8_t* command, size_t size);
+  void send(uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t size);
+
+  int master = -1;
+  std::string name;
+  std::thread thread;
+  std::atomic<bool> running { false };
+  uint32_t delay_us = 0;
+  uint16_t device_type = 0;
+  bool playing = false;
+  uint32_t frames = 0;
+};
+
+#endif
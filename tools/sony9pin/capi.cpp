@@ -0,0 +1,442 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "capi.h"
+
+#include <QCoreApplication>
+#include <QSerialPort>
+#include <QThread>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "clock.h"
+#include "link.h"
+#include "profiles.h"
+#include "timecode.h"
+#include "timeline.h"
+
+using namespace std;
+
+extern void device_make_model(uint16_t device_type, string& device_make, string& device_model);
+extern int open_port(QSerialPort& port, const QString& serialPortName, bool verbose);
+
+struct sony9pin_deck {
+  QString name;
+  unique_ptr<QThread> worker;
+  mutex queue_mutex;
+  condition_variable wake;
+  deque<function<void()>> jobs;
+  bool stopping = false;
+  sony9pin_callback callback = nullptr;
+  void* user = nullptr;
+  uint32_t interval_ms = 0;
+
+  // Worker thread only
+  unique_ptr<QSerialPort> port;
+  unique_ptr<Link<QSerialPort>> link;
+  Sony9PinRemote::Controller controller;
+  DeckProfile profile;
+  uint16_t device_type = 0;
+  bool has_last = false;
+  sony9pin_sample last = {};
+};
+
+namespace {
+
+thread_local string lastError;
+
+// Runs job on the deck worker thread and waits for its result
+int call(sony9pin_deck* deck, const function<int(string& error)>& job) {
+  string error;
+  int result;
+  if (QThread::currentThread() == deck->worker.get()) {
+    // From a monitor callback
+    result = job(error);
+  } else {
+    promise<int> done;
+    auto future = done.get_future();
+    {
+      lock_guard<mutex> lock(deck->queue_mutex);
+      deck->jobs.push_back([&] { done.set_value(job(error)); });
+    }
+    deck->wake.notify_one();
+    result = future.get();
+  }
+  if (result)
+    lastError = error;
+  return result;
+}
+
+int receive(sony9pin_deck* deck, const char* what, string& error) {
+  if (!deck->controller.parse_until(deck->profile.response_timeout_ms)) {
+    error = string(what) + " failed";
+    return 1;
+  }
+  if (is_nak(deck->controller)) {
+    error = string(what) + " refused by the device";
+    return 1;
+  }
+  return 0;
+}
+
+int identify(sony9pin_deck* deck, string& error) {
+  deck->controller.device_type_request();
+  if (auto result = receive(deck, "device_type_request", error))
+    return result;
+  deck->device_type = deck->controller.device_type();
+  deck->profile = find_profile(deck->device_type);
+  return 0;
+}
+
+// Transport commands and cues are refused in local mode or without media,
+// same check as the command line
+int check_status_for_command(sony9pin_deck* deck, string& error) {
+  deck->controller.status_sense();
+  if (auto result = receive(deck, "status_sense", error))
+    return result;
+  if (const auto refusal = command_refusal(deck->controller.status())) {
+    error = refusal;
+    return 1;
+  }
+  return 0;
+}
+
+void copy_string(const string& from, char* to, size_t size) {
+  if (!to || !size)
+    return;
+  const auto length = min(from.size(), size - 1);
+  memcpy(to, from.data(), length);
+  to[length] = '\0';
+}
+
+void to_timecode(const Sony9PinRemote::TimeCode& tc, int fps, sony9pin_timecode& out) {
+  out.hour = tc.hour;
+  out.minute = tc.minute;
+  out.second = tc.second;
+  out.frame = tc.frame;
+  out.is_df = tc.is_df;
+  out.is_cf = tc.is_cf;
+  memset(out.userbits, 0, sizeof(out.userbits));
+  out.frames = Timecode::from_deck(tc, fps).frames();
+}
+
+void poll(sony9pin_deck* deck, sony9pin_callback callback, void* user) {
+  string error;
+  deck->controller.status_sense();
+  if (receive(deck, "status_sense", error))
+    return;
+  const auto st = deck->controller.status();
+  deck->controller.current_time_sense_timer1();
+  if (receive(deck, "timer1", error))
+    return;
+
+  sony9pin_sample sample;
+  sample.realtime_ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+  sample.status = pack_status(st, deck->controller.timecode());
+  to_timecode(deck->controller.timecode(), deck->profile.fps, sample.tc);
+  if (deck->has_last && sample.status == deck->last.status && sample.tc.frames == deck->last.tc.frames)
+    return;
+  deck->has_last = true;
+  deck->last = sample;
+  callback(&sample, user);
+}
+
+void run(sony9pin_deck* deck) {
+  unique_lock<mutex> lock(deck->queue_mutex);
+  auto next_poll = stamp_now().monotonic;
+  while (!deck->stopping) {
+    if (!deck->jobs.empty()) {
+      const auto job = move(deck->jobs.front());
+      deck->jobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+    } else if (deck->callback) {
+      if (stamp_now().monotonic < next_poll) {
+        // Woken early by a job or monitor_stop()
+        deck->wake.wait_until(lock, chrono::steady_clock::time_point(chrono::nanoseconds(next_poll)));
+        continue;
+      }
+      const auto callback = deck->callback;
+      const auto user = deck->user;
+      next_poll = stamp_now().monotonic + (int64_t)deck->interval_ms * 1000000;
+      lock.unlock();
+      poll(deck, callback, user);
+      lock.lock();
+    } else {
+      deck->wake.wait(lock);
+    }
+  }
+  lock.unlock();
+  deck->link.reset();
+  deck->port.reset();
+}
+
+// The deck worker. QSerialPort is used with its blocking calls only, which
+// need no event loop, but its notifiers are refused by a thread Qt did not
+// start.
+class Worker : public QThread {
+public:
+  explicit Worker(sony9pin_deck* deck) : deck(deck) {}
+
+protected:
+  void run() override { ::run(deck); }
+
+private:
+  sony9pin_deck* deck;
+};
+
+// QSerialPort also needs a QCoreApplication: a host without one (Python)
+// gets one for the life of the process
+void ensure_application() {
+  static once_flag once;
+  call_once(once, [] {
+    if (QCoreApplication::instance())
+      return;
+    static int argc = 1;
+    static char name[] = "libsony9pin";
+    static char* argv[] = { name, nullptr };
+    new QCoreApplication(argc, argv);
+  });
+}
+
+}
+
+const char* sony9pin_last_error(void) {
+  return lastError.c_str();
+}
+
+sony9pin_deck* sony9pin_open(const char* port) {
+  auto deck = new sony9pin_deck;
+  deck->name = QString::fromUtf8(port);
+  ensure_application();
+  deck->worker.reset(new Worker(deck));
+  deck->worker->start();
+  const auto result = call(deck, [deck](string& error) {
+    // Created on the worker thread, which owns it from now on
+    deck->port.reset(new QSerialPort);
+    if (open_port(*deck->port, deck->name, false)) {
+      error = "can not open " + deck->name.toStdString();
+      return 1;
+    }
+    deck->controller.attach(*deck->port);
+    deck->link.reset(new Link<QSerialPort>(*deck->port));
+    return identify(deck, error);
+  });
+  if (result) {
+    sony9pin_close(deck);
+    return nullptr;
+  }
+  return deck;
+}
+
+void sony9pin_close(sony9pin_deck* deck) {
+  if (!deck)
+    return;
+  {
+    lock_guard<mutex> lock(deck->queue_mutex);
+    deck->stopping = true;
+  }
+  deck->wake.notify_one();
+  deck->worker->wait();
+  delete deck;
+}
+
+size_t sony9pin_status_count(void) {
+  return status_bit_count;
+}
+
+const char* sony9pin_status_name(size_t bit) {
+  return bit < status_bit_count ? status_bit_names[bit] : nullptr;
+}
+
+int sony9pin_status(sony9pin_deck* deck, uint32_t* status) {
+  return call(deck, [deck, status](string& error) {
+    deck->controller.status_sense();
+    if (auto result = receive(deck, "status_sense", error))
+      return result;
+    *status = pack_status(deck->controller.status(), Sony9PinRemote::TimeCode());
+    return 0;
+  });
+}
+
+int sony9pin_device_type(sony9pin_deck* deck, uint16_t* device_type, char* make, size_t make_size,
+                         char* model, size_t model_size) {
+  return call(deck, [=](string& error) {
+    if (auto result = identify(deck, error))
+      return result;
+    string device_make;
+    string device_model;
+    device_make_model(deck->device_type, device_make, device_model);
+    *device_type = deck->device_type;
+    copy_string(device_make, make, make_size);
+    copy_string(device_model, model, model_size);
+    return 0;
+  });
+}
+
+const char* sony9pin_profile_name(sony9pin_deck* deck) {
+  const char* name = nullptr;
+  call(deck, [deck, &name](string&) {
+    name = deck->profile.name.c_str();
+    return 0;
+  });
+  return name;
+}
+
+int sony9pin_use_model(sony9pin_deck* deck, const char* model) {
+  return call(deck, [deck, model](string& error) {
+    const auto profile = find_profile(string(model));
+    if (!profile) {
+      error = string("no deck profile for ") + model;
+      return 1;
+    }
+    deck->profile = *profile;
+    return 0;
+  });
+}
+
+int sony9pin_fps(sony9pin_deck* deck) {
+  int fps = 0;
+  call(deck, [deck, &fps](string&) {
+    fps = deck->profile.fps;
+    return 0;
+  });
+  return fps;
+}
+
+int sony9pin_transport(sony9pin_deck* deck, char command) {
+  return call(deck, [deck, command](string& error) {
+    // Same frames as the command line and rule actions
+    const auto frame = transport_frame(command);
+    if (!frame) {
+      error = string("unknown command ") + command;
+      return 1;
+    }
+    if (auto result = check_status_for_command(deck, error))
+      return result;
+    if (!deck->link->query(*frame, deck->profile.response_timeout_ms)) {
+      error = string("command ") + command + " failed";
+      return 1;
+    }
+    if (!is_ack(deck->link->frame())) {
+      error = string("command ") + command + " refused by the device";
+      return 1;
+    }
+    if (deck->profile.settle_ms)
+      wait_until(stamp_now().monotonic + (int64_t)deck->profile.settle_ms * 1000000);
+    return 0;
+  });
+}
+
+int sony9pin_cue(sony9pin_deck* deck, const char* timecode) {
+  return call(deck, [deck, timecode](string& error) {
+    Timecode tc;
+    if (!Timecode::parse(timecode, strlen(timecode), deck->profile.fps, tc)) {
+      error = string("invalid timecode ") + timecode;
+      return 1;
+    }
+    if (auto result = check_status_for_command(deck, error))
+      return result;
+    const auto bcd = tc.bcd();
+    deck->controller.cue_up_with_data(bcd.hour, bcd.minute, bcd.second, bcd.frame);
+    if (auto result = receive(deck, "cue_up_with_data", error))
+      return result;
+    if (deck->profile.settle_ms)
+      wait_until(stamp_now().monotonic + (int64_t)deck->profile.settle_ms * 1000000);
+    return 0;
+  });
+}
+
+int sony9pin_read_timecode(sony9pin_deck* deck, int source, sony9pin_timecode* tc) {
+  return call(deck, [deck, source, tc](string& error) {
+    auto& controller = deck->controller;
+    const auto& profile = deck->profile;
+    const char* what;
+    bool userbits = false;
+    switch (source) {
+      case SONY9PIN_TIMER1: controller.current_time_sense_timer1(); what = "timer1"; break;
+      case SONY9PIN_TIMER2: {
+        if (!profile.timer2) {
+          error = "timer2 is not supported by this device";
+          return 1;
+        }
+        controller.current_time_sense_timer2();
+        what = "timer2";
+        break;
+      }
+      case SONY9PIN_LTC: {
+        if (!profile.ltc) {
+          error = "ltc_tc_ub is not supported by this device";
+          return 1;
+        }
+        controller.current_time_sense_ltc_tc_ub();
+        what = "ltc_tc_ub";
+        userbits = true;
+        break;
+      }
+      case SONY9PIN_VITC: {
+        if (!profile.vitc) {
+          error = "vitc_tc_ub is not supported by this device";
+          return 1;
+        }
+        controller.current_time_sense_vitc_tc_ub();
+        what = "vitc_tc_ub";
+        userbits = true;
+        break;
+      }
+      default: {
+        error = "unknown timecode source " + to_string(source);
+        return 1;
+      }
+    }
+    if (auto result = receive(deck, what, error))
+      return result;
+    to_timecode(controller.timecode(), profile.fps, *tc);
+    if (userbits) {
+      const auto ub = controller.userbits();
+      memcpy(tc->userbits, ub.bytes, sizeof(tc->userbits));
+    }
+    return 0;
+  });
+}
+
+int sony9pin_monitor_start(sony9pin_deck* deck, uint32_t interval_ms, sony9pin_callback callback, void* user) {
+  if (!callback) {
+    lastError = "no callback";
+    return 1;
+  }
+  // First sample always reported
+  call(deck, [deck](string&) {
+    deck->has_last = false;
+    return 0;
+  });
+  {
+    lock_guard<mutex> lock(deck->queue_mutex);
+    deck->callback = callback;
+    deck->user = user;
+    deck->interval_ms = interval_ms;
+  }
+  deck->wake.notify_one();
+  return 0;
+}
+
+void sony9pin_monitor_stop(sony9pin_deck* deck) {
+  {
+    lock_guard<mutex> lock(deck->queue_mutex);
+    deck->callback = nullptr;
+  }
+  // Returns once any callback in progress is done
+  call(deck, [](string&) { return 0; });
+}
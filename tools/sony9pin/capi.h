@@ -0,0 +1,98 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef CAPI_H
+#define CAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface of libsony9pin, for in-process deck control from other
+// languages (see python/sony9pin.py). Every deck has its own worker thread
+// owning the serial port: calls may come from any thread and are run in
+// order. The worker is a QThread, QSerialPort needs one; a QCoreApplication
+// is created on the first sony9pin_open() if the process has none, an
+// event loop is not needed. Functions returning int return 0 on success and 1 on error, with
+// the message available from sony9pin_last_error() in the calling thread.
+
+#if defined(_WIN32) && defined(SONY9PIN_LIBRARY)
+#define SONY9PIN_API __declspec(dllexport)
+#elif defined(_WIN32)
+#define SONY9PIN_API __declspec(dllimport)
+#else
+#define SONY9PIN_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sony9pin_deck sony9pin_deck;
+
+typedef struct {
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint8_t frame;
+  uint8_t is_df;
+  uint8_t is_cf;
+  uint8_t userbits[4];  // LTC and VITC only, bytes as sent by the deck
+  int64_t frames;       // drop-frame aware frame count at the deck profile rate
+} sony9pin_timecode;
+
+typedef struct {
+  int64_t realtime_ms;  // host wall clock of the timecode reply
+  uint32_t status;      // bit i is sony9pin_status_name(i)
+  sony9pin_timecode tc; // timer1
+} sony9pin_sample;
+
+enum {
+  SONY9PIN_TIMER1 = 1,
+  SONY9PIN_TIMER2 = 2,
+  SONY9PIN_LTC = 3,
+  SONY9PIN_VITC = 4,
+};
+
+// Called from the deck worker thread, for the first sample and every
+// sample where the status or the timecode changed
+typedef void (*sony9pin_callback)(const sony9pin_sample* sample, void* user);
+
+SONY9PIN_API const char* sony9pin_last_error(void);
+
+// port is a name or an index as for the command line tool, NULL on error
+SONY9PIN_API sony9pin_deck* sony9pin_open(const char* port);
+SONY9PIN_API void sony9pin_close(sony9pin_deck* deck);
+
+// Status fields, same names as in continuous mode
+SONY9PIN_API size_t sony9pin_status_count(void);
+SONY9PIN_API const char* sony9pin_status_name(size_t bit);
+SONY9PIN_API int sony9pin_status(sony9pin_deck* deck, uint32_t* status);
+
+// make and model are copied to the caller's buffers, truncated to size and
+// nul terminated, empty if unknown. A buffer may be NULL with size 0.
+SONY9PIN_API int sony9pin_device_type(sony9pin_deck* deck, uint16_t* device_type, char* make, size_t make_size,
+                                      char* model, size_t model_size);
+SONY9PIN_API const char* sony9pin_profile_name(sony9pin_deck* deck);
+// Profile of a model of docs/_data/deck_profiles.csv, for a deck whose
+// device type does not tell it; fails if the model has no profile
+SONY9PIN_API int sony9pin_use_model(sony9pin_deck* deck, const char* model);
+SONY9PIN_API int sony9pin_fps(sony9pin_deck* deck);
+
+// command is one of the CLI transport commands: e, f, p, r, s, x, w
+SONY9PIN_API int sony9pin_transport(sony9pin_deck* deck, char command);
+SONY9PIN_API int sony9pin_cue(sony9pin_deck* deck, const char* timecode);
+SONY9PIN_API int sony9pin_read_timecode(sony9pin_deck* deck, int source, sony9pin_timecode* tc);
+
+// Polls status and timer1 every interval_ms (0 for back-to-back) until
+// stopped, commands can still be sent in between
+SONY9PIN_API int sony9pin_monitor_start(sony9pin_deck* deck, uint32_t interval_ms, sony9pin_callback callback, void* user);
+SONY9PIN_API void sony9pin_monitor_stop(sony9pin_deck* deck);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "capture.h"
+#include "rules.h"
+
+#include <QStringList>
+#include <csignal>
+
+using namespace std;
+
+bool Capture::set_signal(const string& target, string& error) {
+  return parse_signal_target(target, pid, signal, error);
+}
+
+bool Capture::start(const string& in, const string& out, string& error) {
+  if (pid) {
+#ifndef _WIN32
+    if (kill(pid, signal)) {
+      error = "can not signal process " + to_string(pid);
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  auto command = QString::fromStdString(program);
+  command.replace("%i", QString::fromStdString(in)).replace("%o", QString::fromStdString(out));
+  auto arguments = QProcess::splitCommand(command);
+  if (arguments.isEmpty()) {
+    error = "empty capture command";
+    return false;
+  }
+  const auto name = arguments.takeFirst();
+  // Left running after exit without an out point
+  if (out.empty()) {
+    if (!QProcess::startDetached(name, arguments)) {
+      error = "can not start " + name.toStdString();
+      return false;
+    }
+    return true;
+  }
+  process.start(name, arguments);
+  if (!process.waitForStarted()) {
+    error = "can not start " + name.toStdString();
+    return false;
+  }
+  return true;
+}
+
+bool Capture::stop(string& error) {
+  if (pid) {
+#ifndef _WIN32
+    if (kill(pid, signal)) {
+      error = "can not signal process " + to_string(pid);
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  // ffmpeg, dvrescue... finish the file on SIGTERM
+  process.terminate();
+  if (!process.waitForFinished(10000)) {
+    process.kill();
+    error = "capture did not stop, killed";
+    return false;
+  }
+  return true;
+}
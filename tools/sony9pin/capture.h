@@ -0,0 +1,34 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <QProcess>
+#include <string>
+
+// Capture program of a timecode-synchronized capture, either a command
+// line started at the in point (%i and %o replaced by the in and out
+// timecodes) and terminated at the out point, or a signal sent at both
+// points to a capture program already running and waiting for it. Without
+// an out point, a command outlives sony9pin.
+class Capture {
+public:
+  void set_command(const std::string& command) { program = command; }
+  bool set_signal(const std::string& target, std::string& error);
+  bool is_set() const { return !program.empty() || pid; }
+
+  bool start(const std::string& in, const std::string& out, std::string& error);
+  bool stop(std::string& error);
+
+private:
+  std::string program;
+  int pid = 0;
+  int signal = 0;
+  QProcess process;
+};
+
+#endif
@@ -0,0 +1,37 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "clock.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+Clock* injected = nullptr;
+
+}
+
+void set_clock(Clock* clock) {
+  injected = clock;
+}
+
+Stamp stamp_now() {
+  if (injected)
+    return injected->now();
+  Stamp stamp;
+  stamp.monotonic = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+  stamp.realtime = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+  return stamp;
+}
+
+void wait_until(int64_t monotonic) {
+  if (injected)
+    return injected->wait_until(monotonic);
+  this_thread::sleep_until(chrono::steady_clock::time_point(chrono::nanoseconds(monotonic)));
+}
@@ -0,0 +1,61 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <cstdint>
+
+// Host clock readings, taken as close as possible to the serial I/O.
+// monotonic is steady_clock (CLOCK_MONOTONIC on Linux), realtime is
+// system_clock (CLOCK_REALTIME), both in nanoseconds.
+struct Stamp {
+  int64_t monotonic = 0;
+  int64_t realtime = 0;
+};
+
+// Time source of the command and continuous mode logic: every deadline,
+// sleep and timestamp goes through it, so a test can swap the host clocks
+// for a VirtualClock and run hours of deck activity in no time.
+class Clock {
+public:
+  virtual ~Clock() {}
+  virtual Stamp now() = 0;
+  // Returns once monotonic reached the given time
+  virtual void wait_until(int64_t monotonic) = 0;
+};
+
+// Time that only moves when told to, by wait_until() or advance(): a
+// simulated serial port advances it to the arrival of a reply or to the
+// end of a read timeout. Single-threaded.
+class VirtualClock : public Clock {
+public:
+  explicit VirtualClock(int64_t realtime_origin = 0) : origin(realtime_origin) {}
+
+  Stamp now() override {
+    Stamp stamp;
+    stamp.monotonic = monotonic;
+    stamp.realtime = origin + monotonic;
+    return stamp;
+  }
+  void wait_until(int64_t time) override {
+    if (time > monotonic)
+      monotonic = time;
+  }
+  void advance(int64_t duration) { monotonic += duration; }
+
+private:
+  int64_t origin;
+  int64_t monotonic = 0;
+};
+
+// nullptr restores the host clocks
+void set_clock(Clock* clock);
+
+Stamp stamp_now();
+void wait_until(int64_t monotonic);
+
+#endif
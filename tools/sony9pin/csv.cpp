@@ -0,0 +1,65 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "csv.h"
+
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+
+string lower(string text) {
+  for (auto& c : text)
+    c = (char)tolower((unsigned char)c);
+  return text;
+}
+
+string trim(const string& text) {
+  const auto first = text.find_first_not_of(" \t\r\n");
+  if (first == string::npos)
+    return string();
+  return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+vector<string> split_list(const string& cell, char separator) {
+  vector<string> items;
+  istringstream in(cell);
+  string item;
+  while (getline(in, item, separator)) {
+    item = lower(trim(item));
+    if (!item.empty())
+      items.push_back(item);
+  }
+  return items;
+}
+
+bool read_record(istream& in, vector<string>& cells) {
+  cells.assign(1, string());
+  bool quoted = false;
+  char c;
+  if (in.peek() == EOF)
+    return false;
+  while (in.get(c)) {
+    if (quoted) {
+      if (c != '"')
+        cells.back() += c;
+      else if (in.peek() == '"')
+        cells.back() += (char)in.get();
+      else
+        quoted = false;
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      cells.emplace_back();
+    } else if (c == '\n') {
+      break;
+    } else if (c != '\r') {
+      cells.back() += c;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,25 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef CSV_H
+#define CSV_H
+
+#include <istream>
+#include <string>
+#include <vector>
+
+// The CSV files of docs/_data: decks.csv, deck_profiles.csv
+
+std::string lower(std::string text);
+std::string trim(const std::string& text);
+
+// Lower case items of a "DV; DVCAM" or "DSR-2000/ DSR-2000P" cell
+std::vector<std::string> split_list(const std::string& cell, char separator);
+
+// RFC 4180 record, quoted cells may hold separators, quotes and new lines
+bool read_record(std::istream& in, std::vector<std::string>& cells);
+
+#endif
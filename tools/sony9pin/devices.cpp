@@ -10,6 +10,8 @@
 #include <vector>
 #include <map>
 
+#include "Sony9PinRemote/Sony9PinRemote.h"
+
 std::map<uint16_t, std::pair<std::string, std::vector<std::string>>> devices = {
   { 0x0001, { "SONY", { "BVH-2000" } } },
   { 0x0010, { "SONY", { "BVH-2000" } } },
@@ -315,3 +317,34 @@ std::map<uint16_t, std::pair<std::string, std::vector<std::string>>> devices = {
   { 0xf01d, { "TASCAM", { "DA-88", "DA-98", "DA-98HR", "DS-D98" } } },
   { 0xfe01, { "Drastic", { "VVCR" } } }
 };
+
+void device_make_model(uint16_t device_type, std::string& device_make, std::string& device_model) {
+  switch (device_type) {
+    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_NTSC: {
+      device_make = "Blackmagic";
+      device_model = "Hyperdeck Studio Mini, NTSC";
+      break;
+    }
+    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_PAL: {
+      device_make = "Blackmagic";
+      device_model = "Hyperdeck Studio Mini, PAL";
+      break;
+    }
+    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_24P: {
+      device_make = "Blackmagic";
+      device_model = "Hyperdeck Studio Mini, 24P";
+      break;
+    default:
+      if (devices.find(device_type) != devices.end())
+      {
+        device_make = devices[device_type].first;
+        for (auto model : devices[device_type].second)
+        {
+            if (!device_model.empty())
+              device_model += ", ";
+            device_model += model;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,310 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QStringList>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sidecar.h"
+#include "timecode.h"
+
+using namespace std;
+
+namespace {
+
+// One continuous mode line: wall clock time, tape timecode, play state
+struct Sample {
+  int64_t realtime_ms;
+  int64_t frames;
+  bool play;
+};
+
+// Tape played with the timecode running at play speed, first and last
+// sample of the run
+struct Segment {
+  Sample first;
+  Sample last;
+};
+
+int fps = 30;
+bool ndf = false;
+int64_t rateNum = 30000, rateDen = 1001;
+int64_t tapeNum = 30000, tapeDen = 1001;
+
+// Status fields are only printed when they change, play is carried over
+// from line to line
+bool read_log(istream& in, vector<Sample>& samples, bool& play) {
+  string line;
+  while (getline(in, line)) {
+    istringstream fields(line);
+    string date, tc;
+    if (!(fields >> date >> tc))
+      continue;
+    const auto time = QDateTime::fromString(QString::fromStdString(date), Qt::ISODateWithMs);
+    if (!time.isValid())
+      continue;
+    // Continuous mode prints ';' whatever the tape, the drop-frame mode is
+    // an option
+    if (ndf || fps != 30) {
+      for (auto& c : tc) {
+        if (c == ';')
+          c = ':';
+      }
+    }
+    Timecode timecode;
+    if (!Timecode::parse(tc.c_str(), tc.size(), fps, timecode))
+      continue;
+    string field;
+    while (fields >> field) {
+      if (field == "play=1")
+        play = true;
+      else if (field == "play=0")
+        play = false;
+    }
+    samples.push_back({ time.toMSecsSinceEpoch(), timecode.frames(), play });
+  }
+  return !in.bad();
+}
+
+// A segment runs while the deck plays and each timecode step matches the
+// wall clock time between the samples, within 2 frames or 10%. A timecode
+// standing still for up to 500 ms (poll hiccup, servo) does not end it.
+vector<Segment> find_segments(const vector<Sample>& samples) {
+  const int64_t stall_ms = 500;
+
+  vector<Segment> segments;
+  bool open = false;
+  Segment segment = {};
+  int64_t lastAdvance = 0;
+  for (size_t i = 1; i < samples.size(); i++) {
+    const auto& previous = samples[i - 1];
+    const auto& sample = samples[i];
+    const auto elapsed = sample.realtime_ms - previous.realtime_ms;
+    const auto expected = elapsed * tapeNum / (tapeDen * 1000);
+    const auto delta = sample.frames - previous.frames;
+    const auto tolerance = max<int64_t>(2, expected / 10);
+    const bool playing = previous.play && sample.play;
+
+    if (playing && delta > 0 && llabs(delta - expected) <= tolerance) {
+      if (!open) {
+        segment.first = previous;
+        open = true;
+      }
+      segment.last = sample;
+      lastAdvance = sample.realtime_ms;
+    } else if (open && !(playing && delta == 0 && sample.realtime_ms - lastAdvance <= stall_ms)) {
+      segments.push_back(segment);
+      open = false;
+    }
+  }
+  if (open)
+    segments.push_back(segment);
+  return segments;
+}
+
+string quote(const string& text) {
+  string quoted = "'";
+  for (const auto c : text) {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + '\'';
+}
+
+string format_timecode(int64_t frames, int rate, bool df) {
+  char text[Timecode::format_size];
+  Timecode(frames, rate, df).format(text);
+  return text;
+}
+
+void usage(const string& commandName) {
+  cerr << "Usage: " << commandName << " --start=<ISO 8601 date> [option] [<continuous mode log>...]\n"
+       << "Program segments (play with the timecode running) of continuous mode output, as a CMX3600 EDL\n"
+       << "and as ffmpeg stream copy commands, for a capture started at the given time. Logs are read in\n"
+       << "the given order, from stdin if none.\n"
+       << "Options:\n"
+       << "--start=<ISO 8601 date>: wall clock time of capture frame 0\n"
+       << "--rate=<fps>: capture frame rate (default 30000/1001)\n"
+       << "--fps=<fps>: nominal frame rate of the tape timecode (default 30)\n"
+       << "--ndf: tape timecode is non-drop frame\n"
+       << "--min=<seconds>: shortest segment kept (default 1)\n"
+       << "--reel=<name>: EDL source reel (default AX)\n"
+       << "--title=<title>: EDL title (default capture file name)\n"
+       << "--capture=<file>: capture file of the ffmpeg commands (default capture.mov)\n"
+       << "--edl=<file>: write the EDL to this file (default stdout)\n"
+       << "--ffmpeg=<file>: write one ffmpeg command per segment to this file, - for stdout\n"
+       << "Points are as accurate as the log times (one poll); stream copy cuts are exact for intra-frame\n"
+       << "codecs (FFV1, ProRes, v210...), other codecs cut at the previous keyframe.\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  QCoreApplication coreApplication(argc, argv);
+  QStringList argumentList = QCoreApplication::arguments();
+
+  QString commandName;
+  if (!argumentList.isEmpty())
+    commandName = argumentList.takeFirst();
+
+  QString start, reel = "AX", title, capture = "capture.mov", edlName, ffmpegName;
+  double minSeconds = 1;
+  while (!argumentList.isEmpty() && argumentList.first().startsWith("--")) {
+    const auto argument = argumentList.takeFirst();
+    bool ok = true;
+    if (argument.startsWith("--start=")) {
+      start = argument.mid(8);
+    } else if (argument.startsWith("--rate=")) {
+      ok = parse_frame_rate(argument.mid(7).toStdString(), rateNum, rateDen);
+    } else if (argument.startsWith("--fps=")) {
+      fps = argument.mid(6).toInt(&ok);
+      ok = ok && fps > 0 && fps <= 60;
+    } else if (argument == "--ndf") {
+      ndf = true;
+    } else if (argument.startsWith("--min=")) {
+      minSeconds = argument.mid(6).toDouble(&ok);
+    } else if (argument.startsWith("--reel=")) {
+      reel = argument.mid(7);
+    } else if (argument.startsWith("--title=")) {
+      title = argument.mid(8);
+    } else if (argument.startsWith("--capture=")) {
+      capture = argument.mid(10);
+    } else if (argument.startsWith("--edl=")) {
+      edlName = argument.mid(6);
+    } else if (argument.startsWith("--ffmpeg=")) {
+      ffmpegName = argument.mid(9);
+    } else {
+      usage(commandName.toStdString());
+      return 1;
+    }
+    if (!ok) {
+      cerr << "Error: invalid " << argument.toStdString() << ".\n";
+      return 1;
+    }
+  }
+
+  const auto startTime = QDateTime::fromString(start, Qt::ISODateWithMs);
+  if (start.isEmpty() || !startTime.isValid()) {
+    usage(commandName.toStdString());
+    return 1;
+  }
+  const int64_t startMs = startTime.toMSecsSinceEpoch();
+  // Tape plays at 29.97 for 30 fps timecode
+  tapeNum = fps == 30 ? 30000 : fps;
+  tapeDen = fps == 30 ? 1001 : 1;
+
+  vector<Sample> samples;
+  bool play = false;
+  if (argumentList.isEmpty()) {
+    read_log(cin, samples, play);
+  }
+  for (const auto& name : argumentList) {
+    ifstream file(name.toStdString());
+    if (!file || !read_log(file, samples, play)) {
+      cerr << "Error: can not read " << name.toStdString() << ".\n";
+      return 1;
+    }
+  }
+
+  // Capture frames, and record timecode at the nominal capture rate
+  const int recordFps = (int)((rateNum + rateDen / 2) / rateDen);
+  const bool recordDf = rateDen == 1001 && recordFps == 30 && !ndf;
+  const bool tapeDf = fps == 30 && !ndf;
+  const auto capture_frame = [&](int64_t realtime_ms) {
+    return ((realtime_ms - startMs) * rateNum + rateDen * 500) / (rateDen * 1000);
+  };
+
+  ofstream edlFile, ffmpegFile;
+  if (!edlName.isEmpty()) {
+    edlFile.open(edlName.toStdString());
+    if (!edlFile) {
+      cerr << "Error: can not write " << edlName.toStdString() << ".\n";
+      return 1;
+    }
+  }
+  if (!ffmpegName.isEmpty() && ffmpegName != "-") {
+    ffmpegFile.open(ffmpegName.toStdString());
+    if (!ffmpegFile) {
+      cerr << "Error: can not write " << ffmpegName.toStdString() << ".\n";
+      return 1;
+    }
+  }
+  const bool edlToStdout = edlName.isEmpty() && ffmpegName != "-";
+  ostream& edl = edlToStdout ? cout : edlFile;
+  ostream& ffmpeg = ffmpegName == "-" ? cout : ffmpegFile;
+  const bool writeEdl = edlToStdout || edlFile.is_open();
+  const bool writeFfmpeg = !ffmpegName.isEmpty();
+
+  const QFileInfo captureInfo(capture);
+  if (title.isEmpty())
+    title = captureInfo.completeBaseName();
+  if (writeEdl) {
+    edl << "TITLE: " << title.toStdString() << '\n'
+        << "FCM: " << (tapeDf ? "DROP FRAME" : "NON-DROP FRAME") << "\n\n";
+  }
+
+  int event = 0;
+  int64_t totalFrames = 0;
+  for (const auto& segment : find_segments(samples)) {
+    // Out points are exclusive, one frame after the last sample. The
+    // record in is placed by the wall clock, the record duration is the
+    // source one at the capture rate, so both sides of an event match
+    const auto record_frames = [](int64_t source_frames) {
+      return (source_frames * rateNum * tapeDen + rateDen * tapeNum / 2) / (rateDen * tapeNum);
+    };
+    auto in = capture_frame(segment.first.realtime_ms);
+    auto sourceIn = segment.first.frames;
+    const auto sourceOut = segment.last.frames + 1;
+    if (in + record_frames(sourceOut - sourceIn) <= 0) {
+      cerr << "Info: segment before the capture start skipped.\n";
+      continue;
+    }
+    if (in < 0) {
+      // Started before the capture, keep the captured part
+      sourceIn += (-in * rateDen * tapeNum + rateNum * tapeDen / 2) / (rateNum * tapeDen);
+      in = 0;
+    }
+    const auto out = in + record_frames(sourceOut - sourceIn);
+    if ((out - in) * rateDen < minSeconds * rateNum)
+      continue;
+    event++;
+    totalFrames += out - in;
+
+    if (writeEdl) {
+      char line[128];
+      snprintf(line, sizeof(line), "%03d  %-8.8s AA/V  C        %s %s %s %s\n", event, reel.toStdString().c_str(),
+               format_timecode(sourceIn, fps, tapeDf).c_str(), format_timecode(sourceOut, fps, tapeDf).c_str(),
+               format_timecode(in, recordFps, recordDf).c_str(), format_timecode(out, recordFps, recordDf).c_str());
+      edl << line << "* FROM CLIP NAME: " << captureInfo.fileName().toStdString() << '\n';
+    }
+    if (writeFfmpeg) {
+      char times[64];
+      snprintf(times, sizeof(times), "-ss %.6f", (double)in * rateDen / rateNum);
+      char duration[64];
+      snprintf(duration, sizeof(duration), "-t %.6f", (double)(out - in) * rateDen / rateNum);
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "_%03d.", event);
+      const auto output = captureInfo.path().toStdString() + '/' + captureInfo.completeBaseName().toStdString() + suffix
+                          + captureInfo.suffix().toStdString();
+      ffmpeg << "ffmpeg -nostdin " << times << " -i " << quote(capture.toStdString()) << ' ' << duration
+             << " -map 0 -c copy " << quote(output) << '\n';
+    }
+  }
+
+  cerr << "Info: " << samples.size() << " samples, " << event << " segments, "
+       << format_timecode(totalFrames, recordFps, recordDf) << " in total.\n";
+  return 0;
+}
@@ -0,0 +1,15 @@
+TEMPLATE = app
+TARGET = sony9pin_edl
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QT -= gui
+
+# Lib
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../sidecar.h \
+           ../timecode.h
+
+SOURCES += edl.cpp \
+           ../sidecar.cpp
@@ -0,0 +1,259 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "format.h"
+#include "timecode.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace std;
+
+const StatusDataBit extended_status_bits[] = {
+  { "in_set", 3, 0 },
+  { "out_set", 3, 1 },
+  { "audio_in_set", 3, 2 },
+  { "audio_out_set", 3, 3 },
+  { "cf_mode", 3, 4 },
+  { "freeze_on", 3, 6 },
+  { "auto_mode", 3, 7 },
+  { "preroll", 4, 0 },
+  { "preview", 4, 1 },
+  { "auto_edit", 4, 2 },
+  { "review", 4, 3 },
+  { "edit", 4, 4 },
+  { "full_ee", 4, 6 },
+  { "select_ee", 4, 7 },
+  { "a1", 5, 0 },
+  { "a2", 5, 1 },
+  { "a3", 5, 2 },
+  { "a4", 5, 3 },
+  { "video", 5, 4 },
+  { "assemble", 5, 5 },
+  { "insert", 5, 6 },
+  { "search_led_1", 6, 0 },
+  { "search_led_2", 6, 1 },
+  { "search_led_4", 6, 2 },
+  { "search_led_8", 6, 3 },
+  { "in_out", 7, 0 },
+  { "spot_erase", 7, 2 },
+  { "sync_act", 7, 4 },
+  { "aud_split", 7, 5 },
+  { "lost_lock", 8, 5 },
+  { "buzzer", 8, 7 },
+  { "fnc_abort", 9, 6 },
+};
+const size_t extended_status_bit_count = sizeof(extended_status_bits) / sizeof(*extended_status_bits);
+
+uint8_t decode_status_data(const uint8_t* frame, size_t size, uint8_t* data) {
+  if (size < 3 || (frame[0] & 0xF0) != 0x70 || frame[1] != 0x20)
+    return 0;
+  const uint8_t count = min<size_t>(min<size_t>(frame[0] & 0x0F, size - 3), status_data_size);
+  for (uint8_t i = 0; i < count; i++)
+    data[i] = frame[2 + i];
+  return count;
+}
+
+bool operator!=(const sony9pin::TimeCode& first, const sony9pin::TimeCode& second) {
+  // Non-drop frame counts are one-to-one with in-range fields
+  return first.is_cf != second.is_cf ||
+         first.is_df != second.is_df ||
+         Timecode::from_fields(first.hour, first.minute, first.second, first.frame, 30) !=
+         Timecode::from_fields(second.hour, second.minute, second.second, second.frame, 30);
+}
+
+void format_timecode_userbits(ostream& out, const Sony9PinRemote::TimeCode& tc, const Sony9PinRemote::UserBits* ub)
+{
+  out << "TimeCode: " << dec
+      << setw(2) << setfill('0') << (unsigned int)tc.hour << ':'
+      << setw(2) << setfill('0') << (unsigned int)tc.minute << ':'
+      << setw(2) << setfill('0') << (unsigned int)tc.second << ';'
+      << setw(2) << setfill('0') << (unsigned int)tc.frame << ' '
+      << "CF: " << (unsigned int)tc.is_cf << ' '
+      << "DF: " << (unsigned int)tc.is_df
+      << resetiosflags(std::ios::dec);
+
+  if (ub) {
+    out << " UB: ";
+    format_userbits(out, *ub);
+  }
+
+  out << '\n';
+}
+
+void format_userbits(ostream& out, const Sony9PinRemote::UserBits& ub)
+{
+  out << hex << uppercase
+      << setw(2) << setfill('0') << (unsigned int)ub.bytes[3] << ':'
+      << setw(2) << setfill('0') << (unsigned int)ub.bytes[2] << ':'
+      << setw(2) << setfill('0') << (unsigned int)ub.bytes[1] << ':'
+      << setw(2) << setfill('0') << (unsigned int)ub.bytes[0]
+      << resetiosflags(std::ios::hex|std::ios::uppercase);
+}
+
+bool format_state(ostream& out, const State& state, const State& last, bool first)
+{
+  bool print = false;
+
+  out << dec << ' '
+      << setw(2) << setfill('0') << (unsigned int)state.tc.hour << ':'
+      << setw(2) << setfill('0') << (unsigned int)state.tc.minute << ':'
+      << setw(2) << setfill('0') << (unsigned int)state.tc.second << ';'
+      << setw(2) << setfill('0') << (unsigned int)state.tc.frame
+      << resetiosflags(std::ios::dec);
+
+  if (first || state.tc != last.tc) {
+    print = true;
+  }
+
+  if (first || state.st.b_cassette_out != last.st.b_cassette_out) {
+    out << " cassette_out=" << (unsigned int)state.st.b_cassette_out;
+    print = true;
+  }
+
+  if (first || state.st.b_servo_ref_missing != last.st.b_servo_ref_missing) {
+    out << " servo_ref_missing=" << (unsigned int)state.st.b_servo_ref_missing;
+    print = true;
+  }
+
+  if (first || state.st.b_local != last.st.b_local) {
+    out << " local=" << (unsigned int)state.st.b_local;
+    print = true;
+  }
+
+  if (first || state.st.b_standby != last.st.b_standby) {
+    out << " standby=" << (unsigned int)state.st.b_standby;
+    print = true;
+  }
+
+  if (first || state.st.b_stop != last.st.b_stop) {
+    out << " stop=" << (unsigned int)state.st.b_stop;
+    print = true;
+  }
+
+  if (first || state.st.b_eject != last.st.b_eject) {
+    out << " eject=" << (unsigned int)state.st.b_eject;
+    print = true;
+  }
+
+  if (first || state.st.b_rewind != last.st.b_rewind) {
+    out << " rewind=" << (unsigned int)state.st.b_rewind;
+    print = true;
+  }
+
+  if (first || state.st.b_forward != last.st.b_forward) {
+    out << " forward=" << (unsigned int)state.st.b_forward;
+    print = true;
+  }
+
+  if (first || state.st.b_record != last.st.b_record) {
+    out << " record=" << (unsigned int)state.st.b_record;
+    print = true;
+  }
+
+  if (first || state.st.b_play != last.st.b_play) {
+    out << " play=" << (unsigned int)state.st.b_play;
+    print = true;
+  }
+
+  if (first || state.st.b_servo_lock != last.st.b_servo_lock) {
+    out << " servo_lock=" << (unsigned int)state.st.b_servo_lock;
+    print = true;
+  }
+
+  if (first || state.st.b_tso_mode != last.st.b_tso_mode) {
+    out << " tso_mode=" << (unsigned int)state.st.b_tso_mode;
+    print = true;
+  }
+
+  if (first || state.st.b_shuttle != last.st.b_shuttle) {
+    out << " shuttle=" << (unsigned int)state.st.b_shuttle;
+    print = true;
+  }
+
+  if (first || state.st.b_jog != last.st.b_jog) {
+    out << " jog=" << (unsigned int)state.st.b_jog;
+    print = true;
+  }
+
+  if (first || state.st.b_var != last.st.b_var) {
+    out << " var=" << (unsigned int)state.st.b_var;
+    print = true;
+  }
+
+  if (first || state.st.b_direction != last.st.b_direction) {
+    out << " direction=" << (unsigned int)state.st.b_direction;
+    print = true;
+  }
+
+  if (first || state.st.b_still != last.st.b_still) {
+    out << " still=" << (unsigned int)state.st.b_still;
+    print = true;
+  }
+
+  if (first || state.st.b_cue_up != last.st.b_cue_up) {
+    out << " cue_up=" << (unsigned int)state.st.b_cue_up;
+    print = true;
+  }
+
+  if (first || state.st.b_lamp_still != last.st.b_lamp_still) {
+    out << " lamp_still=" << (unsigned int)state.st.b_lamp_still;
+    print = true;
+  }
+
+  if (first || state.st.b_lamp_fwd != last.st.b_lamp_fwd) {
+    out << " lamp_fwd=" << (unsigned int)state.st.b_lamp_fwd;
+    print = true;
+  }
+
+  if (first || state.st.b_lamp_rev != last.st.b_lamp_rev) {
+    out << " lamp_rev=" << (unsigned int)state.st.b_lamp_rev;
+    print = true;
+  }
+
+  if (first || state.st.b_near_eot != last.st.b_near_eot) {
+    out << " near_eot=" << (unsigned int)state.st.b_near_eot;
+    print = true;
+  }
+
+  if (first || state.st.b_eot != last.st.b_eot) {
+    out << " eot=" << (unsigned int)state.st.b_eot;
+    print = true;
+  }
+
+  if (first || state.st.b_cf_lock != last.st.b_cf_lock) {
+    out << " cf_lock=" << (unsigned int)state.st.b_cf_lock;
+    print = true;
+  }
+
+  if (first || state.st.b_svo_alarm != last.st.b_svo_alarm) {
+    out << " svo_alarm=" << (unsigned int)state.st.b_svo_alarm;
+    print = true;
+  }
+
+  if (first || state.st.b_sys_alarm != last.st.b_sys_alarm) {
+    out << " sys_alarm=" << (unsigned int)state.st.b_sys_alarm;
+    print = true;
+  }
+
+  if (first || state.st.b_rec_inhib != last.st.b_rec_inhib) {
+    out << " rec_inhib=" << (unsigned int)state.st.b_rec_inhib;
+    print = true;
+  }
+
+  for (size_t i = 0; i < extended_status_bit_count; i++) {
+    const auto& bit = extended_status_bits[i];
+    if (bit.byte >= state.data_size)
+      continue;
+    const unsigned int value = (state.data[bit.byte] >> bit.bit) & 1;
+    if (first || bit.byte >= last.data_size || value != ((last.data[bit.byte] >> bit.bit) & 1u)) {
+      out << ' ' << bit.name << '=' << value;
+      print = true;
+    }
+  }
+
+  return print;
+}
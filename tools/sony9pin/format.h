@@ -0,0 +1,55 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+
+// Status data bytes of a full status_sense(0, status_data_size) reply
+const uint8_t status_data_size = 10;
+
+// Documented status bits Sony9PinRemote::Status does not decode: edit
+// presets and modes, audio/video channels, search speed lamps, servo and
+// function details
+struct StatusDataBit {
+  const char* name;
+  uint8_t byte;
+  uint8_t bit;
+};
+extern const StatusDataBit extended_status_bits[];
+extern const size_t extended_status_bit_count;
+
+struct State {
+  Sony9PinRemote::TimeCode tc;
+  Sony9PinRemote::Status st;
+  uint8_t data[status_data_size];  // raw status data, data_size bytes from data 0
+  uint8_t data_size;
+};
+
+// Raw status data of a status sense reply frame (CMD1 0x7n, CMD2 0x20),
+// returns the number of bytes copied, 0 if the frame is not a status reply
+uint8_t decode_status_data(const uint8_t* frame, size_t size, uint8_t* data);
+
+bool operator!=(const sony9pin::TimeCode& first, const sony9pin::TimeCode& second);
+
+// "TimeCode: HH:MM:SS;FF CF: x DF: x[ UB: xx:xx:xx:xx]\n", user bits only
+// if ub is set
+void format_timecode_userbits(std::ostream& out, const Sony9PinRemote::TimeCode& tc, const Sony9PinRemote::UserBits* ub);
+
+// "XX:XX:XX:XX", most significant byte first
+void format_userbits(std::ostream& out, const Sony9PinRemote::UserBits& ub);
+
+// Continuous mode line: timecode then every status field, then every
+// extended status bit the deck returned, that changed since last (all of
+// them if first), returns true if anything changed
+bool format_state(std::ostream& out, const State& state, const State& last, bool first);
+
+#endif
@@ -0,0 +1,89 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "frame.h"
+
+#include <cstring>
+
+namespace {
+
+// System control, transport, preset/select, sense request and their returns
+bool is_command_class(uint8_t cmd1) {
+  switch (cmd1 >> 4) {
+    case 0x0:
+    case 0x1:
+    case 0x2:
+    case 0x4:
+    case 0x6:
+    case 0x7:
+    case 0xA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}
+
+bool FrameDecoder::feed(uint8_t byte) {
+  if (frame_size) {
+    used -= frame_size;
+    memmove(buffer, buffer + frame_size, used);
+    frame_size = 0;
+  }
+  buffer[used++] = byte;
+  return scan();
+}
+
+bool FrameDecoder::next() {
+  if (frame_size) {
+    used -= frame_size;
+    memmove(buffer, buffer + frame_size, used);
+    frame_size = 0;
+  }
+  return scan();
+}
+
+void FrameDecoder::reset() {
+  used = 0;
+  frame_size = 0;
+  skipped = 0;
+}
+
+bool FrameDecoder::scan() {
+  while (used) {
+    const size_t size = 3 + (buffer[0] & 0x0F);
+    if (is_command_class(buffer[0])) {
+      if (used < size)
+        return false;
+      uint8_t checksum = 0;
+      for (size_t i = 0; i < size - 1; i++)
+        checksum += buffer[i];
+      if (checksum == buffer[size - 1]) {
+        frame_size = size;
+        return true;
+      }
+    }
+
+    // Not a frame start, try from the next byte
+    used--;
+    memmove(buffer, buffer + 1, used);
+    skipped++;
+  }
+  return false;
+}
+
+size_t encode_frame(uint8_t* out, uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t count) {
+  out[0] = (cmd1 & 0xF0) | (uint8_t)count;
+  out[1] = cmd2;
+  uint8_t checksum = out[0] + out[1];
+  for (size_t i = 0; i < count; i++) {
+    out[2 + i] = data[i];
+    checksum += data[i];
+  }
+  out[2 + count] = checksum;
+  return count + 3;
+}
@@ -0,0 +1,50 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Incremental Sony 9-pin frame decoder: CMD1 (class in the high nibble,
+// data count in the low nibble), CMD2, data, checksum (sum of the previous
+// bytes modulo 256). Bytes that can not start a valid frame are skipped
+// one at a time, so after garbage the decoder is back in sync at most
+// max_size - 1 bytes into the first intact frame, and each input byte is
+// examined at most max_size times.
+class FrameDecoder {
+public:
+  static const size_t max_size = 3 + 15;
+
+  // Adds one byte, returns true if a valid frame is now available
+  bool feed(uint8_t byte);
+  // Looks for another frame in the bytes already buffered
+  bool next();
+  void reset();
+
+  // Valid until the next feed(), next() or reset()
+  const uint8_t* data() const { return buffer; }
+  size_t size() const { return frame_size; }
+
+  // Bytes skipped while resynchronizing since the last reset()
+  uint64_t discarded() const { return skipped; }
+  // Bytes buffered, not yet part of a frame
+  size_t pending() const { return used - frame_size; }
+
+private:
+  bool scan();
+
+  uint8_t buffer[max_size];
+  size_t used = 0;
+  size_t frame_size = 0;
+  uint64_t skipped = 0;
+};
+
+// Writes CMD1 | count, CMD2, data, checksum to out (count + 3 bytes)
+size_t encode_frame(uint8_t* out, uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t count);
+
+#endif
@@ -0,0 +1,24 @@
+TEMPLATE = app
+TARGET = sony9pin_fuzz
+CONFIG += c++14 console
+CONFIG -= qt app_bundle
+
+# qmake CONFIG+=libfuzzer (clang) for a libFuzzer build, standalone driver
+# otherwise
+libfuzzer {
+  DEFINES += SONY9PIN_LIBFUZZER
+  QMAKE_CXXFLAGS += -fsanitize=fuzzer,address
+  QMAKE_LFLAGS += -fsanitize=fuzzer,address
+}
+
+# Lib
+INCLUDEPATH += ..
+
+# Input
+HEADERS += ../clock.h \
+           ../frame.h \
+           ../link.h
+
+SOURCES += fuzz_frame.cpp \
+           ../clock.cpp \
+           ../frame.cpp
@@ -0,0 +1,181 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+// Fuzz target for the 9-pin reply framing used by sony9pin before the
+// controller parses a reply: the frame decoder, and Link::wait() on a port
+// holding one reply behind garbage. Built with libFuzzer (qmake CONFIG+=libfuzzer,
+// clang) or with the standalone driver below, which replays files given on
+// the command line or runs seeded random streams.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "frame.h"
+#include "link.h"
+
+using namespace std;
+
+namespace {
+
+// Replies sony9pin waits for: ack, NAK, device type, status, timer1, LTC+UB
+const uint8_t replies[][FrameDecoder::max_size] = {
+  { 0x10, 0x01, 0x11 },
+  { 0x11, 0x12, 0x01, 0x24 },
+  { 0x12, 0x11, 0xF0, 0x1D, 0x30 },
+  { 0x7A, 0x20, 0x00, 0x01, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1B },
+  { 0x74, 0x04, 0x12, 0x34, 0x56, 0x01, 0x15 },
+  { 0x78, 0x05, 0x12, 0x34, 0x56, 0x01, 0x11, 0x22, 0x33, 0x44, 0xC4 },
+};
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "Error: check failed: %s (line %d).\n", #condition, __LINE__); \
+      abort(); \
+    } \
+  } while (0)
+
+void check_frame(const uint8_t* frame, size_t size) {
+  CHECK(size >= 3 && size <= FrameDecoder::max_size);
+  CHECK(size == 3 + (size_t)(frame[0] & 0x0F));
+  uint8_t checksum = 0;
+  for (size_t i = 0; i + 1 < size; i++)
+    checksum += frame[i];
+  CHECK(checksum == frame[size - 1]);
+}
+
+void check_frame(const FrameDecoder& decoder) {
+  check_frame(decoder.data(), decoder.size());
+}
+
+// Every byte already received, the line idle after them
+class MemoryPort {
+public:
+  explicit MemoryPort(const vector<uint8_t>& bytes) : bytes(bytes) {}
+  int64_t write(const char*, int64_t size) { return size; }
+  int64_t peek(char* data, int64_t size) {
+    const auto count = min<int64_t>(size, bytes.size() - offset);
+    memcpy(data, bytes.data() + offset, count);
+    return count;
+  }
+  int64_t read(char* data, int64_t size) {
+    const auto count = peek(data, size);
+    offset += count;
+    return count;
+  }
+  bool waitForReadyRead(int) { return false; }
+
+  size_t offset = 0;
+
+private:
+  vector<uint8_t> bytes;
+};
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (!size)
+    return 0;
+
+  // Every byte ends up in a frame, skipped, or still pending
+  FrameDecoder decoder;
+  uint64_t framed = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (!decoder.feed(data[i]))
+      continue;
+    do {
+      check_frame(decoder);
+      framed += decoder.size();
+    } while (decoder.next());
+  }
+  CHECK(decoder.pending() < FrameDecoder::max_size);
+  CHECK(framed + decoder.discarded() + decoder.pending() == size);
+
+  // Back in sync on intact replies following the garbage: at most
+  // max_size - 1 bytes are pending, and a false frame start is rejected
+  // once max_size bytes from it are in, so a bounded number of bytes
+  // later a reply is decoded exactly
+  const auto& reply = replies[data[0] % (sizeof(replies) / sizeof(replies[0]))];
+  const size_t reply_size = 3 + (reply[0] & 0x0F);
+  const size_t copies = (2 * FrameDecoder::max_size) / reply_size + 2;
+  bool found = false;
+  for (size_t copy = 0; copy < copies && !found; copy++) {
+    for (size_t i = 0; i < reply_size && !found; i++) {
+      if (!decoder.feed(reply[i]))
+        continue;
+      do {
+        check_frame(decoder);
+        found = decoder.size() == reply_size && !memcmp(decoder.data(), reply, reply_size);
+      } while (!found && decoder.next());
+    }
+  }
+  CHECK(found);
+
+  // Link::wait() on the garbage (less than a frame of it, more is given up
+  // on as a corrupted reply) then exactly one reply, nothing after: the
+  // reply is found, unless a frame in the garbage ran into it
+  vector<uint8_t> line(data, data + min(size, FrameDecoder::max_size - 1));
+  const size_t garbage = line.size();
+  line.insert(line.end(), reply, reply + reply_size);
+  MemoryPort port(line);
+  Link<MemoryPort> link(port);
+  found = false;
+  bool overlapped = false;
+  while (!found && !overlapped && link.wait(1000)) {
+    check_frame(link.frame(), link.frame_size());
+    const auto start = port.offset;
+    CHECK(!memcmp(line.data() + start, link.frame(), link.frame_size()));
+    found = start == garbage && link.frame_size() == reply_size;
+    overlapped = start < garbage && start + link.frame_size() > garbage;
+    char bytes[FrameDecoder::max_size];
+    port.read(bytes, link.frame_size());
+  }
+  CHECK(found || overlapped);
+
+  return 0;
+}
+
+#ifndef SONY9PIN_LIBFUZZER
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      ifstream file(argv[i], ios::binary);
+      const vector<uint8_t> input((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+      LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    fprintf(stderr, "Info: %d inputs OK.\n", argc - 1);
+    return 0;
+  }
+
+  // Random streams, half of them made of valid replies with corrupted bytes
+  mt19937 random(9);
+  vector<uint8_t> input;
+  const int runs = 200000;
+  for (int run = 0; run < runs; run++) {
+    input.clear();
+    const size_t size = 1 + random() % 256;
+    while (input.size() < size) {
+      if (run % 2) {
+        const auto& reply = replies[random() % (sizeof(replies) / sizeof(replies[0]))];
+        input.insert(input.end(), reply, reply + 3 + (reply[0] & 0x0F));
+        if (random() % 4 == 0)
+          input[random() % input.size()] ^= 1 << (random() % 8);
+      } else {
+        input.push_back((uint8_t)random());
+      }
+    }
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+  }
+  fprintf(stderr, "Info: %d random inputs OK.\n", runs);
+  return 0;
+}
+#endif
@@ -0,0 +1,338 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "gang.h"
+
+#include <QSerialPort>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "clock.h"
+#include "link.h"
+#include "profiles.h"
+#include "timecode.h"
+#include "trace.h"
+
+using namespace std;
+
+extern int open_port(QSerialPort& port, const QString& serialPortName, bool verbose);
+
+namespace {
+
+struct GangDeck {
+  QString name;
+  QSerialPort port;
+  Sony9PinRemote::Controller controller;
+  DeckProfile profile;
+  Stamp tx;
+  int tid;
+};
+
+typedef vector<unique_ptr<GangDeck>> Gang;
+
+const int lock_timeout_ms = 10000;
+
+// Play speed of the timecode, 29.97 for 30 fps
+double play_fps(int fps) {
+  return fps == 30 ? 30000.0 / 1001 : fps;
+}
+
+// Sense commands reply with data: only a NAK or no reply fails them
+bool gang_sense(GangDeck& deck) {
+  return deck.controller.parse_until(deck.profile.response_timeout_ms) && !is_nak(deck.controller);
+}
+
+bool gang_status(GangDeck& deck) {
+  TraceSpan span("status_sense", deck.tid);
+  deck.controller.status_sense();
+  if (!gang_sense(deck)) {
+    cerr << "Error: " << deck.name.toStdString() << ": get device status failed.\n";
+    return false;
+  }
+  return true;
+}
+
+// Profile of every deck, all at the same frame rate unless forced
+bool gang_identify(Gang& decks, int& fps) {
+  for (auto& deck : decks) {
+    deck->controller.device_type_request();
+    if (!deck->controller.parse_until(deck->profile.response_timeout_ms) || is_nak(deck->controller)) {
+      cerr << "Error: " << deck->name.toStdString() << ": get device type failed.\n";
+      return false;
+    }
+    deck->profile = find_profile(deck->controller.device_type());
+  }
+  if (fps)
+    return true;
+  fps = decks[0]->profile.fps;
+  for (auto& deck : decks) {
+    if (deck->profile.fps != fps) {
+      cerr << "Error: " << deck->name.toStdString() << ": " << deck->profile.fps << " fps deck in a " << fps
+           << " fps gang, use --fps.\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool gang_check(Gang& decks) {
+  for (auto& deck : decks) {
+    if (!gang_status(*deck))
+      return false;
+    if (!deck->controller.is_remote_enabled()) {
+      cerr << "Error: " << deck->name.toStdString() << ": the device is in local mode.\n";
+      return false;
+    }
+    if (!deck->controller.is_media_exist()) {
+      cerr << "Error: " << deck->name.toStdString() << ": the device does not contain a cassette.\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Polls every deck until predicate holds on all of them
+template <typename Predicate>
+bool gang_wait(Gang& decks, int timeout_ms, Predicate predicate) {
+  const auto deadline = stamp_now().monotonic + (int64_t)timeout_ms * 1000000;
+  vector<bool> done(decks.size());
+  size_t remaining = decks.size();
+  while (remaining) {
+    for (size_t i = 0; i < decks.size(); i++) {
+      if (done[i])
+        continue;
+      if (!gang_status(*decks[i]))
+        return false;
+      if (predicate(decks[i]->controller.status())) {
+        done[i] = true;
+        remaining--;
+      }
+    }
+    if (remaining && stamp_now().monotonic > deadline) {
+      for (size_t i = 0; i < decks.size(); i++)
+        if (!done[i])
+          cerr << "Error: " << decks[i]->name.toStdString() << ": timeout.\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Cue up is still set from a previous cue until the deck moves: a deck is
+// parked once cue up is set and timer1 stands still, two reads a frame
+// apart, within a second of the cue point
+bool gang_wait_cued(Gang& decks, const Timecode& cue, int fps) {
+  const int64_t frame_ns = (int64_t)(1e9 / play_fps(fps));
+  uint32_t cue_timeout_ms = 0;
+  for (auto& deck : decks)
+    cue_timeout_ms = max(cue_timeout_ms, deck->profile.cue_timeout_ms);
+  const auto deadline = stamp_now().monotonic + (int64_t)cue_timeout_ms * 1000000;
+  vector<bool> done(decks.size()), read(decks.size());
+  vector<Timecode> last(decks.size());
+  size_t remaining = decks.size();
+  while (remaining) {
+    for (size_t i = 0; i < decks.size(); i++) {
+      if (done[i])
+        continue;
+      auto& controller = decks[i]->controller;
+      if (!gang_status(*decks[i]))
+        return false;
+      if (!controller.status().b_cue_up) {
+        read[i] = false;
+        continue;
+      }
+      TraceSpan span("timer1", decks[i]->tid);
+      controller.current_time_sense_timer1();
+      if (!gang_sense(*decks[i])) {
+        cerr << "Error: " << decks[i]->name.toStdString() << ": timer1 failed.\n";
+        return false;
+      }
+      const auto position = Timecode::from_deck(controller.timecode(), fps);
+      if (read[i] && position == last[i] && llabs(position - cue) <= fps) {
+        done[i] = true;
+        remaining--;
+      }
+      last[i] = position;
+      read[i] = true;
+    }
+    if (remaining && stamp_now().monotonic > deadline) {
+      for (size_t i = 0; i < decks.size(); i++)
+        if (!done[i])
+          cerr << "Error: " << decks[i]->name.toStdString() << ": timeout.\n";
+      return false;
+    }
+    if (remaining)
+      wait_until(stamp_now().monotonic + frame_ns);
+  }
+  return true;
+}
+
+int gang_cue(Gang& decks, const QString& param, int fps, bool verbose) {
+  const auto text = param.toLatin1();
+  Timecode tc;
+  if (!Timecode::parse(text.constData(), text.size(), fps, tc)) {
+    cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
+    return 1;
+  }
+  const auto bcd = tc.bcd();
+
+  if (verbose) {
+    cerr << "Info: gang cue_up_with_data " << param.toStdString() << ".\n";
+  }
+  for (auto& deck : decks) {
+    deck->controller.cue_up_with_data(bcd.hour, bcd.minute, bcd.second, bcd.frame);
+    if (!deck->controller.parse_until(deck->profile.response_timeout_ms) || !deck->controller.ack()) {
+      cerr << "Error: " << deck->name.toStdString() << ": cue_up_with_data failed.\n";
+      return 1;
+    }
+  }
+
+  // Pre-arm: every deck parked on its cue point before anything is fired
+  if (!gang_wait_cued(decks, tc, fps))
+    return 1;
+  cerr << "Info: gang armed, " << decks.size() << " decks cued to " << param.toStdString() << ".\n";
+  return 0;
+}
+
+void gang_send(GangDeck& deck, char command) {
+  auto& controller = deck.controller;
+  switch (command) {
+    case 'e': controller.eject(); break;
+    case 'f': controller.fast_forward(); break;
+    case 'p': controller.play(); break;
+    case 'r': controller.rewind(); break;
+    case 's': controller.stop(); break;
+    case 'x': controller.frame_step_forward(); break;
+    case 'w': controller.frame_step_reverse(); break;
+  }
+  deck.port.flush();
+}
+
+int gang_timecodes(Gang& decks, int fps) {
+  // Back-to-back reads, offsets corrected by the time between replies
+  vector<Sony9PinRemote::TimeCode> tcs;
+  vector<Stamp> rxs;
+  for (auto& deck : decks) {
+    TraceSpan span("timer1", deck->tid);
+    deck->controller.current_time_sense_timer1();
+    if (!gang_sense(*deck)) {
+      cerr << "Error: " << deck->name.toStdString() << ": timer1 failed.\n";
+      return 1;
+    }
+    rxs.push_back(stamp_now());
+    tcs.push_back(deck->controller.timecode());
+  }
+
+  const auto reference = Timecode::from_deck(tcs[0], fps);
+  for (size_t i = 0; i < decks.size(); i++) {
+    char text[Timecode::format_size];
+    const auto tc = Timecode::from_deck(tcs[i], fps);
+    tc.format(text);
+    const double elapsed = (rxs[i].monotonic - rxs[0].monotonic) * 1e-9 * play_fps(fps);
+    cerr << "Info: deck " << i << " (" << decks[i]->name.toStdString() << ") timecode=" << text
+         << " offset_frames=" << (double)(tc - reference) - elapsed << ".\n";
+  }
+  return 0;
+}
+
+int gang_fire(Gang& decks, char command, int fps, bool verbose) {
+  if (verbose) {
+    cerr << "Info: gang fire " << command << ".\n";
+  }
+
+  // Nothing but the sends between the first and the last deck
+  for (auto& deck : decks) {
+    TraceSpan span("tx", deck->tid);
+    deck->tx = stamp_now();
+    gang_send(*deck, command);
+  }
+
+  for (auto& deck : decks) {
+    TraceSpan span("ack", deck->tid);
+    if (!deck->controller.parse_until(deck->profile.response_timeout_ms) || !deck->controller.ack()) {
+      cerr << "Error: " << deck->name.toStdString() << ": command " << command << " failed.\n";
+      deck->controller.print_nak();
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < decks.size(); i++) {
+    cerr << "Info: deck " << i << " (" << decks[i]->name.toStdString() << ") skew_us="
+         << (decks[i]->tx.monotonic - decks[0]->tx.monotonic) / 1000 << ".\n";
+  }
+
+  if (command == 'p') {
+    if (!gang_wait(decks, lock_timeout_ms, [](const Sony9PinRemote::Status& st) { return st.b_play && st.b_servo_lock; }))
+      return 1;
+    return gang_timecodes(decks, fps);
+  }
+  return 0;
+}
+
+}
+
+int gang(const QStringList& portNames, QStringList commands, int fps, bool verbose) {
+  if (portNames.size() < 2) {
+    cerr << "Error: gang mode needs at least 2 ports.\n";
+    return 1;
+  }
+
+  Gang decks;
+  for (const auto& portName : portNames) {
+    decks.emplace_back(new GangDeck);
+    auto& deck = *decks.back();
+    deck.name = portName;
+    deck.tid = (int)decks.size() - 1;
+    if (auto result = open_port(deck.port, portName, verbose))
+      return result;
+    deck.controller.attach(deck.port);
+    trace.thread_name(deck.tid, deck.port.portName().toStdString());
+  }
+
+  if (!gang_identify(decks, fps) || !gang_check(decks))
+    return 1;
+
+  while (!commands.isEmpty()) {
+    const auto argument = commands.takeFirst();
+    const char value = argument[0].toLatin1();
+    switch (value) {
+      case 'c': {
+        if (commands.isEmpty()) {
+          cerr << "Error: missing timecode.\n";
+          return 1;
+        }
+        if (auto result = gang_cue(decks, commands.takeFirst(), fps, verbose))
+          return result;
+        break;
+      }
+      case 'e':
+      case 'f':
+      case 'p':
+      case 'r':
+      case 's':
+      case 'x':
+      case 'w': {
+        if (auto result = gang_fire(decks, value, fps, verbose))
+          return result;
+        break;
+      }
+      case '2': {
+        if (auto result = gang_timecodes(decks, fps))
+          return result;
+        break;
+      }
+      default: {
+        cerr << "Error: unknown gang command " << value << ".\n";
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
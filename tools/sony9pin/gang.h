@@ -0,0 +1,20 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef GANG_H
+#define GANG_H
+
+#include <QStringList>
+
+// Gang-roll: opens every port in portNames, pre-arms the decks with the
+// cue commands found in commands, then fires each transport command to all
+// decks back-to-back from this thread and reports the per-deck send skew
+// and, after servo lock, the timecode offsets relative to the first deck.
+// Timeouts come from the profile of each deck, the frame rate too unless
+// fps is not 0.
+int gang(const QStringList& portNames, QStringList commands, int fps, bool verbose);
+
+#endif
@@ -0,0 +1,241 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "health.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+const char* const Health::metric_names[metric_count] = { "lock_ms", "cue_ms", "rewind_x", "forward_x" };
+
+namespace {
+
+// Measurements of the baseline, at least this many recent ones to compare
+const size_t baseline_count = 5;
+const size_t recent_count = 5;
+const size_t recent_min = 3;
+
+// A recent median past baseline * factor and baseline + floor is a
+// regression, a speed under baseline * factor
+const struct {
+  double factor;
+  double floor;
+} margins[Health::metric_count] = {
+  { 1.5, 250 },   // lock_ms
+  { 1.5, 2000 },  // cue_ms
+  { 0.8, 0 },     // rewind_x
+  { 0.8, 0 },     // forward_x
+};
+
+const double nak_factor = 2;
+const double nak_floor = 0.001;
+
+// Ramp up excluded from spool speeds, shortest spool measured
+const int64_t spool_ramp_ns = 1000000000;
+const int64_t spool_min_ns = 2000000000;
+// A cue not complete by then is not measured
+const int64_t cue_timeout_ns = 300000000000LL;
+
+string file_part(const string& text) {
+  string part = text;
+  for (auto& c : part) {
+    if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-')
+      c = '_';
+  }
+  return part;
+}
+
+double median(vector<double> values) {
+  sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+}
+
+Health::~Health() {
+  close();
+}
+
+bool Health::open(const string& dir, const string& port, uint16_t device_type, int rate) {
+  fps = rate;
+  char type[8];
+  snprintf(type, sizeof(type), "%04x", device_type);
+  path = dir + '/' + file_part(port) + '_' + type + ".health";
+  replay();
+  return sink.open(path, 0, 0, string());
+}
+
+void Health::close() {
+  if (!sink.is_open())
+    return;
+  end_spool();
+  if (replies.count) {
+    sink.write(to_string(stamp_now().realtime / 1000000) + " replies " + to_string(replies.count) + ' '
+               + to_string(replies.naks) + ' ' + to_string(replies.failures) + '\n');
+    sessions.push_back(replies);
+    replies = {};
+  }
+  sink.close();
+}
+
+void Health::replay() {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return;
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    // A line cut by a crash is ignored
+    if (!strchr(line, '\n'))
+      break;
+    char* end;
+    strtoll(line, &end, 10);
+    if (end == line)
+      continue;
+    char name[16] = {};
+    double value;
+    Replies session;
+    unsigned long long count, naks, failures;
+    if (sscanf(end, " replies %llu %llu %llu", &count, &naks, &failures) == 3) {
+      session.count = count;
+      session.naks = naks;
+      session.failures = failures;
+      sessions.push_back(session);
+      continue;
+    }
+    if (sscanf(end, " %15s %lf", name, &value) != 2)
+      continue;
+    for (int i = 0; i < metric_count; i++) {
+      if (!strcmp(name, metric_names[i]))
+        values[i].push_back(value);
+    }
+  }
+  fclose(file);
+}
+
+void Health::record(Metric metric, double value) {
+  values[metric].push_back(value);
+  char text[32];
+  snprintf(text, sizeof(text), metric == LockMs || metric == CueMs ? "%.0f" : "%.2f", value);
+  sink.write(to_string(stamp_now().realtime / 1000000) + ' ' + metric_names[metric] + ' ' + text + '\n');
+}
+
+void Health::command(char command, int64_t monotonic_ns) {
+  if (!sink.is_open())
+    return;
+  // Another command ends what the previous one started
+  playNs = command == 'p' ? monotonic_ns : 0;
+  cueNs = command == 'c' ? monotonic_ns : 0;
+  cueLeft = false;
+}
+
+void Health::reply(bool received, bool nak) {
+  if (!sink.is_open())
+    return;
+  replies.count++;
+  if (!received)
+    replies.failures++;
+  else if (nak)
+    replies.naks++;
+}
+
+void Health::sample(const Sony9PinRemote::Status& st, int64_t frames, int64_t monotonic_ns) {
+  if (!sink.is_open())
+    return;
+
+  if (playNs && st.b_play && st.b_servo_lock) {
+    record(LockMs, (monotonic_ns - playNs) / 1e6);
+    playNs = 0;
+  }
+
+  // Cue up is still set from a previous cue until the deck moves
+  if (cueNs) {
+    if (!st.b_cue_up) {
+      cueLeft = true;
+    } else if (cueLeft) {
+      record(CueMs, (monotonic_ns - cueNs) / 1e6);
+      cueNs = 0;
+    }
+    if (monotonic_ns - cueNs > cue_timeout_ns)
+      cueNs = 0;
+  }
+
+  const int direction = st.b_shuttle || st.b_jog || st.b_var || st.b_play ? 0 : st.b_rewind ? -1 : st.b_forward ? 1 : 0;
+  if (direction != spool) {
+    end_spool();
+    spool = direction;
+    spoolNs = monotonic_ns;
+  } else if (spool && monotonic_ns - spoolNs >= spool_ramp_ns && lastNs) {
+    spoolFrames += llabs(frames - lastFrames);
+    spooledNs += monotonic_ns - lastNs;
+  }
+  lastFrames = frames;
+  lastNs = monotonic_ns;
+}
+
+void Health::end_spool() {
+  if (spool && spooledNs >= spool_min_ns) {
+    // Play speed of 30 fps timecode is 29.97
+    const double play = fps == 30 ? 30000.0 / 1001 : fps;
+    record(spool < 0 ? RewindSpeed : ForwardSpeed, spoolFrames * 1e9 / spooledNs / play);
+  }
+  spool = 0;
+  spoolFrames = 0;
+  spooledNs = 0;
+}
+
+bool Health::compare(Metric metric, double& baseline, double& recent) const {
+  const auto& all = values[metric];
+  if (all.size() < baseline_count + recent_min)
+    return false;
+  baseline = median(vector<double>(all.begin(), all.begin() + baseline_count));
+  recent = median(vector<double>(all.end() - min(recent_count, all.size() - baseline_count), all.end()));
+  return true;
+}
+
+bool Health::compare_naks(double& baseline, double& recent) const {
+  if (sessions.size() < baseline_count + recent_min)
+    return false;
+  const auto rate = [](vector<Replies>::const_iterator first, vector<Replies>::const_iterator last) {
+    uint64_t count = 0, naks = 0;
+    for (auto session = first; session != last; ++session) {
+      count += session->count;
+      naks += session->naks + session->failures;
+    }
+    return count ? (double)naks / count : 0.0;
+  };
+  baseline = rate(sessions.begin(), sessions.begin() + baseline_count);
+  recent = rate(sessions.end() - min(recent_count, sessions.size() - baseline_count), sessions.end());
+  return true;
+}
+
+vector<string> Health::regressions() const {
+  vector<string> lines;
+  char line[128];
+  for (int i = 0; i < metric_count; i++) {
+    double baseline, recent;
+    if (!compare((Metric)i, baseline, recent))
+      continue;
+    const auto& margin = margins[i];
+    const bool slower = margin.factor > 1 ? recent > baseline * margin.factor && recent > baseline + margin.floor
+                                          : recent < baseline * margin.factor;
+    if (slower) {
+      snprintf(line, sizeof(line), "%s %.2f, baseline %.2f", metric_names[i], recent, baseline);
+      lines.push_back(line);
+    }
+  }
+  double baseline, recent;
+  if (compare_naks(baseline, recent) && recent > baseline * nak_factor && recent > nak_floor) {
+    snprintf(line, sizeof(line), "nak_rate %.4f, baseline %.4f", recent, baseline);
+    lines.push_back(line);
+  }
+  return lines;
+}
@@ -0,0 +1,84 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "logsink.h"
+
+// Per-deck transport timing, <dir>/<port>_<device type>.health, one text
+// line per measurement, appended across sessions:
+//   <realtime ms> lock_ms <ms>          play command to servo lock
+//   <realtime ms> cue_ms <ms>           cue command to cue complete
+//   <realtime ms> rewind_x <speed>      rewind speed, times play speed
+//   <realtime ms> forward_x <speed>     fast forward speed
+//   <realtime ms> replies <count> <naks> <failures>   per session
+// Timings are measured from the continuous mode polls, spool speeds from
+// the timecode deltas once the transport is up to speed. The first
+// measurements of a deck are its baseline; the latest ones are compared
+// to it so a clogging head or a worn transport shows before a capture.
+class Health {
+public:
+  enum Metric { LockMs, CueMs, RewindSpeed, ForwardSpeed, metric_count };
+
+  ~Health();
+
+  bool open(const std::string& dir, const std::string& port, uint16_t device_type, int fps);
+  bool is_open() const { return sink.is_open(); }
+  const std::string& file_name() const { return path; }
+  // Ends a spool being measured and writes the reply counts
+  void close();
+
+  void command(char command, int64_t monotonic_ns);
+  void reply(bool received, bool nak);
+  void sample(const Sony9PinRemote::Status& st, int64_t frames, int64_t monotonic_ns);
+
+  size_t count(Metric metric) const { return values[metric].size(); }
+  // Median of the baseline and of the recent measurements, false if there
+  // are too few to compare
+  bool compare(Metric metric, double& baseline, double& recent) const;
+  bool compare_naks(double& baseline, double& recent) const;
+  // One line per metric worse than the baseline by more than its margin
+  std::vector<std::string> regressions() const;
+
+  static const char* const metric_names[metric_count];
+
+private:
+  struct Replies {
+    uint64_t count;
+    uint64_t naks;
+    uint64_t failures;
+  };
+
+  void replay();
+  void record(Metric metric, double value);
+  void end_spool();
+
+  LogSink sink;
+  std::string path;
+  int fps = 30;
+  std::vector<double> values[metric_count];
+  std::vector<Replies> sessions;
+  Replies replies = {};
+
+  // Measurements in progress
+  int64_t playNs = 0;
+  int64_t cueNs = 0;
+  bool cueLeft = false;
+  int spool = 0;  // -1 rewind, 1 fast forward
+  int64_t spoolNs = 0;
+  int64_t spoolFrames = 0;
+  int64_t spooledNs = 0;
+  int64_t lastFrames = 0;
+  int64_t lastNs = 0;
+};
+
+#endif
@@ -0,0 +1,593 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include <QCoreApplication>
+#include <QProcess>
+#include <QStringList>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capi.h"
+#include "csv.h"
+#include "timeline.h"
+
+using namespace std;
+
+namespace {
+
+// One row of docs/_data/decks.csv
+struct DeckModel {
+  string make;
+  vector<string> models;
+  vector<string> formats;
+  bool ntsc;
+  bool pal;
+};
+
+struct Job {
+  string tape;
+  string format;
+  string standard;
+  int64_t duration_ms;
+  int64_t queued_ms;  // since the last (re)queue
+  int attempts;
+  vector<size_t> faulted;  // decks that faulted on this job
+};
+
+struct Deck {
+  QString port;
+  string make;
+  string model;
+  const DeckModel* catalog = nullptr;
+  sony9pin_deck* handle = nullptr;
+  thread worker;
+  // Under queueMutex
+  bool faulted = false;
+  int64_t busy_ms = 0;
+  int done = 0;
+  int faults = 0;
+};
+
+// Outcome of an ingest attempt: a deck fault retires the deck, a job
+// failure (no cassette loaded, capture not started) only retries the job
+enum Outcome { Done, JobFailure, DeckFault };
+
+vector<DeckModel> catalog;
+vector<unique_ptr<Deck>> decks;
+
+mutex queueMutex;
+condition_variable queueChanged;
+deque<Job> queue;
+bool queueClosed = false;
+int running = 0;
+vector<Job> failed;
+vector<int64_t> latencies;
+
+mutex outputMutex;
+
+QString captureCommand;
+int64_t loadTimeout_ms = 600000;
+int maxAttempts = 3;
+bool verbose = false;
+
+const int64_t poll_ms = 500;
+const int64_t spool_timeout_ms = 900000;
+const int64_t stall_ms = 30000;
+
+int64_t now_ms() {
+  return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lines from the deck threads are not interleaved
+void say(const string& line) {
+  lock_guard<mutex> lock(outputMutex);
+  cerr << line << '\n';
+}
+
+bool read_catalog(const string& path) {
+  ifstream file(path);
+  vector<string> header, cells;
+  if (!file || !read_record(file, header))
+    return false;
+  size_t make = header.size(), model = make, formats = make, standard = make;
+  for (size_t i = 0; i < header.size(); i++) {
+    const auto name = lower(trim(header[i]));
+    if (name == "make")
+      make = i;
+    else if (name == "model")
+      model = i;
+    else if (name == "compatible formats")
+      formats = i;
+    else if (name == "standard")
+      standard = i;
+  }
+  if (model == header.size() || formats == header.size() || standard == header.size()) {
+    cerr << "Error: " << path << " has no Model, Compatible Formats or Standard column.\n";
+    return false;
+  }
+  while (read_record(file, cells)) {
+    cells.resize(header.size());
+    DeckModel deck;
+    if (make < header.size())
+      deck.make = trim(cells[make]);
+    deck.models = split_list(cells[model], '/');
+    deck.formats = split_list(cells[formats], ';');
+    const auto standards = lower(cells[standard]);
+    deck.ntsc = standards.find("ntsc") != string::npos;
+    deck.pal = standards.find("pal") != string::npos;
+    if (!deck.models.empty())
+      catalog.push_back(deck);
+  }
+  return true;
+}
+
+// Catalog row of a model, a device type may give several models ("DSR-1500, DSR-1500A")
+const DeckModel* find_model(const string& models) {
+  for (const auto& model : split_list(models, ',')) {
+    for (const auto& deck : catalog) {
+      if (find(deck.models.begin(), deck.models.end(), model) != deck.models.end())
+        return &deck;
+    }
+  }
+  return nullptr;
+}
+
+bool is_compatible(const DeckModel& deck, const Job& job) {
+  if (job.standard == "ntsc" ? !deck.ntsc : !deck.pal)
+    return false;
+  return find(deck.formats.begin(), deck.formats.end(), job.format) != deck.formats.end();
+}
+
+bool can_take(size_t index, const Job& job) {
+  const auto& deck = *decks[index];
+  return !deck.faulted && deck.catalog && is_compatible(*deck.catalog, job)
+         && find(job.faulted.begin(), job.faulted.end(), index) == job.faulted.end();
+}
+
+// <tape> <format> <NTSC|PAL> <duration estimate, [[hh:]mm:]ss>
+bool parse_job(const string& line, Job& job) {
+  istringstream fields(line);
+  string duration;
+  if (!(fields >> job.tape >> job.format >> job.standard >> duration))
+    return false;
+  job.format = lower(job.format);
+  job.standard = lower(job.standard);
+  if (job.standard != "ntsc" && job.standard != "pal")
+    return false;
+  int64_t seconds = 0;
+  istringstream parts(duration);
+  string part;
+  while (getline(parts, part, ':')) {
+    if (part.empty() || part.find_first_not_of("0123456789") != string::npos)
+      return false;
+    seconds = seconds * 60 + stoll(part);
+  }
+  job.duration_ms = seconds * 1000;
+  job.attempts = 0;
+  job.faulted.clear();
+  return true;
+}
+
+void submit(Job job) {
+  {
+    lock_guard<mutex> lock(queueMutex);
+    job.queued_ms = now_ms();
+    bool usable = false;
+    for (size_t i = 0; i < decks.size() && !usable; i++)
+      usable = can_take(i, job);
+    if (!usable) {
+      say("Error: tape " + job.tape + ": no usable deck for " + job.format + ' ' + job.standard + '.');
+      failed.push_back(job);
+      return;
+    }
+    queue.push_back(job);
+  }
+  queueChanged.notify_all();
+}
+
+class Status {
+public:
+  explicit Status(uint32_t word) : word(word) {}
+  bool operator[](const char* name) const { return (word >> status_bit(name)) & 1; }
+
+private:
+  uint32_t word;
+};
+
+bool read_status(Deck& deck, uint32_t& word, string& error) {
+  if (sony9pin_status(deck.handle, &word)) {
+    error = sony9pin_last_error();
+    return false;
+  }
+  return true;
+}
+
+// Polls the status until predicate holds
+template <typename Predicate>
+Outcome wait_status(Deck& deck, int64_t timeout_ms, Outcome timeout, const char* what, string& error,
+                    Predicate predicate) {
+  const auto deadline = now_ms() + timeout_ms;
+  for (;;) {
+    uint32_t word;
+    if (!read_status(deck, word, error))
+      return DeckFault;
+    if (predicate(Status(word)))
+      return Done;
+    if (now_ms() > deadline) {
+      error = string("timeout waiting for ") + what;
+      return timeout;
+    }
+    this_thread::sleep_for(chrono::milliseconds(poll_ms));
+  }
+}
+
+Outcome transport(Deck& deck, char command, string& error) {
+  if (sony9pin_transport(deck.handle, command)) {
+    error = sony9pin_last_error();
+    return DeckFault;
+  }
+  return Done;
+}
+
+// Runs until the deck stops on its own (end of the recording or of the
+// tape), the timecode stands still while playing (blank tape) or the
+// estimate is well past
+Outcome play_tape(Deck& deck, const Job& job, string& error) {
+  if (auto outcome = transport(deck, 'p', error))
+    return outcome;
+  const auto start = now_ms();
+  const auto limit = start + job.duration_ms * 5 / 4 + 120000;
+  int64_t lastFrames = -1, lastAdvance = start;
+  for (;;) {
+    this_thread::sleep_for(chrono::milliseconds(poll_ms));
+    uint32_t word;
+    sony9pin_timecode tc;
+    if (!read_status(deck, word, error))
+      return DeckFault;
+    const Status st(word);
+    if (st["sys_alarm"] || st["svo_alarm"]) {
+      error = st["sys_alarm"] ? "system alarm" : "servo alarm";
+      return DeckFault;
+    }
+    if (!st["play"] || st["eot"])
+      return Done;
+    if (sony9pin_read_timecode(deck.handle, SONY9PIN_TIMER1, &tc)) {
+      error = sony9pin_last_error();
+      return DeckFault;
+    }
+    const auto now = now_ms();
+    if (tc.frames != lastFrames) {
+      lastFrames = tc.frames;
+      lastAdvance = now;
+    } else if (now - lastAdvance > stall_ms) {
+      if (verbose)
+        say("Info: " + deck.port.toStdString() + ": tape " + job.tape + ": timecode stopped, end of the recording.");
+      return Done;
+    }
+    if (now > limit) {
+      say("Info: " + deck.port.toStdString() + ": tape " + job.tape + ": duration estimate exceeded, stopped.");
+      return Done;
+    }
+  }
+}
+
+// The per-deck ingest sequence: wait for the operator to load the
+// cassette, rewind, start the capture, play to the end, stop and eject
+Outcome ingest(Deck& deck, const Job& job, string& error) {
+  const auto port = deck.port.toStdString();
+  say("Info: " + port + ": load tape " + job.tape + " (" + job.format + ' ' + job.standard + ").");
+  if (auto outcome = wait_status(deck, loadTimeout_ms, JobFailure, "the cassette", error,
+                                 [](const Status& st) { return !st["cassette_out"]; }))
+    return outcome;
+  uint32_t word;
+  if (!read_status(deck, word, error))
+    return DeckFault;
+  if (Status(word)["local"]) {
+    error = "the device is in local mode";
+    return DeckFault;
+  }
+
+  if (auto outcome = transport(deck, 'r', error))
+    return outcome;
+  if (auto outcome = wait_status(deck, spool_timeout_ms, DeckFault, "the rewind", error,
+                                 [](const Status& st) { return !st["rewind"] && (st["stop"] || st["still"]); }))
+    return outcome;
+
+  QProcess capture;
+  if (!captureCommand.isEmpty()) {
+    auto command = captureCommand;
+    command.replace("%t", QString::fromStdString(job.tape)).replace("%p", deck.port);
+    auto arguments = QProcess::splitCommand(command);
+    if (arguments.isEmpty()) {
+      error = "empty capture command";
+      return JobFailure;
+    }
+    capture.setProgram(arguments.takeFirst());
+    capture.setArguments(arguments);
+    capture.start();
+    if (!capture.waitForStarted()) {
+      error = "the capture command did not start";
+      return JobFailure;
+    }
+  }
+
+  auto outcome = play_tape(deck, job, error);
+  string stopError;
+  if (transport(deck, 's', stopError) && outcome == Done) {
+    outcome = DeckFault;
+    error = stopError;
+  }
+  if (!captureCommand.isEmpty()) {
+    capture.terminate();
+    if (!capture.waitForFinished(10000))
+      capture.kill();
+  }
+  if (outcome == Done && transport(deck, 'e', error))
+    outcome = DeckFault;
+  return outcome;
+}
+
+// Queued jobs no deck left in the pool can take, under queueMutex
+void fail_orphans() {
+  for (auto job = queue.begin(); job != queue.end();) {
+    bool usable = false;
+    for (size_t i = 0; i < decks.size() && !usable; i++)
+      usable = can_take(i, *job);
+    if (usable) {
+      ++job;
+      continue;
+    }
+    say("Error: tape " + job->tape + ": no usable deck left for " + job->format + ' ' + job->standard + '.');
+    failed.push_back(*job);
+    job = queue.erase(job);
+  }
+}
+
+// First queued job this deck can take, requeued jobs first
+bool take_job(size_t index, Job& job) {
+  unique_lock<mutex> lock(queueMutex);
+  for (;;) {
+    if (decks[index]->faulted)
+      return false;
+    const auto found = find_if(queue.begin(), queue.end(), [index](const Job& queued) { return can_take(index, queued); });
+    if (found != queue.end()) {
+      job = *found;
+      queue.erase(found);
+      latencies.push_back(now_ms() - job.queued_ms);
+      running++;
+      return true;
+    }
+    // A running job may still come back after a fault
+    if (queueClosed && !running)
+      return false;
+    queueChanged.wait(lock);
+  }
+}
+
+void run_deck(size_t index) {
+  auto& deck = *decks[index];
+  Job job;
+  while (take_job(index, job)) {
+    const auto start = now_ms();
+    string error;
+    const auto outcome = ingest(deck, job, error);
+    const auto port = deck.port.toStdString();
+    {
+      lock_guard<mutex> lock(queueMutex);
+      deck.busy_ms += now_ms() - start;
+      running--;
+      job.attempts++;
+      switch (outcome) {
+        case Done: {
+          deck.done++;
+          say("Info: " + port + ": tape " + job.tape + " done.");
+          break;
+        }
+        case DeckFault:
+        case JobFailure: {
+          if (outcome == DeckFault) {
+            deck.faulted = true;
+            deck.faults++;
+            job.faulted.push_back(index);
+            say("Error: " + port + ": " + error + ", deck taken out of the pool.");
+            fail_orphans();
+          } else {
+            say("Error: " + port + ": tape " + job.tape + ": " + error + '.');
+          }
+          bool usable = false;
+          for (size_t i = 0; i < decks.size() && !usable; i++)
+            usable = can_take(i, job);
+          if (job.attempts >= maxAttempts || !usable) {
+            say("Error: tape " + job.tape + " failed after " + to_string(job.attempts) + " attempts.");
+            failed.push_back(job);
+          } else {
+            // Rebalanced: back at the front, any other compatible deck
+            job.queued_ms = now_ms();
+            queue.push_front(job);
+            say("Info: tape " + job.tape + " requeued.");
+          }
+          break;
+        }
+      }
+    }
+    queueChanged.notify_all();
+  }
+}
+
+void read_jobs(istream& in) {
+  string line;
+  while (getline(in, line)) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+    Job job;
+    if (!parse_job(line, job)) {
+      say("Error: invalid job " + line + '.');
+      continue;
+    }
+    submit(job);
+  }
+}
+
+void usage(const string& commandName) {
+  cerr << "Usage: " << commandName << " [option] <port>[=<model>]...\n"
+       << "Ingest scheduler: runs a queue of tape jobs on a pool of decks. Each job goes to the first free\n"
+       << "deck compatible with its format and standard, per the deck identification and the format\n"
+       << "columns of decks.csv; the deck waits for the operator to load the tape, rewinds, starts the\n"
+       << "capture command, plays to the end, stops and ejects. A deck fault takes the deck out of the\n"
+       << "pool and requeues its job for another deck.\n"
+       << "Jobs are lines of <tape> <format> <NTSC|PAL> <duration estimate, [[hh:]mm:]ss>, read from stdin\n"
+       << "until closed if no --jobs file, so jobs can be queued while decks are running.\n"
+       << "<model>: model of the deck in decks.csv, when the device type does not tell it\n"
+       << "Options:\n"
+       << "--jobs=<file>: job list\n"
+       << "--decks=<file>: deck catalog (default docs/_data/decks.csv)\n"
+       << "--capture=<command>: capture started before play and terminated after stop, %t is replaced by the\n"
+       << "                     tape, %p by the port\n"
+       << "--load=<seconds>: time for the operator to load a cassette (default 600)\n"
+       << "--attempts=<count>: attempts per job (default 3)\n"
+       << "--verbose: more info\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  QCoreApplication coreApplication(argc, argv);
+  QStringList argumentList = QCoreApplication::arguments();
+
+  QString commandName;
+  if (!argumentList.isEmpty())
+    commandName = argumentList.takeFirst();
+
+  QString jobsName, catalogName = "docs/_data/decks.csv";
+  while (!argumentList.isEmpty() && argumentList.first().startsWith("--")) {
+    const auto argument = argumentList.takeFirst();
+    bool ok = true;
+    if (argument.startsWith("--jobs=")) {
+      jobsName = argument.mid(7);
+    } else if (argument.startsWith("--decks=")) {
+      catalogName = argument.mid(8);
+    } else if (argument.startsWith("--capture=")) {
+      captureCommand = argument.mid(10);
+    } else if (argument.startsWith("--load=")) {
+      loadTimeout_ms = argument.mid(7).toInt(&ok) * 1000LL;
+    } else if (argument.startsWith("--attempts=")) {
+      maxAttempts = argument.mid(11).toInt(&ok);
+      ok = ok && maxAttempts > 0;
+    } else if (argument == "--verbose") {
+      verbose = true;
+    } else {
+      usage(commandName.toStdString());
+      return 1;
+    }
+    if (!ok) {
+      cerr << "Error: invalid " << argument.toStdString() << ".\n";
+      return 1;
+    }
+  }
+  if (argumentList.isEmpty()) {
+    usage(commandName.toStdString());
+    return 1;
+  }
+  if (!read_catalog(catalogName.toStdString())) {
+    cerr << "Error: can not read " << catalogName.toStdString() << ".\n";
+    return 1;
+  }
+
+  for (const auto& argument : argumentList) {
+    decks.emplace_back(new Deck);
+    auto& deck = *decks.back();
+    const auto separator = argument.indexOf('=');
+    deck.port = separator < 0 ? argument : argument.left(separator);
+    deck.handle = sony9pin_open(deck.port.toUtf8().constData());
+    if (!deck.handle) {
+      cerr << "Error: " << deck.port.toStdString() << ": " << sony9pin_last_error() << ".\n";
+      return 1;
+    }
+    uint16_t deviceType;
+    char make[256];
+    char model[256];
+    if (sony9pin_device_type(deck.handle, &deviceType, make, sizeof(make), model, sizeof(model))) {
+      cerr << "Error: " << deck.port.toStdString() << ": " << sony9pin_last_error() << ".\n";
+      return 1;
+    }
+    deck.make = make;
+    deck.model = separator < 0 ? string(model) : argument.mid(separator + 1).toStdString();
+    deck.catalog = find_model(deck.model);
+    // Timings of the model given, of the device type otherwise
+    if (separator >= 0 && sony9pin_use_model(deck.handle, deck.model.c_str()) && verbose)
+      cerr << "Info: " << deck.port.toStdString() << ": " << sony9pin_last_error() << ", profile of the device type used.\n";
+    char type[8];
+    snprintf(type, sizeof(type), "%04x", deviceType);
+    if (deck.catalog) {
+      string formats;
+      for (const auto& format : deck.catalog->formats)
+        formats += (formats.empty() ? "" : ", ") + format;
+      cerr << "Info: " << deck.port.toStdString() << ": " << deck.make << ' ' << deck.model << " (" << type << "), "
+           << formats << (deck.catalog->ntsc ? " NTSC" : "") << (deck.catalog->pal ? " PAL" : "") << ".\n";
+    } else {
+      cerr << "Error: " << deck.port.toStdString() << ": " << (deck.model.empty() ? type : deck.model)
+           << " is not in " << catalogName.toStdString() << ", no job will be assigned to it.\n";
+    }
+  }
+
+  const auto start = now_ms();
+  for (size_t i = 0; i < decks.size(); i++)
+    decks[i]->worker = thread(run_deck, i);
+
+  if (jobsName.isEmpty()) {
+    read_jobs(cin);
+  } else {
+    ifstream file(jobsName.toStdString());
+    if (!file)
+      cerr << "Error: can not read " << jobsName.toStdString() << ".\n";
+    read_jobs(file);
+  }
+  {
+    lock_guard<mutex> lock(queueMutex);
+    queueClosed = true;
+  }
+  queueChanged.notify_all();
+  for (auto& deck : decks) {
+    deck->worker.join();
+    sony9pin_close(deck->handle);
+  }
+
+  // Left in the queue once every deck that could take them faulted
+  failed.insert(failed.end(), queue.begin(), queue.end());
+  const auto elapsed = max<int64_t>(now_ms() - start, 1);
+  int done = 0;
+  for (const auto& deck : decks) {
+    done += deck->done;
+    cerr << "Info: " << deck->port.toStdString() << ": " << deck->done << " tapes, utilization "
+         << deck->busy_ms * 100 / elapsed << "%" << (deck->faulted ? ", faulted" : "") << ".\n";
+  }
+  if (!latencies.empty()) {
+    sort(latencies.begin(), latencies.end());
+    int64_t total = 0;
+    for (const auto latency : latencies)
+      total += latency;
+    cerr << "Info: queue latency mean " << total / (int64_t)latencies.size() / 1000 << " s, median "
+         << latencies[latencies.size() / 2] / 1000 << " s, max " << latencies.back() / 1000 << " s over "
+         << latencies.size() << " assignments.\n";
+  }
+  cerr << "Info: " << done << " tapes done, " << failed.size() << " failed.\n";
+  for (const auto& job : failed)
+    cerr << "Info: failed tape " << job.tape << ".\n";
+  return failed.empty() ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+TEMPLATE = app
+TARGET = sony9pin_ingest
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QT += serialport
+QT -= gui
+
+# Lib
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../capi.h \
+           ../csv.h \
+           ../link.h \
+           ../profiles.h \
+           ../timecode.h \
+           ../timeline.h
+
+SOURCES += ingest.cpp \
+           ../capi.cpp \
+           ../clock.cpp \
+           ../csv.cpp \
+           ../devices.cpp \
+           ../format.cpp \
+           ../frame.cpp \
+           ../link.cpp \
+           ../port.cpp \
+           ../profiles.cpp \
+           ../timeline.cpp
+
+RESOURCES += ../profiles.qrc
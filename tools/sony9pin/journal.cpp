@@ -0,0 +1,220 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "journal.h"
+#include "clock.h"
+#include "timeline.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+// Commands that move the tape, a position older than one of them is stale
+const char* const motion_commands = "cefjmprswx";
+
+const int64_t position_interval_ms = 1000;
+
+// Journal file names are made of port and tape ID, anything else than
+// [0-9A-Za-z._-] is replaced
+string file_part(const string& text) {
+  string part = text;
+  for (auto& c : part) {
+    if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-')
+      c = '_';
+  }
+  return part;
+}
+
+uint32_t status_mask(const char* const names[], size_t count) {
+  uint32_t mask = 0;
+  for (size_t i = 0; i < count; i++)
+    mask |= 1u << status_bit(names[i]);
+  return mask;
+}
+
+}
+
+Journal::~Journal() {
+  close();
+}
+
+string Journal::tape_from_userbits(const Sony9PinRemote::UserBits& ub) {
+  if (!ub.bytes[0] && !ub.bytes[1] && !ub.bytes[2] && !ub.bytes[3])
+    return string();
+  char text[9];
+  snprintf(text, sizeof(text), "%02X%02X%02X%02X", ub.bytes[0], ub.bytes[1], ub.bytes[2], ub.bytes[3]);
+  return text;
+}
+
+bool Journal::open(const string& dir, const string& port, const string& tape, int rate) {
+  fps = rate;
+  path = dir + '/' + file_part(port) + '_' + file_part(tape) + ".journal";
+  replay();
+  // Appended, never rotated: the whole history of the tape is replayed
+  return sink.open(path, 0, 0, string());
+}
+
+void Journal::close() {
+  if (!sink.is_open())
+    return;
+  if (unwritten)
+    write_position(position_ms);
+  sink.close();
+}
+
+void Journal::replay() {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return;
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    char* end;
+    const int64_t ms = strtoll(line, &end, 10);
+    char kind = 0, command = 0, text[32] = {}, result[8] = {};
+    unsigned value = 0;
+    if (end == line || sscanf(end, " %c", &kind) != 1)
+      continue;
+    // A line cut by a crash is ignored
+    if (!strchr(line, '\n'))
+      break;
+    entry_count++;
+    switch (kind) {
+      case 'C': {
+        if (sscanf(end, " C %c %31s", &command, text) < 1)
+          break;
+        if (strchr(motion_commands, command))
+          moved = true;
+        if (command == 'c' && Timecode::parse(text, strlen(text), fps, cue))
+          cued = true;
+        break;
+      }
+      case 'R': {
+        if (sscanf(end, " R %c %7s %u", &command, result, &value) == 3 && !strcmp(result, "ok")) {
+          reply_histogram[min<unsigned>(value / 1000, reply_bins - 1)]++;
+          reply_count++;
+        }
+        break;
+      }
+      case 'P': {
+        char word[16] = {};
+        if (sscanf(end, " P %31s %15s", text, word) == 2 && Timecode::parse(text, strlen(text), fps, last)) {
+          position_ms = written_ms = ms;
+          // "-" for a timecode read alone, the transport state is not known
+          if (strcmp(word, "-")) {
+            status = written_status = strtoul(word, nullptr, 16);
+            moved = false;
+          }
+        }
+        break;
+      }
+    }
+  }
+  fclose(file);
+  // Cues are logged as typed, positions in the drop-frame mode of the tape
+  if (cued && has_position())
+    cue = cue.in_mode(fps, last.is_df());
+}
+
+void Journal::command(char command, const Timecode* target) {
+  if (!sink.is_open())
+    return;
+  if (unwritten)
+    write_position(position_ms);
+  string line = to_string(stamp_now().realtime / 1000000) + " C " + command;
+  if (target) {
+    char text[Timecode::format_size];
+    target->format(text);
+    line += ' ';
+    line += text;
+    cue = has_position() ? target->in_mode(fps, last.is_df()) : *target;
+    cued = true;
+  }
+  sink.write(line + '\n');
+  if (strchr(motion_commands, command))
+    moved = true;
+  entry_count++;
+}
+
+void Journal::reply(char command, Result result, int64_t reply_ns) {
+  if (!sink.is_open())
+    return;
+  static const char* const results[] = { "ok", "nak", "fail" };
+  sink.write(to_string(stamp_now().realtime / 1000000) + " R " + command + ' ' + results[result] + ' '
+             + to_string(reply_ns / 1000) + '\n');
+  if (result == Ok) {
+    reply_histogram[min<int64_t>(reply_ns / 1000000, reply_bins - 1)]++;
+    reply_count++;
+  }
+  entry_count++;
+}
+
+void Journal::position(const Sony9PinRemote::TimeCode& tc, uint32_t word, int64_t realtime_ms) {
+  if (!sink.is_open())
+    return;
+  if (unwritten && !unwritten_status)
+    write_position(position_ms);
+  last = Timecode::from_deck(tc, fps);
+  status = word;
+  position_ms = realtime_ms;
+  moved = false;
+  unwritten = true;
+  unwritten_status = true;
+  if (status != written_status || realtime_ms - written_ms >= position_interval_ms)
+    write_position(realtime_ms);
+}
+
+void Journal::position(const Sony9PinRemote::TimeCode& tc, int64_t realtime_ms) {
+  if (!sink.is_open())
+    return;
+  if (unwritten && unwritten_status)
+    write_position(position_ms);
+  last = Timecode::from_deck(tc, fps);
+  position_ms = realtime_ms;
+  unwritten = true;
+  unwritten_status = false;
+  if (realtime_ms - written_ms >= position_interval_ms)
+    write_position(realtime_ms);
+}
+
+void Journal::write_position(int64_t realtime_ms) {
+  char text[Timecode::format_size];
+  last.format(text);
+  char word[16] = "-";
+  if (unwritten_status) {
+    snprintf(word, sizeof(word), "%x", status);
+    written_status = status;
+  }
+  sink.write(to_string(realtime_ms) + " P " + text + ' ' + word + '\n');
+  written_ms = realtime_ms;
+  unwritten = false;
+  entry_count++;
+}
+
+bool Journal::is_parked() const {
+  static const char* const parked[] = { "stop", "still" };
+  static const char* const moving[] = { "play", "rewind", "forward", "shuttle", "jog", "var", "eject", "cassette_out" };
+  static const uint32_t parked_mask = status_mask(parked, sizeof(parked) / sizeof(*parked));
+  static const uint32_t moving_mask = status_mask(moving, sizeof(moving) / sizeof(*moving));
+  return has_position() && !moved && (status & parked_mask) && !(status & moving_mask);
+}
+
+uint32_t Journal::typical_reply_ms() const {
+  if (reply_count < 16)
+    return 0;
+  uint64_t seen = 0;
+  for (int i = 0; i < reply_bins; i++) {
+    seen += reply_histogram[i];
+    if (seen * 2 >= reply_count)
+      return i + 1;
+  }
+  return reply_bins;
+}
@@ -0,0 +1,90 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <string>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "logsink.h"
+#include "timecode.h"
+
+// Per-tape session journal, <dir>/<port>_<tape>.journal, one text line per
+// entry, appended across sessions:
+//   <realtime ms> C <command>[ <timecode>]           command sent
+//   <realtime ms> R <command> <ok|nak|fail> <us>     its reply, reply time
+//   <realtime ms> P <timecode> <status word, hex|->  last known position,
+//                                                    "-" if only the
+//                                                    timecode was read
+// Entries go through a LogSink, so a command never waits for the disk. On
+// open, the existing journal is replayed to get back the last known
+// position and transport state, the last cue and the reply times of the
+// deck, e.g. to skip a cue to where the tape already is.
+class Journal {
+public:
+  enum Result { Ok, Nak, Fail };
+
+  ~Journal();
+
+  // Tape ID from LTC user bits, empty if they are all zero
+  static std::string tape_from_userbits(const Sony9PinRemote::UserBits& ub);
+
+  bool open(const std::string& dir, const std::string& port, const std::string& tape, int fps);
+  bool is_open() const { return sink.is_open(); }
+  const std::string& file_name() const { return path; }
+  void close();
+
+  void command(char command, const Timecode* target = nullptr);
+  void reply(char command, Result result, int64_t reply_ns);
+  // Written on a status change or once a second, the latest one before
+  // the next command and on close. status is a pack_status() word.
+  void position(const Sony9PinRemote::TimeCode& tc, uint32_t status, int64_t realtime_ms);
+  // Timecode read alone, does not tell the transport stopped
+  void position(const Sony9PinRemote::TimeCode& tc, int64_t realtime_ms);
+
+  // Replayed state, also kept up to date by this session
+  uint64_t entries() const { return entry_count; }
+  bool has_position() const { return position_ms != 0; }
+  int64_t position_time_ms() const { return position_ms; }
+  const Timecode& last_position() const { return last; }
+  uint32_t last_status() const { return status; }
+  // No motion command since the last position, and stopped or still there
+  bool is_parked() const;
+  bool has_cue() const { return cued; }
+  const Timecode& last_cue() const { return cue; }
+  // Median reply time in the journal, in ms, 0 if too few replies
+  uint32_t typical_reply_ms() const;
+
+private:
+  void replay();
+  void write_position(int64_t realtime_ms);
+
+  LogSink sink;
+  std::string path;
+  int fps = 30;
+  uint64_t entry_count = 0;
+
+  Timecode last;
+  uint32_t status = 0;
+  int64_t position_ms = 0;
+  int64_t written_ms = 0;
+  uint32_t written_status = 0;
+  bool unwritten = false;
+  bool unwritten_status = false;
+  bool moved = false;
+
+  bool cued = false;
+  Timecode cue;
+
+  // 1 ms bins, the last one for anything slower
+  static const int reply_bins = 64;
+  uint64_t reply_histogram[reply_bins] = {};
+  uint64_t reply_count = 0;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "link.h"
+#include "timecode.h"
+
+using namespace std;
+
+namespace {
+
+// Status data byte and bit of each field, as documented for status sense
+const struct {
+  bool Sony9PinRemote::Status::* field;
+  uint8_t byte;
+  uint8_t bit;
+} status_fields[] = {
+  { &Sony9PinRemote::Status::b_local, 0, 0 },
+  { &Sony9PinRemote::Status::b_servo_ref_missing, 0, 4 },
+  { &Sony9PinRemote::Status::b_cassette_out, 0, 5 },
+  { &Sony9PinRemote::Status::b_play, 1, 0 },
+  { &Sony9PinRemote::Status::b_record, 1, 1 },
+  { &Sony9PinRemote::Status::b_forward, 1, 2 },
+  { &Sony9PinRemote::Status::b_rewind, 1, 3 },
+  { &Sony9PinRemote::Status::b_eject, 1, 4 },
+  { &Sony9PinRemote::Status::b_stop, 1, 5 },
+  { &Sony9PinRemote::Status::b_standby, 1, 7 },
+  { &Sony9PinRemote::Status::b_cue_up, 2, 0 },
+  { &Sony9PinRemote::Status::b_still, 2, 1 },
+  { &Sony9PinRemote::Status::b_direction, 2, 2 },
+  { &Sony9PinRemote::Status::b_var, 2, 3 },
+  { &Sony9PinRemote::Status::b_jog, 2, 4 },
+  { &Sony9PinRemote::Status::b_shuttle, 2, 5 },
+  { &Sony9PinRemote::Status::b_tso_mode, 2, 6 },
+  { &Sony9PinRemote::Status::b_servo_lock, 2, 7 },
+  { &Sony9PinRemote::Status::b_lamp_rev, 6, 4 },
+  { &Sony9PinRemote::Status::b_lamp_fwd, 6, 5 },
+  { &Sony9PinRemote::Status::b_lamp_still, 6, 6 },
+  { &Sony9PinRemote::Status::b_sys_alarm, 8, 0 },
+  { &Sony9PinRemote::Status::b_svo_alarm, 8, 1 },
+  { &Sony9PinRemote::Status::b_cf_lock, 8, 2 },
+  { &Sony9PinRemote::Status::b_eot, 8, 3 },
+  { &Sony9PinRemote::Status::b_near_eot, 8, 4 },
+  { &Sony9PinRemote::Status::b_rec_inhib, 9, 7 },
+};
+
+}
+
+const CommandFrame* transport_frame(char command) {
+  switch (command) {
+    case 'e': return &command_frames::eject;
+    case 'f': return &command_frames::fast_forward;
+    case 'p': return &command_frames::play;
+    case 'r': return &command_frames::rewind;
+    case 's': return &command_frames::stop;
+    case 'x': return &command_frames::frame_step_forward;
+    case 'w': return &command_frames::frame_step_reverse;
+    default: return nullptr;
+  }
+}
+
+bool decode_status(const uint8_t* frame, size_t size, Sony9PinRemote::Status& st) {
+  uint8_t data[status_data_size] = {};
+  const auto count = decode_status_data(frame, size, data);
+  if (!count)
+    return false;
+  for (const auto& field : status_fields) {
+    if (field.byte < count)
+      st.*field.field = (data[field.byte] >> field.bit) & 1;
+  }
+  return true;
+}
+
+bool is_nak(const Sony9PinRemote::Controller& controller) {
+  return !controller.ack() && (controller.is_nak_unknown_command() ||
+                               controller.is_nak_checksum_error() ||
+                               controller.is_nak_parity_error() ||
+                               controller.is_nak_buffer_overrun() ||
+                               controller.is_nak_framing_error() ||
+                               controller.is_nak_timeout());
+}
+
+const char* command_refusal(const Sony9PinRemote::Status& st) {
+  if (st.b_local)
+    return "The device is in local mode. Please switch to remote and try again";
+  if (st.b_cassette_out)
+    return "The device does not contain a cassette. Please insert media and try again";
+  return nullptr;
+}
+
+bool decode_timecode(const uint8_t* frame, size_t size, Sony9PinRemote::TimeCode& tc, Sony9PinRemote::UserBits* ub) {
+  const size_t count = frame[0] & 0x0F;
+  if (size < 7 || (frame[0] & 0xF0) != 0x70 || count < 4 || frame[1] >= 0x08)
+    return false;
+  const uint8_t* data = frame + 2;
+  tc.frame = from_bcd(data[0] & 0x3F);
+  tc.is_df = (data[0] >> 6) & 1;
+  tc.is_cf = (data[0] >> 7) & 1;
+  tc.second = from_bcd(data[1] & 0x7F);
+  tc.minute = from_bcd(data[2] & 0x7F);
+  tc.hour = from_bcd(data[3] & 0x3F);
+  if (ub && count >= 8) {
+    for (int i = 0; i < 4; i++)
+      ub->bytes[i] = data[4 + i];
+  }
+  return true;
+}
@@ -0,0 +1,189 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "clock.h"
+#include "format.h"
+#include "frame.h"
+
+// Command frame with at most one data byte, checksum computed at compile
+// time
+struct CommandFrame {
+  uint8_t bytes[4];
+  uint8_t size;
+
+  constexpr CommandFrame(uint8_t cmd1, uint8_t cmd2)
+    : bytes{ (uint8_t)(cmd1 & 0xF0), cmd2, (uint8_t)((cmd1 & 0xF0) + cmd2), 0 }, size(3) {}
+  constexpr CommandFrame(uint8_t cmd1, uint8_t cmd2, uint8_t data)
+    : bytes{ (uint8_t)((cmd1 & 0xF0) | 1), cmd2, data, (uint8_t)(((cmd1 & 0xF0) | 1) + cmd2 + data) }, size(4) {}
+};
+
+// The fixed commands of the poll loop and of rule actions
+namespace command_frames {
+constexpr CommandFrame stop(0x20, 0x00);
+constexpr CommandFrame play(0x20, 0x01);
+constexpr CommandFrame eject(0x20, 0x0F);
+constexpr CommandFrame fast_forward(0x20, 0x10);
+constexpr CommandFrame frame_step_forward(0x20, 0x14);
+constexpr CommandFrame rewind(0x20, 0x20);
+constexpr CommandFrame frame_step_reverse(0x20, 0x24);
+constexpr CommandFrame device_type(0x00, 0x11);
+constexpr CommandFrame status_sense(0x60, 0x20, status_data_size);  // data 0 to 9
+constexpr CommandFrame timer1(0x60, 0x0C, 0x04);
+constexpr CommandFrame timer2(0x60, 0x0C, 0x08);
+constexpr CommandFrame ltc_tc_ub(0x60, 0x0C, 0x11);
+constexpr CommandFrame vitc_tc_ub(0x60, 0x0C, 0x22);
+}
+
+static_assert(command_frames::play.bytes[2] == 0x21 && command_frames::play.size == 3, "transport frame");
+static_assert(command_frames::status_sense.bytes[0] == 0x61 && command_frames::status_sense.bytes[3] == 0x8B,
+              "sense frame");
+
+// Transport command of a rule action or command line letter, nullptr if
+// there is none
+const CommandFrame* transport_frame(char command);
+
+// Replies, from a frame the decoder validated
+inline bool is_ack(const uint8_t* frame) { return frame[0] == 0x10 && frame[1] == 0x01; }
+inline bool is_nak(const uint8_t* frame) { return frame[0] == 0x11 && frame[1] == 0x12; }
+// Last reply parsed by the controller was a NAK. Sense commands reply with
+// data, not an ACK: their replies are checked with this, never ack().
+bool is_nak(const Sony9PinRemote::Controller& controller);
+// Status sense reply (CMD1 0x7n, CMD2 0x20), fields of the bytes returned
+bool decode_status(const uint8_t* frame, size_t size, Sony9PinRemote::Status& st);
+// Why a transport command or cue would be refused by the deck of this
+// status, nullptr if it can be sent
+const char* command_refusal(const Sony9PinRemote::Status& st);
+// Time data reply (CMD1 0x74 or 0x78 with user bits), ub may be nullptr
+bool decode_timecode(const uint8_t* frame, size_t size, Sony9PinRemote::TimeCode& tc, Sony9PinRemote::UserBits* ub);
+
+// Reply framing on a QIODevice-like port (write, peek, read,
+// waitForReadyRead). Replies are located in a fixed buffer by the frame
+// decoder; query() sends a prebuilt frame and consumes its reply without
+// the controller, so a poll allocates nothing and formats nothing between
+// send and receive.
+template <typename Port>
+class Link {
+public:
+  explicit Link(Port& port) : port(port) {}
+
+  // Waits until a complete, valid reply is buffered. Bytes that can not
+  // start a frame are dropped so the controller parses from a frame
+  // boundary, and a corrupted or truncated reply fails after a bounded
+  // number of bytes or a short idle line instead of the full timeout. Once
+  // the line is idle, a noise byte that looks like the header of a long
+  // frame is dropped and the rest rescanned, the reply behind it kept. The
+  // reply stays in the port, a copy in frame().
+  bool wait(uint32_t timeout_ms);
+
+  // Sends a prebuilt frame and reads its reply into frame(), fails on a
+  // port error
+  bool query(const CommandFrame& command, uint32_t timeout_ms) {
+    // Bytes still buffered are left from an earlier reply (the rest of a
+    // corrupted one past a spurious frame), they would be taken for this one
+    char bytes[FrameDecoder::max_size];
+    for (;;) {
+      const auto stale = port.peek(bytes, sizeof(bytes));
+      if (stale < 0)
+        return false;
+      if (!stale)
+        break;
+      port.read(bytes, stale);
+    }
+    sent = stamp_now();
+    port.write(reinterpret_cast<const char*>(command.bytes), command.size);
+    if (!wait(timeout_ms))
+      return false;
+    port.read(bytes, size);
+    return true;
+  }
+
+  const uint8_t* frame() const { return reply; }
+  size_t frame_size() const { return size; }
+  // When query() wrote the request, and when wait() peeked the last byte
+  // of the reply
+  const Stamp& tx() const { return sent; }
+  const Stamp& rx() const { return received; }
+  // Replies given up on as corrupted or truncated
+  uint64_t malformed() const { return malformed_replies; }
+
+private:
+  static int64_t now_ms() { return stamp_now().monotonic / 1000000; }
+
+  Port& port;
+  uint8_t reply[FrameDecoder::max_size];
+  size_t size = 0;
+  Stamp sent;
+  Stamp received;
+  uint64_t malformed_replies = 0;
+};
+
+template <typename Port>
+bool Link<Port>::wait(uint32_t timeout_ms) {
+  // Above the 16 ms latency timer of FTDI USB-serial adapters, which hold
+  // the end of a reply that long
+  const int idle_ms = 20;
+  const auto deadline = now_ms() + timeout_ms;
+  FrameDecoder decoder;
+  char bytes[FrameDecoder::max_size];
+  uint64_t dropped = 0;
+  bool idle = false;
+  for (;;) {
+    const auto count = port.peek(bytes, sizeof(bytes));
+    if (count < 0)
+      return false;
+    const auto peeked = stamp_now();
+    decoder.reset();
+    for (int64_t i = 0; i < count; i++) {
+      if (decoder.feed((uint8_t)bytes[i])) {
+        if (decoder.discarded())
+          port.read(bytes, decoder.discarded());
+        memcpy(reply, decoder.data(), decoder.size());
+        size = decoder.size();
+        received = peeked;
+        return true;
+      }
+    }
+    if (decoder.discarded()) {
+      dropped += decoder.discarded();
+      port.read(bytes, decoder.discarded());
+      if (dropped >= FrameDecoder::max_size) {
+        malformed_replies++;
+        return false;
+      }
+      continue;
+    }
+    if (idle && count) {
+      // Nothing more is coming for the frame the first byte started
+      port.read(bytes, 1);
+      if (count == 1) {
+        malformed_replies++;
+        return false;
+      }
+      continue;
+    }
+
+    const auto remaining = deadline - now_ms();
+    if (remaining <= 0)
+      return false;
+    if (!port.waitForReadyRead(count ? std::min<int>(idle_ms, remaining) : remaining)) {
+      if (!count)
+        return false;
+      // Line went idle in the middle of a frame
+      idle = true;
+    }
+  }
+}
+
+#endif
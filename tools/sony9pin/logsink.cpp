@@ -0,0 +1,175 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "logsink.h"
+
+#include <QProcess>
+#include <QStringList>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const size_t batch_size = 256 * 1024;
+const size_t max_pending = 16 * 1024 * 1024;
+const auto flush_interval = chrono::seconds(1);
+const int64_t sync_interval_s = 10;
+
+int64_t seconds_now() {
+  return chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void sync_file(FILE* file) {
+  fflush(file);
+#ifdef _WIN32
+  _commit(_fileno(file));
+#else
+  fsync(fileno(file));
+#endif
+}
+
+}
+
+LogSink::~LogSink() {
+  close();
+}
+
+bool LogSink::open(const string& log_path, uint64_t bytes, int64_t seconds, const string& log_compressor) {
+  file = fopen(log_path.c_str(), "a");
+  if (!file)
+    return false;
+  path = log_path;
+  max_bytes = bytes;
+  max_seconds = seconds;
+  compressor = log_compressor;
+  fseek(file, 0, SEEK_END);
+  segment_bytes = ftell(file);
+  segment_start = last_sync = seconds_now();
+  pending.reserve(batch_size * 2);
+  writing.reserve(batch_size * 2);
+  stopping = false;
+  opened = true;
+  writer = thread(&LogSink::run, this);
+  return true;
+}
+
+void LogSink::close() {
+  if (!opened)
+    return;
+  opened = false;
+  {
+    lock_guard<std::mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  writer.join();
+  if (file) {
+    sync_file(file);
+    fclose(file);
+  }
+  file = nullptr;
+  if (dropped_lines)
+    cerr << "Error: " << dropped_lines << " log lines dropped, disk too slow or log not writable.\n";
+}
+
+void LogSink::write(const string& line) {
+  bool full;
+  {
+    lock_guard<std::mutex> lock(queue_mutex);
+    if (pending.size() + line.size() > max_pending) {
+      dropped_lines++;
+      return;
+    }
+    pending += line;
+    full = pending.size() >= batch_size;
+  }
+  if (full)
+    wake.notify_one();
+}
+
+void LogSink::run() {
+  unique_lock<std::mutex> lock(queue_mutex);
+  for (;;) {
+    wake.wait_for(lock, flush_interval, [this] { return stopping || pending.size() >= batch_size; });
+    const bool last = stopping;
+    pending.swap(writing);
+    lock.unlock();
+    write_batch();
+    lock.lock();
+    if (last && pending.empty())
+      return;
+  }
+}
+
+// Writer thread only, the file is not touched by the caller until close()
+void LogSink::write_batch() {
+  // Left without a file by a failed rotation, retried every batch
+  if (!file)
+    file = fopen(path.c_str(), "a");
+  if (!writing.empty()) {
+    if (file) {
+      fwrite(writing.data(), 1, writing.size(), file);
+      fflush(file);
+      segment_bytes += writing.size();
+    } else {
+      const auto lines = (uint64_t)count(writing.begin(), writing.end(), '\n');
+      lock_guard<std::mutex> lock(queue_mutex);
+      dropped_lines += lines;
+    }
+    writing.clear();
+  }
+  if (!file)
+    return;
+
+  const auto now = seconds_now();
+  if ((max_bytes && segment_bytes >= max_bytes) || (max_seconds && now - segment_start >= max_seconds)) {
+    if (segment_bytes)
+      rotate();
+    segment_start = now;
+  } else if (now - last_sync >= sync_interval_s) {
+    sync_file(file);
+    last_sync = now;
+  }
+}
+
+void LogSink::rotate() {
+  sync_file(file);
+  fclose(file);
+
+  char suffix[32];
+  const auto closed = chrono::system_clock::to_time_t(chrono::system_clock::now());
+  strftime(suffix, sizeof(suffix), ".%Y%m%dT%H%M%SZ", gmtime(&closed));
+  auto segment = path + suffix;
+  for (int i = 1; FILE* existing = fopen(segment.c_str(), "r"); i++) {
+    // More than one rotation within a second
+    fclose(existing);
+    segment = path + suffix + '-' + to_string(i);
+  }
+  if (rename(path.c_str(), segment.c_str()))
+    cerr << "Error: can not rotate log " << path << ".\n";
+  else if (compressor == "zstd")
+    QProcess::startDetached("zstd", QStringList() << "-q" << "--rm" << QString::fromStdString(segment));
+  else if (compressor == "gzip")
+    QProcess::startDetached("gzip", QStringList() << "-f" << QString::fromStdString(segment));
+
+  file = fopen(path.c_str(), "a");
+  if (!file) {
+    // Lines are dropped and counted until the log can be reopened
+    cerr << "Error: can not reopen log " << path << ".\n";
+  }
+  segment_bytes = 0;
+  last_sync = seconds_now();
+}
@@ -0,0 +1,62 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Continuous mode log file. write() only appends to an in-memory batch;
+// a writer thread flushes batches in large writes, fsyncs periodically and
+// rotates the file by size or age. Closed segments are renamed with their
+// closing time and optionally compressed by an external zstd or gzip. If
+// the disk falls behind, lines are dropped (and counted) rather than
+// blocking the caller.
+class LogSink {
+public:
+  ~LogSink();
+
+  // max_bytes and max_seconds of 0 disable the corresponding rotation,
+  // compressor is "zstd", "gzip" or empty.
+  bool open(const std::string& path, uint64_t max_bytes, int64_t max_seconds, const std::string& compressor);
+  bool is_open() const { return opened; }
+  void close();
+
+  void write(const std::string& line);
+
+  uint64_t dropped() const { return dropped_lines; }
+
+private:
+  void run();
+  void write_batch();
+  void rotate();
+
+  std::string path;
+  std::string compressor;
+  uint64_t max_bytes = 0;
+  int64_t max_seconds = 0;
+
+  FILE* file = nullptr;
+  bool opened = false;
+  uint64_t segment_bytes = 0;
+  int64_t segment_start = 0;
+  int64_t last_sync = 0;
+
+  std::thread writer;
+  std::mutex queue_mutex;
+  std::condition_variable wake;
+  std::string pending;
+  std::string writing;
+  bool stopping = false;
+  uint64_t dropped_lines = 0;
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+
+#include "clock.h"
+#include "link.h"
+#include "poller.h"
+#include "timecode.h"
+#include "trace.h"
+
+// Frame accurate relative moves (commands m and j) on any port of a
+// Poller: frame steps and jogs, then timer1 read once the tape stands
+// still and the frames missed or overshot corrected by steps. Every timer1
+// reply is passed to on_position, for the journal and the sidecar.
+template <typename Port>
+class Motion {
+public:
+  Motion(Poller<Port>& poller, Link<Port>& link, int fps) : poller(poller), link(link), fps(fps) {}
+
+  // Timer1 once the tape stands still, two reads a frame apart alike, 1 s
+  // at most
+  bool read_still_position(Timecode& position);
+  // Frame steps back to back, each one waiting for its reply only, returns
+  // the number acknowledged
+  int64_t send_steps(int64_t count);
+  // Steps to the target from a still position, reading timer1 after each
+  // pass only; a pass that did not land is corrected by the frames missed
+  // or overshot
+  int step_to(const Timecode& target, Timecode& position, int64_t& steps);
+
+  // Relative move of frames, negative for reverse
+  int step_frames(int64_t frames, bool verbose);
+  // Jog at rate times play speed for a duration, then still; the frames
+  // the transport ramps missed or overshot, up to one second of them, are
+  // corrected by steps, more is an error
+  int jog(double rate, double seconds, bool verbose);
+
+  std::function<void(const Sony9PinRemote::TimeCode& tc, const Stamp& tx, const Stamp& rx)> on_position;
+
+private:
+  bool read_position(Timecode& position);
+
+  Poller<Port>& poller;
+  Link<Port>& link;
+  int fps;
+};
+
+template <typename Port>
+bool Motion<Port>::read_position(Timecode& position) {
+  Sony9PinRemote::TimeCode tc;
+  if (!poller.query(command_frames::timer1) || !decode_timecode(link.frame(), link.frame_size(), tc, nullptr))
+    return false;
+  if (on_position)
+    on_position(tc, link.tx(), link.rx());
+  position = Timecode::from_deck(tc, fps);
+  return true;
+}
+
+template <typename Port>
+bool Motion<Port>::read_still_position(Timecode& position) {
+  const int64_t frame_ns = fps == 30 ? 1001000000 / 30 : 1000000000 / fps;
+  const auto deadline = stamp_now().monotonic + 1000000000;
+  Timecode last;
+  bool read = false;
+  for (;;) {
+    if (read_position(position)) {
+      if (read && position == last)
+        return true;
+      last = position;
+      read = true;
+    } else if (!poller.ready()) {
+      return false;
+    }
+    if (stamp_now().monotonic > deadline)
+      return read;
+    wait_until(stamp_now().monotonic + frame_ns);
+  }
+}
+
+template <typename Port>
+int64_t Motion<Port>::send_steps(int64_t count) {
+  TraceSpan span("send_steps");
+  const auto& step = count < 0 ? command_frames::frame_step_reverse : command_frames::frame_step_forward;
+  int64_t acked = 0;
+  for (int64_t i = 0; i < llabs(count); i++) {
+    if (poller.query(step))
+      acked += is_ack(link.frame());
+    else if (!poller.ready())
+      break;
+  }
+  return acked;
+}
+
+template <typename Port>
+int Motion<Port>::step_to(const Timecode& target, Timecode& position, int64_t& steps) {
+  const int max_passes = 3;
+  for (int pass = 0; pass < max_passes && position != target; pass++) {
+    steps += send_steps(target - position);
+    if (!read_still_position(position)) {
+      std::cerr << "Error: timer1 failed.\n";
+      return 1;
+    }
+  }
+  if (position != target) {
+    char text[Timecode::format_size];
+    target.format(text);
+    std::cerr << "Error: tape is " << position - target << " frames from " << text << " after " << max_passes << " passes.\n";
+    return 1;
+  }
+  return 0;
+}
+
+template <typename Port>
+int Motion<Port>::step_frames(int64_t frames, bool verbose) {
+  TraceSpan span("step_frames");
+  Timecode start;
+  if (!read_still_position(start)) {
+    std::cerr << "Error: timer1 failed.\n";
+    return 1;
+  }
+  if (verbose)
+    std::cerr << "Info: step " << frames << " frames.\n";
+  const auto begin = stamp_now().monotonic;
+  Timecode position = start;
+  int64_t steps = 0;
+  const auto result = step_to(start + frames, position, steps);
+  std::cerr << "Info: moved " << position - start << " frames in " << (stamp_now().monotonic - begin) / 1000000 << " ms, "
+            << steps << " steps.\n";
+  return result;
+}
+
+template <typename Port>
+int Motion<Port>::jog(double rate, double seconds, bool verbose) {
+  TraceSpan span("jog");
+  Timecode start;
+  if (!read_still_position(start)) {
+    std::cerr << "Error: timer1 failed.\n";
+    return 1;
+  }
+  // Speed data N is 10^(N/32 - 2) times play speed, 0 still
+  const auto speed = (uint8_t)std::min(127.0, std::max(1.0, floor(32 * (log10(fabs(rate)) + 2) + 0.5)));
+  const uint8_t cmd2 = rate < 0 ? 0x21 : 0x11;
+  const double play = fps == 30 ? 30000.0 / 1001 : fps;
+  const auto expected = (int64_t)floor(rate * play * seconds + 0.5);
+  if (verbose) {
+    std::cerr << "Info: jog at " << pow(10, speed / 32.0 - 2) * (rate < 0 ? -1 : 1) << " times play speed for " << seconds
+              << " s.\n";
+  }
+
+  const auto begin = stamp_now().monotonic;
+  if (!poller.query(CommandFrame(0x20, cmd2, speed)) || !is_ack(link.frame())) {
+    std::cerr << "Error: jog failed.\n";
+    return 1;
+  }
+  wait_until(begin + (int64_t)(seconds * 1e9));
+  if (!poller.query(CommandFrame(0x20, cmd2, 0)) || !is_ack(link.frame())) {
+    std::cerr << "Error: jog still failed.\n";
+    return 1;
+  }
+  const auto stilled = stamp_now().monotonic;
+
+  Timecode position;
+  if (!read_still_position(position)) {
+    std::cerr << "Error: timer1 failed.\n";
+    return 1;
+  }
+  const auto jogged = position - start;
+  int64_t steps = 0;
+  int result = 0;
+  if (llabs(jogged - expected) <= fps) {
+    result = step_to(start + expected, position, steps);
+  } else {
+    std::cerr << "Error: jogged " << jogged << " frames for " << expected << ", more than a second off, not corrected.\n";
+    result = 1;
+  }
+  std::cerr << "Info: moved " << position - start << " frames (" << jogged << " jogged in "
+            << (stilled - begin) / 1000000 << " ms, " << steps << " steps) in " << (stamp_now().monotonic - begin) / 1000000
+            << " ms.\n";
+  return result;
+}
+
+#endif
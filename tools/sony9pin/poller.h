@@ -0,0 +1,220 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "clock.h"
+#include "format.h"
+#include "link.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "trace.h"
+
+// Outcome of one continuous mode poll
+struct Poll {
+  unsigned queries = 0;          // PollScheduler::Query of the slot
+  bool status = false;           // status data read and decoded
+  bool timecode = false;         // timer1 read and decoded
+  bool userbits = false;         // LTC user bits read and decoded
+  int failed = 0;                // queries without a reply
+  int undecoded = 0;             // replies that are not the one asked for
+  int dropped = 0;               // late replies given up on
+  Stamp tx;                      // timer1 request written
+  Stamp rx;                      // last byte of the timer1 reply peeked, else the failure
+  Sony9PinRemote::UserBits ub = {};
+};
+
+// Commands on a link one at a time, on any port (serial port, simulated
+// deck) and the clock of clock.h. A reply that did not come in time stays
+// pending: before the next command it is waited for with doubling timeouts,
+// from the typical latency of the deck up to twice the response timeout,
+// then dropped. The settle time of the deck after a transport command is
+// waited out there as well.
+template <typename Port>
+class Poller {
+public:
+  Poller(Port& port, Link<Port>& link) : port(port), link(link) {}
+
+  void set_timing(uint32_t response_timeout, uint32_t typical_latency, uint32_t settle) {
+    response_timeout_ms = response_timeout;
+    typical_latency_ms = typical_latency;
+    settle_ms = settle;
+  }
+  uint32_t timeout_ms() const { return response_timeout_ms; }
+
+  // For commands sent through the controller, which leave their reply
+  // pending the same way when it does not come in time
+  void set_pending(bool value) { reply_pending = value; }
+  bool pending() const { return reply_pending; }
+  // Starts the settle time, after a transport command
+  void settle() {
+    if (settle_ms)
+      settle_until = stamp_now().monotonic + (int64_t)settle_ms * 1000000;
+  }
+
+  // Returns false if a pending reply was dropped
+  bool ready();
+  // Drops a pending reply and anything buffered without waiting
+  void drop() {
+    port.clear();
+    reply_pending = false;
+  }
+  // Sends a prebuilt frame once ready, the reply in link.frame(); fails on
+  // no reply, left pending
+  bool query(const CommandFrame& command);
+
+  // Request to reply of the last query
+  int64_t reply_ns() const { return last_reply_ns; }
+  uint64_t drained() const { return drained_replies; }
+  uint64_t dropped() const { return dropped_replies; }
+
+  // Called after every query, with whether a reply came and was a NAK
+  std::function<void(bool received, bool nak)> on_reply;
+
+  // Continuous mode: status, timer1 and LTC user bits in the slots of the
+  // scheduler (everything but the user bits until it is started), the
+  // rules evaluated on each reply with transport for their commands.
+  // sample(state, previous, poll, first) gets every poll and returns true
+  // to stop, so does an exit rule.
+  template <typename Sample>
+  void run(PollScheduler& scheduler, Rules& rules, const Rules::Transport& transport, Sample sample);
+
+private:
+  Port& port;
+  Link<Port>& link;
+  uint32_t response_timeout_ms = 1000;
+  uint32_t typical_latency_ms = 10;
+  uint32_t settle_ms = 0;
+  int64_t settle_until = 0;
+  bool reply_pending = false;
+  int64_t last_reply_ns = 0;
+  uint64_t drained_replies = 0;
+  uint64_t dropped_replies = 0;
+};
+
+template <typename Port>
+bool Poller<Port>::ready() {
+  if (settle_until) {
+    wait_until(settle_until);
+    settle_until = 0;
+  }
+  if (!reply_pending)
+    return true;
+  reply_pending = false;
+
+  const auto deadline = stamp_now().monotonic + 2 * (int64_t)response_timeout_ms * 1000000;
+  int64_t wait_ms = std::max<uint32_t>(typical_latency_ms, 1);
+  for (;;) {
+    if (link.wait(wait_ms)) {
+      char bytes[FrameDecoder::max_size];
+      port.read(bytes, link.frame_size());
+      drained_replies++;
+      return true;
+    }
+    const auto remaining_ms = (deadline - stamp_now().monotonic) / 1000000;
+    if (remaining_ms <= 0)
+      break;
+    wait_ms = std::min(wait_ms * 2, remaining_ms);
+  }
+  port.clear();
+  dropped_replies++;
+  return false;
+}
+
+template <typename Port>
+bool Poller<Port>::query(const CommandFrame& command) {
+  ready();
+  TraceSpan span("query");
+  const auto start = stamp_now().monotonic;
+  reply_pending = true;
+  const bool received = link.query(command, response_timeout_ms);
+  if (received) {
+    reply_pending = false;
+    last_reply_ns = stamp_now().monotonic - start;
+  }
+  if (on_reply)
+    on_reply(received, received && is_nak(link.frame()));
+  return received;
+}
+
+template <typename Port>
+template <typename Sample>
+void Poller<Port>::run(PollScheduler& scheduler, Rules& rules, const Rules::Transport& transport, Sample sample) {
+  State previous = {};
+  bool first = true;
+  bool stop = false;
+  while (!stop) {
+    TraceSpan pollSpan("poll");
+    State state = previous;
+    Poll poll;
+    const auto droppedBefore = dropped_replies;
+    poll.queries = scheduler.started() ? scheduler.next_slot() : PollScheduler::Timecode | PollScheduler::Status;
+
+    if (poll.queries & PollScheduler::Status) {
+      const auto statusStart = stamp_now();
+      // Full status data in the same round trip, for the extended bits
+      const bool statusReceived = query(command_frames::status_sense);
+      if (!statusReceived) {
+        poll.failed++;
+      } else if (!decode_status(link.frame(), link.frame_size(), state.st)) {
+        poll.undecoded++;
+      } else {
+        state.data_size = decode_status_data(link.frame(), link.frame_size(), state.data);
+        poll.status = true;
+      }
+      const auto statusRx = statusReceived ? link.rx() : stamp_now();
+      scheduler.done(PollScheduler::Status, stamp_now().monotonic - statusStart.monotonic);
+      if (!rules.empty()) {
+        TraceSpan span("rules");
+        if (rules.status(state.st, previous.st, first, statusRx, previous.tc, transport))
+          stop = true;
+      }
+    }
+
+    const auto timecodeStart = stamp_now();
+    const bool timecodeReceived = query(command_frames::timer1);
+    poll.tx = timecodeReceived ? link.tx() : timecodeStart;
+    poll.rx = timecodeReceived ? link.rx() : stamp_now();
+    if (!timecodeReceived) {
+      poll.failed++;
+    } else if (!decode_timecode(link.frame(), link.frame_size(), state.tc, nullptr)) {
+      poll.undecoded++;
+    } else {
+      poll.timecode = true;
+    }
+    scheduler.done(PollScheduler::Timecode, stamp_now().monotonic - timecodeStart.monotonic);
+    if (!rules.empty()) {
+      TraceSpan span("rules");
+      if (rules.timecode(state.tc, previous.tc, first, poll.rx, transport))
+        stop = true;
+    }
+
+    if (poll.queries & PollScheduler::Userbits) {
+      const auto ubTx = stamp_now();
+      Sony9PinRemote::TimeCode ltc;
+      if (!query(command_frames::ltc_tc_ub))
+        poll.failed++;
+      else if (!decode_timecode(link.frame(), link.frame_size(), ltc, &poll.ub))
+        poll.undecoded++;
+      else
+        poll.userbits = true;
+      scheduler.done(PollScheduler::Userbits, stamp_now().monotonic - ubTx.monotonic);
+    }
+
+    poll.dropped = (int)(dropped_replies - droppedBefore);
+    if (sample(state, previous, poll, first))
+      stop = true;
+    previous = state;
+    first = false;
+  }
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include <QSerialPort>
+#include <QSerialPortInfo>
+#include <iostream>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+
+int open_port(QSerialPort& port, const QString& serialPortName, bool verbose) {
+  // Config
+  bool portNumberIsOk = false;
+  const auto portNumber = serialPortName.toInt(&portNumberIsOk);
+  if (portNumberIsOk) {
+    const auto portInfos = QSerialPortInfo::availablePorts();
+    if (portNumber >= portInfos.size()) {
+      std::cerr << "Error: wrong port index.\n";
+      return 1;
+    }
+    const auto& portInfo = portInfos[portNumber];
+    port.setPort(portInfo);
+  } else {
+    port.setPortName(serialPortName);
+  }
+  port.setBaudRate(Sony9PinSerial::BAUDRATE);
+  port.setParity(QSerialPort::OddParity);
+
+  // Open
+  if (verbose) {
+    std::cerr << "Info: open device " << port.portName().toStdString() << ".\n";
+  }
+  if (!port.open(QIODevice::ReadWrite)) {
+    std::cerr << "Error: open device fail.\n";
+    return 1;
+  }
+  //QThread::msleep(2000);
+  if (verbose) {
+    std::cerr << "Info: open device OK.\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "profiles.h"
+
+#include <QFile>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "csv.h"
+
+using namespace std;
+
+extern void device_make_model(uint16_t device_type, string& device_make, string& device_model);
+
+namespace {
+
+const char* const columns[] = { "device type", "make", "model", "response timeout (ms)", "typical latency (ms)",
+                                "settle (ms)", "cue timeout (ms)", "frame rate", "timer2", "ltc", "vitc", "source" };
+enum Column {
+  DeviceType, Make, Model, ResponseTimeout, TypicalLatency, Settle, CueTimeout, FrameRate, Timer2, Ltc, Vitc, Source,
+  column_count
+};
+
+bool parse_number(const string& cell, int base, uint32_t max, uint32_t& value) {
+  const auto text = trim(cell);
+  char* end;
+  const auto number = strtoul(text.c_str(), &end, base);
+  if (text.empty() || *end || number > max)
+    return false;
+  value = (uint32_t)number;
+  return true;
+}
+
+bool parse_flag(const string& cell, bool& value) {
+  const auto text = lower(trim(cell));
+  value = text == "yes";
+  return value || text == "no";
+}
+
+// Model names of a device type in the device database, lower case: "DSR-1500,
+// DSR-1500A" is two
+vector<string> device_models(uint16_t device_type) {
+  string make;
+  string model;
+  device_make_model(device_type, make, model);
+  return split_list(model, ',');
+}
+
+// The status data has no 525/625 bit, only the device type tells: PAL
+// variants are named "...P" (BVW-75P) or "..., PAL" in the device database
+bool is_pal(uint16_t device_type) {
+  string make;
+  string model;
+  device_make_model(device_type, make, model);
+  for (const auto& name : split_list(model, ',')) {
+    if (name == "pal" || name.find("625") != string::npos)
+      return true;
+    if (name.size() >= 2 && name.back() == 'p' && isdigit((unsigned char)name[name.size() - 2]))
+      return true;
+  }
+  return false;
+}
+
+const vector<DeckProfile>& profiles() {
+  static const vector<DeckProfile> table = [] {
+    vector<DeckProfile> rows;
+    QFile file(":/deck_profiles.csv");
+    string error;
+    if (!file.open(QIODevice::ReadOnly)) {
+      cerr << "Error: no deck profiles built in, defaults used.\n";
+    } else {
+      istringstream in(file.readAll().toStdString());
+      if (!read_profiles(in, rows, error))
+        cerr << "Error: deck profiles, " << error << ", defaults used.\n";
+    }
+    return rows;
+  }();
+  return table;
+}
+
+DeckProfile pal_profile() {
+  DeckProfile profile;
+  profile.name = "default, PAL";
+  profile.fps = 25;
+  return profile;
+}
+
+}
+
+bool read_profiles(istream& in, vector<DeckProfile>& profiles, string& error) {
+  vector<string> header, cells;
+  if (!read_record(in, header)) {
+    error = "no header";
+    return false;
+  }
+  size_t index[column_count];
+  for (int column = 0; column < column_count; column++) {
+    index[column] = header.size();
+    for (size_t i = 0; i < header.size(); i++) {
+      if (lower(trim(header[i])) == columns[column])
+        index[column] = i;
+    }
+    if (index[column] == header.size()) {
+      error = string("no ") + columns[column] + " column";
+      return false;
+    }
+  }
+
+  vector<DeckProfile> rows;
+  for (int line = 2; read_record(in, cells); line++) {
+    if (cells.size() == 1 && trim(cells[0]).empty())
+      continue;
+    cells.resize(header.size());
+    DeckProfile profile;
+    profile.name = trim(cells[index[Make]]) + ' ' + trim(cells[index[Model]]);
+    profile.models = split_list(cells[index[Model]], '/');
+    bool valid = !profile.models.empty();
+    for (const auto& type : split_list(cells[index[DeviceType]], '/')) {
+      uint32_t value;
+      valid = valid && parse_number(type, 16, 0xFFFF, value);
+      profile.device_types.push_back((uint16_t)value);
+    }
+    uint32_t fps = 0;
+    valid = valid && parse_number(cells[index[ResponseTimeout]], 10, 60000, profile.response_timeout_ms) &&
+            parse_number(cells[index[TypicalLatency]], 10, 60000, profile.typical_latency_ms) &&
+            parse_number(cells[index[Settle]], 10, 60000, profile.settle_ms) &&
+            parse_number(cells[index[CueTimeout]], 10, 3600000, profile.cue_timeout_ms) &&
+            parse_number(cells[index[FrameRate]], 10, 60, fps) && fps >= 24 &&
+            parse_flag(cells[index[Timer2]], profile.timer2) && parse_flag(cells[index[Ltc]], profile.ltc) &&
+            parse_flag(cells[index[Vitc]], profile.vitc);
+    profile.fps = (int)fps;
+    profile.source = lower(trim(cells[index[Source]]));
+    if (!valid || (profile.source != "default" && profile.source != "manual" && profile.source != "measured")) {
+      error = "line " + to_string(line) + " is not valid";
+      return false;
+    }
+    rows.push_back(profile);
+  }
+  profiles.swap(rows);
+  return true;
+}
+
+const DeckProfile& find_profile(uint16_t device_type) {
+  static const DeckProfile default_profile;
+  static const DeckProfile default_pal_profile = pal_profile();
+  for (const auto& profile : profiles()) {
+    if (find(profile.device_types.begin(), profile.device_types.end(), device_type) != profile.device_types.end())
+      return profile;
+  }
+  for (const auto& model : device_models(device_type)) {
+    if (const auto profile = find_profile(model))
+      return *profile;
+  }
+  return is_pal(device_type) ? default_pal_profile : default_profile;
+}
+
+const DeckProfile* find_profile(const string& model) {
+  const auto name = lower(trim(model));
+  for (const auto& profile : profiles()) {
+    if (find(profile.models.begin(), profile.models.end(), name) != profile.models.end())
+      return &profile;
+  }
+  return nullptr;
+}
@@ -0,0 +1,48 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Per-model timing and capabilities, from docs/_data/deck_profiles.csv
+// (built into the program), keyed by the device types returned by
+// device_type_request() and by model names, as in decks.csv. Unknown
+// models get the worst-case defaults the tool has always used.
+struct DeckProfile {
+  std::string name = "default";
+  std::vector<uint16_t> device_types;
+  std::vector<std::string> models;      // lower case
+  uint32_t response_timeout_ms = 1000;  // reply timeout for any command
+  uint32_t typical_latency_ms = 10;     // request to reply, idle deck
+  uint32_t settle_ms = 0;               // wait after a transport change before the next command
+  uint32_t cue_timeout_ms = 180000;     // longest cue_up_with_data() from tape end to end
+  int fps = 30;                         // nominal frame rate
+  bool timer2 = true;                   // current_time_sense_timer2()
+  bool ltc = true;                      // current_time_sense_ltc_tc_ub()
+  bool vitc = true;                     // current_time_sense_vitc_tc_ub()
+  // Where the figures come from: "default" (not checked on the model),
+  // "manual" or "measured" (latency percentiles of --stress on the deck)
+  std::string source = "default";
+};
+
+// Rows of a deck_profiles.csv, false with the line and the problem in
+// error if one does not parse
+bool read_profiles(std::istream& in, std::vector<DeckProfile>& profiles, std::string& error);
+
+// Profile of the given device type, else of one of its model names in the
+// device database, else the default profile, at 25 fps if the device
+// database names a PAL variant
+const DeckProfile& find_profile(uint16_t device_type);
+// Profile of a model name, for a deck whose device type does not tell it;
+// nullptr if unknown
+const DeckProfile* find_profile(const std::string& model);
+
+#endif
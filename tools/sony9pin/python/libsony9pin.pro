@@ -0,0 +1,30 @@
+TEMPLATE = lib
+TARGET = sony9pin
+CONFIG += c++14
+QT += serialport
+QT -= gui
+DEFINES += SONY9PIN_LIBRARY
+
+# Lib
+INCLUDEPATH += ..
+
+# Input
+HEADERS += ../capi.h \
+           ../csv.h \
+           ../link.h \
+           ../profiles.h \
+           ../timecode.h \
+           ../timeline.h
+
+SOURCES += ../capi.cpp \
+           ../clock.cpp \
+           ../csv.cpp \
+           ../devices.cpp \
+           ../format.cpp \
+           ../frame.cpp \
+           ../link.cpp \
+           ../port.cpp \
+           ../profiles.cpp \
+           ../timeline.cpp
+
+RESOURCES += ../profiles.qrc
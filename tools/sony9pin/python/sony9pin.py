@@ -0,0 +1,225 @@
+#  Copyright (c) MIPoPS. All Rights Reserved.
+#
+#  Use of this source code is governed by a BSD-3-Clause license that can
+#  be found in the LICENSE.txt file in the same directory.
+
+"""In-process Sony 9-pin deck control over libsony9pin (see capi.h).
+
+    with sony9pin.Deck("/dev/ttyUSB0") as deck:
+        print(deck.type())
+        deck.cue("00:01:00;00")
+        deck.play()
+        print(deck.timecode())
+
+The library is looked up in $SONY9PIN_LIBRARY, next to this file, then in
+the system library path.
+"""
+
+import asyncio
+import ctypes
+import ctypes.util
+import os
+import sys
+from collections import namedtuple
+
+__all__ = ["Deck", "Error", "Timecode", "Sample", "TIMER1", "TIMER2", "LTC", "VITC"]
+
+TIMER1, TIMER2, LTC, VITC = 1, 2, 3, 4
+
+
+class Error(Exception):
+    pass
+
+
+Timecode = namedtuple("Timecode", "hour minute second frame is_df is_cf userbits frames")
+Timecode.__str__ = lambda tc: "%02d:%02d:%02d%s%02d" % (tc.hour, tc.minute, tc.second, ";" if tc.is_df else ":", tc.frame)
+
+Sample = namedtuple("Sample", "realtime_ms status timecode")
+
+
+class _Timecode(ctypes.Structure):
+    _fields_ = [
+        ("hour", ctypes.c_uint8),
+        ("minute", ctypes.c_uint8),
+        ("second", ctypes.c_uint8),
+        ("frame", ctypes.c_uint8),
+        ("is_df", ctypes.c_uint8),
+        ("is_cf", ctypes.c_uint8),
+        ("userbits", ctypes.c_uint8 * 4),
+        ("frames", ctypes.c_int64),
+    ]
+
+    def to_tuple(self):
+        return Timecode(self.hour, self.minute, self.second, self.frame, bool(self.is_df), bool(self.is_cf),
+                        bytes(self.userbits), self.frames)
+
+
+class _Sample(ctypes.Structure):
+    _fields_ = [
+        ("realtime_ms", ctypes.c_int64),
+        ("status", ctypes.c_uint32),
+        ("tc", _Timecode),
+    ]
+
+
+_Callback = ctypes.CFUNCTYPE(None, ctypes.POINTER(_Sample), ctypes.c_void_p)
+
+
+def _load():
+    names = []
+    if os.environ.get("SONY9PIN_LIBRARY"):
+        names.append(os.environ["SONY9PIN_LIBRARY"])
+    here = os.path.dirname(os.path.abspath(__file__))
+    if sys.platform == "win32":
+        names.append(os.path.join(here, "sony9pin.dll"))
+    elif sys.platform == "darwin":
+        names.append(os.path.join(here, "libsony9pin.dylib"))
+    else:
+        names.append(os.path.join(here, "libsony9pin.so"))
+    found = ctypes.util.find_library("sony9pin")
+    if found:
+        names.append(found)
+    for name in names:
+        if os.path.exists(name) or name == found:
+            return ctypes.CDLL(name)
+    raise Error("libsony9pin not found, set SONY9PIN_LIBRARY")
+
+
+_lib = _load()
+_lib.sony9pin_last_error.restype = ctypes.c_char_p
+_lib.sony9pin_open.argtypes = [ctypes.c_char_p]
+_lib.sony9pin_open.restype = ctypes.c_void_p
+_lib.sony9pin_close.argtypes = [ctypes.c_void_p]
+_lib.sony9pin_close.restype = None
+_lib.sony9pin_status_count.restype = ctypes.c_size_t
+_lib.sony9pin_status_name.argtypes = [ctypes.c_size_t]
+_lib.sony9pin_status_name.restype = ctypes.c_char_p
+_lib.sony9pin_status.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint32)]
+_lib.sony9pin_device_type.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint16),
+                                      ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t]
+_lib.sony9pin_profile_name.argtypes = [ctypes.c_void_p]
+_lib.sony9pin_profile_name.restype = ctypes.c_char_p
+_lib.sony9pin_use_model.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.sony9pin_fps.argtypes = [ctypes.c_void_p]
+_lib.sony9pin_transport.argtypes = [ctypes.c_void_p, ctypes.c_char]
+_lib.sony9pin_cue.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.sony9pin_read_timecode.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(_Timecode)]
+_lib.sony9pin_monitor_start.argtypes = [ctypes.c_void_p, ctypes.c_uint32, _Callback, ctypes.c_void_p]
+_lib.sony9pin_monitor_stop.argtypes = [ctypes.c_void_p]
+_lib.sony9pin_monitor_stop.restype = None
+
+STATUS_FIELDS = tuple(_lib.sony9pin_status_name(i).decode() for i in range(_lib.sony9pin_status_count()))
+
+
+def _status(word):
+    return {name: bool(word >> i & 1) for i, name in enumerate(STATUS_FIELDS)}
+
+
+def _check(result):
+    if result:
+        raise Error(_lib.sony9pin_last_error().decode())
+
+
+class Deck:
+    """One deck on one serial port, port is a name or an index."""
+
+    def __init__(self, port):
+        self._deck = _lib.sony9pin_open(str(port).encode())
+        if not self._deck:
+            raise Error(_lib.sony9pin_last_error().decode())
+        self._callback = None
+
+    def close(self):
+        if self._deck:
+            _lib.sony9pin_close(self._deck)
+            self._deck = None
+            self._callback = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def status(self):
+        """Status fields by name, as in continuous mode."""
+        word = ctypes.c_uint32()
+        _check(_lib.sony9pin_status(self._deck, ctypes.byref(word)))
+        return _status(word.value)
+
+    def type(self):
+        device_type = ctypes.c_uint16()
+        make = ctypes.create_string_buffer(256)
+        model = ctypes.create_string_buffer(256)
+        _check(_lib.sony9pin_device_type(self._deck, ctypes.byref(device_type), make, len(make), model, len(model)))
+        return {
+            "device_type": device_type.value,
+            "device_make": make.value.decode(),
+            "device_model": model.value.decode(),
+            "profile": _lib.sony9pin_profile_name(self._deck).decode(),
+            "fps": _lib.sony9pin_fps(self._deck),
+        }
+
+    def use_model(self, model):
+        """Timings of a model of deck_profiles.csv, when the device type does not tell it."""
+        _check(_lib.sony9pin_use_model(self._deck, str(model).encode()))
+
+    def _transport(self, command):
+        _check(_lib.sony9pin_transport(self._deck, command))
+
+    def eject(self):
+        self._transport(b"e")
+
+    def fast_forward(self):
+        self._transport(b"f")
+
+    def play(self):
+        self._transport(b"p")
+
+    def rewind(self):
+        self._transport(b"r")
+
+    def stop(self):
+        self._transport(b"s")
+
+    def frame_step_forward(self):
+        self._transport(b"x")
+
+    def frame_step_reverse(self):
+        self._transport(b"w")
+
+    def cue(self, timecode):
+        """timecode is "HH:MM:SS:FF", ';' before the frames for drop-frame."""
+        _check(_lib.sony9pin_cue(self._deck, str(timecode).encode()))
+
+    def timecode(self, source=TIMER1):
+        tc = _Timecode()
+        _check(_lib.sony9pin_read_timecode(self._deck, source, ctypes.byref(tc)))
+        return tc.to_tuple()
+
+    def monitor(self, callback, interval_ms=0):
+        """Calls callback(Sample) from the deck thread on every change of
+        status or timer1, until stop_monitor()."""
+        def trampoline(sample, user):
+            sample = sample.contents
+            callback(Sample(sample.realtime_ms, _status(sample.status), sample.tc.to_tuple()))
+        self._callback = _Callback(trampoline)
+        _check(_lib.sony9pin_monitor_start(self._deck, interval_ms, self._callback, None))
+
+    def stop_monitor(self):
+        _lib.sony9pin_monitor_stop(self._deck)
+        self._callback = None
+
+    async def samples(self, interval_ms=0):
+        """Async iterator over monitor samples."""
+        loop = asyncio.get_running_loop()
+        queue = asyncio.Queue()
+        self.monitor(lambda sample: loop.call_soon_threadsafe(queue.put_nowait, sample), interval_ms)
+        try:
+            while True:
+                yield await queue.get()
+        finally:
+            self.stop_monitor()
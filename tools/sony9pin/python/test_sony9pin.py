@@ -0,0 +1,170 @@
+#  Copyright (c) MIPoPS. All Rights Reserved.
+#
+#  Use of this source code is governed by a BSD-3-Clause license that can
+#  be found in the LICENSE.txt file in the same directory.
+
+"""sony9pin.py against a simulated deck on a pseudo-terminal (POSIX only):
+
+    SONY9PIN_LIBRARY=path/to/libsony9pin.so python3 -m unittest test_sony9pin
+
+Skipped if the library can not be loaded.
+"""
+
+import os
+import select
+import sys
+import threading
+import time
+import unittest
+
+try:
+    import sony9pin
+except Exception as error:  # library not built
+    sony9pin = None
+    load_error = str(error)
+
+
+def to_bcd(value):
+    return value // 10 << 4 | value % 10
+
+
+class FakeDeck:
+    """Deck in remote with a tape, as bench/fakedeck.cpp: device type 0x00e0,
+    stop or play, timecode running while playing, cues refused."""
+
+    def __init__(self, device_type=0x00E0):
+        import tty
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.master)
+        tty.setraw(self.slave)
+        self.name = os.ttyname(self.slave)
+        self.device_type = device_type
+        self.playing = False
+        self.frames = 0
+        self.commands = []
+        self.running = True
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def close(self):
+        self.running = False
+        self.thread.join()
+        os.close(self.master)
+        os.close(self.slave)
+
+    def run(self):
+        buffer = b""
+        while self.running:
+            if not select.select([self.master], [], [], 0.05)[0]:
+                continue
+            buffer += os.read(self.master, 64)
+            while len(buffer) >= 3:
+                size = 3 + (buffer[0] & 0x0F)
+                if len(buffer) < size:
+                    break
+                frame = buffer[:size]
+                if sum(frame[:-1]) & 0xFF != frame[-1]:
+                    buffer = buffer[1:]
+                    continue
+                buffer = buffer[size:]
+                self.reply(frame)
+
+    def send(self, cmd1, cmd2, data=b""):
+        frame = bytes([cmd1 | len(data), cmd2]) + bytes(data)
+        os.write(self.master, frame + bytes([sum(frame) & 0xFF]))
+
+    def reply(self, command):
+        cmd1, cmd2 = command[0] & 0xF0, command[1]
+        self.commands.append((cmd1, cmd2))
+        if self.playing:
+            self.frames += 1
+        if cmd1 == 0x00 and cmd2 == 0x11:
+            self.send(0x10, 0x11, [self.device_type >> 8, self.device_type & 0xFF])
+        elif cmd1 == 0x20 and cmd2 == 0x31:
+            # Refuses cues
+            self.send(0x10, 0x12, [0x01])
+        elif cmd1 == 0x20:
+            self.playing = cmd2 == 0x01
+            self.send(0x10, 0x01)
+        elif cmd1 == 0x60 and cmd2 == 0x20 and len(command) > 3:
+            # Remote, media in, stop or play, servo locked while playing
+            status = [0] * 16
+            status[1] = 0x01 if self.playing else 0x20
+            status[2] = 0x80 if self.playing else 0x00
+            start, count = command[2] >> 4, command[2] & 0x0F
+            self.send(0x70, 0x20, status[start:start + count])
+        elif cmd1 == 0x60 and cmd2 == 0x0C and len(command) > 3:
+            frames = self.frames
+            tc = [to_bcd(frames % 30), to_bcd(frames // 30 % 60), to_bcd(frames // 1800 % 60), to_bcd(frames // 108000 % 24)]
+            replies = {0x04: (0x00, tc), 0x08: (0x01, tc), 0x11: (0x04, tc + [0x12, 0x34, 0x56, 0x78]),
+                       0x22: (0x06, tc + [0, 0, 0, 0])}
+            if command[2] in replies:
+                self.send(0x70, *replies[command[2]])
+            else:
+                self.send(0x10, 0x12, [0x01])
+        else:
+            # NAK, unknown command
+            self.send(0x10, 0x12, [0x01])
+
+
+@unittest.skipIf(sony9pin is None, "libsony9pin not loaded: %s" % (None if sony9pin else load_error))
+@unittest.skipIf(sys.platform == "win32", "no pseudo-terminals")
+class DeckTest(unittest.TestCase):
+    def setUp(self):
+        self.fake = FakeDeck()
+        self.deck = sony9pin.Deck(self.fake.name)
+
+    def tearDown(self):
+        self.deck.close()
+        self.fake.close()
+
+    def test_type(self):
+        info = self.deck.type()
+        self.assertEqual(info["device_type"], 0x00E0)
+        self.assertEqual(info["device_model"], "HDD-1000")
+        self.assertEqual(info["profile"], "Sony HDD-1000")
+        self.assertEqual(info["fps"], 30)
+
+    def test_status(self):
+        status = self.deck.status()
+        self.assertTrue(status["stop"])
+        self.assertFalse(status["play"])
+        self.assertFalse(status["local"])
+
+    def test_transport(self):
+        self.deck.play()
+        status = self.deck.status()
+        self.assertTrue(status["play"])
+        self.assertTrue(status["servo_lock"])
+        self.assertIn((0x20, 0x01), self.fake.commands)
+        self.deck.stop()
+        self.assertTrue(self.deck.status()["stop"])
+
+    def test_timecode(self):
+        self.deck.play()
+        first = self.deck.timecode()
+        second = self.deck.timecode()
+        self.assertGreater(second.frames, first.frames)
+        ltc = self.deck.timecode(sony9pin.LTC)
+        self.assertEqual(ltc.userbits, bytes([0x12, 0x34, 0x56, 0x78]))
+
+    def test_nak(self):
+        with self.assertRaises(sony9pin.Error):
+            self.deck.cue("00:00:10:00")
+
+    def test_monitor(self):
+        samples = []
+        self.deck.play()
+        self.deck.monitor(samples.append, 10)
+        time.sleep(0.5)
+        self.deck.stop_monitor()
+        count = len(samples)
+        self.assertGreater(count, 1)
+        self.assertTrue(all(sample.status["play"] for sample in samples))
+        self.assertTrue(all(b.timecode.frames > a.timecode.frames for a, b in zip(samples, samples[1:])))
+        time.sleep(0.1)
+        self.assertEqual(len(samples), count)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,307 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "rules.h"
+#include "timeline.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const struct {
+  const char* name;
+  char command;
+} transports[] = {
+  { "stop", 's' },
+  { "play", 'p' },
+  { "eject", 'e' },
+  { "rewind", 'r' },
+  { "fast_forward", 'f' },
+  { "frame_step_forward", 'x' },
+  { "frame_step_reverse", 'w' },
+};
+
+#ifndef _WIN32
+const struct {
+  const char* name;
+  int signal;
+} signals[] = {
+  { "HUP", SIGHUP },
+  { "INT", SIGINT },
+  { "TERM", SIGTERM },
+  { "USR1", SIGUSR1 },
+  { "USR2", SIGUSR2 },
+};
+
+// Without a reader a FIFO can not be opened non-blocking for writing,
+// open is retried when the rule fires
+int open_fifo(const string& path) {
+  return open(path.c_str(), O_WRONLY | O_NONBLOCK);
+}
+#endif
+
+bool parse_number(const string& text, int& value) {
+  char* end;
+  value = strtol(text.c_str(), &end, 10);
+  return !text.empty() && !*end;
+}
+
+}
+
+bool parse_signal_target(const string& text, int& pid, int& signal, string& error) {
+#ifdef _WIN32
+  error = "signals are not supported on Windows";
+  return false;
+#else
+  signal = SIGUSR1;
+  const auto slash = text.find('/');
+  if (!parse_number(text.substr(0, slash), pid) || pid <= 0) {
+    error = "invalid pid in " + text;
+    return false;
+  }
+  if (slash != string::npos) {
+    const auto name = text.substr(slash + 1);
+    bool known = parse_number(name, signal);
+    for (const auto& entry : signals) {
+      if (name == entry.name || name == string("SIG") + entry.name) {
+        signal = entry.signal;
+        known = true;
+      }
+    }
+    if (!known) {
+      error = "unknown signal " + name;
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+Rules::~Rules() {
+#ifndef _WIN32
+  for (auto& rule : rules)
+    for (auto& action : rule.actions)
+      if (action.kind == Action::Fifo && action.fd >= 0)
+        ::close(action.fd);
+#endif
+}
+
+bool Rules::add(const string& spec, int rate, string& error) {
+  fps = rate;
+  Rule rule = {};
+  rule.spec = spec;
+  rule.latency_min = INT64_MAX;
+
+  // Event, a timecode event holds 3 separators itself
+  size_t end = 0;
+  if (spec.compare(0, 4, "tc>=") == 0) {
+    size_t separators = 0;
+    for (end = 4; end < spec.size(); end++) {
+      const char c = spec[end];
+      if ((c == ':' || c == ';' || c == '.') && ++separators > 3)
+        break;
+    }
+    const auto text = spec.substr(4, end - 4);
+    if (!Timecode::parse(text.c_str(), text.size(), fps, rule.target)) {
+      error = "invalid timecode " + text;
+      return false;
+    }
+    rule.is_timecode = true;
+  } else {
+    end = spec.find(':');
+    if (end == string::npos)
+      end = spec.size();
+    rule.rising = spec[0] != '!';
+    rule.bit = status_bit(spec.substr(rule.rising ? 0 : 1, end - (rule.rising ? 0 : 1)));
+    if (rule.bit < 0) {
+      error = "unknown event " + spec.substr(0, end);
+      return false;
+    }
+  }
+  rule.event = spec.substr(0, end);
+  if (end + 1 >= spec.size()) {
+    error = "no action for " + rule.event;
+    return false;
+  }
+
+  // Actions
+  size_t begin = end + 1;
+  while (begin <= spec.size()) {
+    auto next = spec.find(',', begin);
+    if (next == string::npos)
+      next = spec.size();
+    const auto text = spec.substr(begin, next - begin);
+    begin = next + 1;
+
+    Action action = {};
+    action.fd = -1;
+    bool found = false;
+    for (const auto& transport : transports) {
+      if (text == transport.name) {
+        action.kind = Action::Command;
+        action.command = transport.command;
+        found = true;
+      }
+    }
+    if (found) {
+    } else if (text == "exit") {
+      action.kind = Action::Exit;
+    } else if (text.compare(0, 5, "fifo=") == 0) {
+#ifdef _WIN32
+      error = "FIFO actions are not supported on Windows";
+      return false;
+#else
+      action.kind = Action::Fifo;
+      action.path = text.substr(5);
+      // A reader going away must fail the write, not end the process
+      signal(SIGPIPE, SIG_IGN);
+      action.fd = open_fifo(action.path);
+      if (action.fd < 0 && errno != ENXIO) {
+        error = "can not open FIFO " + action.path;
+        return false;
+      }
+#endif
+    } else if (text.compare(0, 7, "signal=") == 0) {
+#ifdef _WIN32
+      error = "signal actions are not supported on Windows";
+      return false;
+#else
+      action.kind = Action::Signal;
+      if (!parse_signal_target(text.substr(7), action.pid, action.signal, error))
+        return false;
+#endif
+    } else {
+      error = "unknown action " + text;
+      return false;
+    }
+    rule.actions.push_back(action);
+  }
+
+  rules.push_back(rule);
+  return true;
+}
+
+bool Rules::fire(Rule& rule, const Stamp& rx, const Sony9PinRemote::TimeCode& tc, const Transport& transport) {
+  bool exit = false, failed = false;
+  for (auto& action : rule.actions) {
+    switch (action.kind) {
+      case Action::Command: {
+        if (transport(action.command))
+          failed = true;
+        break;
+      }
+      case Action::Fifo: {
+#ifndef _WIN32
+        if (action.fd < 0)
+          action.fd = open_fifo(action.path);
+        char text[Timecode::format_size];
+        Timecode::from_deck(tc, fps).format(text);
+        const auto line = rule.event + ' ' + text + ' ' + to_string(rx.realtime) + '\n';
+        if (action.fd < 0 || write(action.fd, line.data(), line.size()) != (ssize_t)line.size()) {
+          failed = true;
+          // Reader gone, the next event reopens for the next one
+          if (action.fd >= 0 && errno == EPIPE) {
+            ::close(action.fd);
+            action.fd = -1;
+          }
+        }
+#endif
+        break;
+      }
+      case Action::Signal: {
+#ifndef _WIN32
+        if (kill(action.pid, action.signal))
+          failed = true;
+#endif
+        break;
+      }
+      case Action::Exit: {
+        exit = true;
+        break;
+      }
+    }
+  }
+
+  const auto latency = stamp_now().monotonic - rx.monotonic;
+  rule.fired++;
+  if (failed)
+    rule.failed++;
+  rule.latency_min = min(rule.latency_min, latency);
+  rule.latency_max = max(rule.latency_max, latency);
+  rule.latency_total += latency;
+  cerr << "Info: rule " << rule.event << " fired, reaction " << latency / 1000 << " us"
+       << (failed ? ", an action failed" : "") << ".\n";
+  return exit;
+}
+
+bool Rules::status(const Sony9PinRemote::Status& st, const Sony9PinRemote::Status& last, bool first,
+                   const Stamp& rx, const Sony9PinRemote::TimeCode& tc, const Transport& transport) {
+  const auto now = pack_status(st, tc);
+  const auto before = pack_status(last, tc);
+  const auto window = last_status_rx ? rx.monotonic - last_status_rx : 0;
+  last_status_rx = rx.monotonic;
+
+  bool exit = false;
+  for (auto& rule : rules) {
+    if (rule.is_timecode)
+      continue;
+    const uint32_t mask = 1u << rule.bit;
+    const bool set = rule.rising ? (now & mask) : !(now & mask);
+    const bool was = rule.rising ? (before & mask) : !(before & mask);
+    // Edges only, a state already there when the session starts is not an event
+    if (set && !was && !first) {
+      rule.window_max = max(rule.window_max, window);
+      exit |= fire(rule, rx, tc, transport);
+    }
+  }
+  return exit;
+}
+
+bool Rules::timecode(const Sony9PinRemote::TimeCode& tc, const Sony9PinRemote::TimeCode& last, bool first,
+                     const Stamp& rx, const Transport& transport) {
+  const auto window = last_timecode_rx ? rx.monotonic - last_timecode_rx : 0;
+  last_timecode_rx = rx.monotonic;
+  if (first)
+    return false;
+
+  const auto now = Timecode::from_deck(tc, fps).frames();
+  const auto before = Timecode::from_deck(last, fps).frames();
+  bool exit = false;
+  for (auto& rule : rules) {
+    if (!rule.is_timecode)
+      continue;
+    // Target in the drop-frame mode of the tape
+    const auto f = rule.target.fields();
+    const auto target = Timecode::from_fields(f.hour, f.minute, f.second, f.frame, fps, tc.is_df).frames();
+    if (before < target && now >= target) {
+      rule.window_max = max(rule.window_max, window);
+      exit |= fire(rule, rx, tc, transport);
+    }
+  }
+  return exit;
+}
+
+void Rules::report() const {
+  for (const auto& rule : rules) {
+    cerr << "Info: rule " << rule.spec << ": fired " << rule.fired << " times";
+    if (rule.fired) {
+      cerr << ", " << rule.failed << " failed, reaction us min=" << rule.latency_min / 1000
+           << " avg=" << rule.latency_total / rule.fired / 1000 << " max=" << rule.latency_max / 1000
+           << ", detection window up to " << rule.window_max / 1000 << " us";
+    }
+    cerr << ".\n";
+  }
+}
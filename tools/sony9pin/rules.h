@@ -0,0 +1,89 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "clock.h"
+#include "timecode.h"
+
+// Continuous mode event rules, "<event>:<action>[,<action>...]":
+//   events:  <status field>   field set (e.g. near_eot, svo_alarm)
+//            !<status field>  field cleared (e.g. !servo_lock)
+//            tc>=<timecode>   timecode reaches this point going forward
+//   actions: stop, play, eject, rewind, fast_forward, frame_step_forward,
+//            frame_step_reverse: transport command, sent without status
+//            pre-check
+//            fifo=<path>: non-blocking write of "<event> <timecode>
+//            <realtime ns>\n", last known timecode for status events
+//            (dropped if nobody is reading)
+//            signal=<pid>[/<signal>]: kill(), default USR1
+//            exit: leave continuous mode after this sample
+// Rules are evaluated right after the reply that shows the event, and the
+// reaction latency (reply received to last action done) is recorded.
+class Rules {
+public:
+  typedef std::function<int(char command)> Transport;
+
+  ~Rules();
+
+  bool add(const std::string& spec, int fps, std::string& error);
+  bool empty() const { return rules.empty(); }
+
+  // Returns true if an exit action fired
+  bool status(const Sony9PinRemote::Status& st, const Sony9PinRemote::Status& last, bool first,
+              const Stamp& rx, const Sony9PinRemote::TimeCode& tc, const Transport& transport);
+  bool timecode(const Sony9PinRemote::TimeCode& tc, const Sony9PinRemote::TimeCode& last, bool first,
+                const Stamp& rx, const Transport& transport);
+
+  // Fire counts and latencies, to stderr
+  void report() const;
+
+private:
+  struct Action {
+    enum Kind { Command, Fifo, Signal, Exit } kind;
+    char command;
+    std::string path;
+    int fd;
+    int pid;
+    int signal;
+  };
+
+  struct Rule {
+    std::string spec;
+    std::string event;
+    int bit;
+    bool rising;
+    bool is_timecode;
+    Timecode target;
+    std::vector<Action> actions;
+    uint64_t fired;
+    uint64_t failed;
+    int64_t latency_min;
+    int64_t latency_max;
+    int64_t latency_total;
+    int64_t window_max;
+  };
+
+  bool fire(Rule& rule, const Stamp& rx, const Sony9PinRemote::TimeCode& tc, const Transport& transport);
+
+  std::vector<Rule> rules;
+  int fps = 30;
+  int64_t last_status_rx = 0;
+  int64_t last_timecode_rx = 0;
+};
+
+// "<pid>[/<signal>]", signal by number or name (HUP, INT, TERM, USR1,
+// USR2, with or without SIG), USR1 by default
+bool parse_signal_target(const std::string& text, int& pid, int& signal, std::string& error);
+
+#endif
@@ -0,0 +1,120 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "scheduler.h"
+#include "clock.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+// 38.4 kbaud, start + 8 data + parity + stop bits
+const int64_t byte_ns = 11 * 1000000000LL / 38400;
+
+// Request and reply bytes on the wire
+const int64_t query_bytes[] = {
+  4 + 7,   // current_time_sense_timer1
+  4 + 13,  // status_sense
+  4 + 11,  // current_time_sense_ltc_tc_ub
+};
+
+const char* const query_names[] = { "timecode", "status", "userbits" };
+
+// Share of the slot the queries may take, the rest absorbs latency spikes
+const int64_t budget_percent = 90;
+// A query left out this many slots in a row is sent anyway
+const int64_t max_age = 8;
+
+}
+
+void PollScheduler::start(int64_t num, int64_t den, int frames, bool userbits, uint32_t typical_latency_ms) {
+  rate_num = num;
+  rate_den = den;
+  every = frames;
+  period = every * rate_den * 1000000000 / rate_num;
+  origin = stamp_now().monotonic;
+  slot = 0;
+  enabled = Timecode | Status | (userbits ? Userbits : 0);
+  for (int i = 0; i < query_count; i++) {
+    cost[i] = query_bytes[i] * byte_ns + (int64_t)typical_latency_ms * 1000000;
+    age[i] = 0;
+    served[i] = 0;
+  }
+}
+
+int64_t PollScheduler::slot_time(int64_t index) const {
+  // Exact rational grid, as the sidecar frame clock
+  const int64_t frames = index * every;
+  return origin + frames / rate_num * rate_den * 1000000000 + frames % rate_num * rate_den * 1000000000 / rate_num;
+}
+
+unsigned PollScheduler::next_slot() {
+  slot++;
+  auto now = stamp_now().monotonic;
+  if (now > slot_time(slot) + period / 2) {
+    // Previous slot overran, resume on the grid
+    auto next = (int64_t)((now - origin) / (double)period) + 1;
+    while (slot_time(next) < now)
+      next++;
+    skipped += next - slot;
+    slot = next;
+  }
+  wait_until(slot_time(slot));
+
+  now = stamp_now().monotonic;
+  const auto jitter = now - slot_time(slot);
+  slot_count++;
+  jitter_total += jitter;
+  jitter_max = max(jitter_max, jitter);
+
+  // Timecode every slot, then the other queries, oldest first (user bits
+  // at half weight), while they fit
+  const auto budget = period * budget_percent / 100;
+  unsigned queries = Timecode;
+  int64_t total = cost[0];
+  int order[] = { 1, 2 };
+  if (age[2] >= 2 * (age[1] + 1))
+    swap(order[0], order[1]);
+  for (const auto i : order) {
+    if (!(enabled & (1u << i)))
+      continue;
+    if (total + cost[i] <= budget || age[i] >= max_age) {
+      queries |= 1u << i;
+      total += cost[i];
+    }
+  }
+  for (int i = 0; i < query_count; i++) {
+    if (queries & (1u << i)) {
+      age[i] = 0;
+      served[i]++;
+    } else if (enabled & (1u << i)) {
+      age[i]++;
+    }
+  }
+  return queries;
+}
+
+void PollScheduler::done(Query query, int64_t duration_ns) {
+  for (int i = 0; i < query_count; i++) {
+    if (query == (1 << i))
+      cost[i] += (duration_ns - cost[i]) / 8;
+  }
+}
+
+void PollScheduler::report() const {
+  if (!started())
+    return;
+  cerr << "Info: poll schedule " << rate_num << '/' << rate_den << " fps every " << every << " frames: "
+       << slot_count << " slots, " << skipped << " skipped, jitter us avg=" << (slot_count ? jitter_total / (int64_t)slot_count / 1000 : 0)
+       << " max=" << jitter_max / 1000;
+  for (int i = 0; i < query_count; i++) {
+    if (enabled & (1u << i))
+      cerr << ", " << query_names[i] << " in " << served[i] << " slots (" << cost[i] / 1000 << " us)";
+  }
+  cerr << ".\n";
+}
@@ -0,0 +1,58 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+
+// Continuous mode poll slots on a video frame grid (rate_num/rate_den fps,
+// one slot every N frames). Each slot always reads the timecode, status
+// and LTC user bits are added while the measured cost of the slot fits in
+// its share of the line (38.4 kbaud, 11 bits per byte, plus the deck
+// latency), the least recently served first. Slot start jitter against the
+// ideal grid is measured, late slots are skipped instead of bunched.
+class PollScheduler {
+public:
+  enum Query {
+    Timecode = 1 << 0,
+    Status = 1 << 1,
+    Userbits = 1 << 2,
+  };
+
+  void start(int64_t rate_num, int64_t rate_den, int every, bool userbits, uint32_t typical_latency_ms);
+  bool started() const { return period > 0; }
+
+  // Sleeps until the next slot, returns the queries of the slot
+  unsigned next_slot();
+  // Measured duration of a query, request sent to reply parsed
+  void done(Query query, int64_t duration_ns);
+
+  void report() const;
+
+private:
+  static const int query_count = 3;
+
+  int64_t slot_time(int64_t slot) const;
+
+  int64_t rate_num = 0;
+  int64_t rate_den = 1;
+  int every = 1;
+  int64_t period = 0;
+  int64_t origin = 0;
+  int64_t slot = 0;
+  unsigned enabled = 0;
+  int64_t cost[query_count] = {};
+  int64_t age[query_count] = {};
+  uint64_t served[query_count] = {};
+
+  uint64_t slot_count = 0;
+  uint64_t skipped = 0;
+  int64_t jitter_total = 0;
+  int64_t jitter_max = 0;
+};
+
+#endif
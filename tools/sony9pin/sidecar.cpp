@@ -0,0 +1,121 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "sidecar.h"
+#include "timecode.h"
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+Sidecar::~Sidecar() {
+  close();
+}
+
+bool Sidecar::open(const string& path, int64_t num, int64_t den, int64_t capture_start, int fps) {
+  file.open(path, ios::out | ios::trunc);
+  if (!file.is_open())
+    return false;
+  rate_num = num;
+  rate_den = den;
+  start = capture_start;
+  deck_fps = fps;
+  next_tick = 0;
+  has_last = false;
+  file << "source,capture_frame,capture_pts_ns,tx_monotonic_ns,rx_monotonic_ns,rx_realtime_ns,deck_frame,deck_tc\n";
+  return true;
+}
+
+void Sidecar::close() {
+  if (file.is_open())
+    file.close();
+}
+
+int64_t Sidecar::tick_time(int64_t tick) const {
+  // Exact rational grid, no accumulated drift over long captures
+  const int64_t seconds = tick / rate_num;
+  const int64_t rest = tick % rate_num;
+  return start + seconds * rate_den * 1000000000 + rest * rate_den * 1000000000 / rate_num;
+}
+
+// A tick of -1 leaves capture_frame empty
+void Sidecar::row(const char* source, int64_t tick, int64_t tx, int64_t rx, int64_t realtime, int64_t deck_frame, bool df) {
+  char tc[Timecode::format_size];
+  Timecode(deck_frame, deck_fps, df).format(tc);
+  file << source << ',';
+  if (tick >= 0)
+    file << tick;
+  file << ',' << (realtime - start) << ',' << tx << ',' << rx << ',' << realtime << ',' << deck_frame << ',' << tc << '\n';
+}
+
+void Sidecar::sample(const char* source, const Stamp& tx, const Stamp& rx, const Sony9PinRemote::TimeCode& tc) {
+  if (!file.is_open())
+    return;
+
+  const int64_t frame = Timecode::from_deck(tc, deck_fps).frames();
+  if (!start)
+    start = rx.realtime;
+
+  // One interpolated row per target frame clock tick since the previous
+  // sample, deck position linear between the two replies if the tape
+  // played or stood still in between: two frames of slack for the reply
+  // times and the frame boundaries, one percent for the clocks
+  if (has_last && rx.realtime > last_rx.realtime) {
+    const int64_t span = rx.realtime - last_rx.realtime;
+    const double play_fps = deck_fps == 30 ? 30000.0 / 1001 : deck_fps;
+    const double expected = span * play_fps / 1e9;
+    const bool linear = frame == last_frame || fabs(frame - last_frame - expected) <= 2 + expected / 100;
+    for (int64_t t = tick_time(next_tick); t <= rx.realtime; t = tick_time(++next_tick)) {
+      const int64_t offset = t - last_rx.realtime;
+      const int64_t monotonic = last_rx.monotonic + offset;
+      if (!linear) {
+        file << "gap," << next_tick << ',' << (t - start) << ',' << monotonic << ',' << monotonic << ',' << t << ",,\n";
+        continue;
+      }
+      const int64_t interp = last_frame + (int64_t)llround((double)(frame - last_frame) * offset / span);
+      row("interp", next_tick, monotonic, monotonic, t, interp, last_df);
+    }
+  } else if (!has_last) {
+    // A tick at this reply gets its row from the next sample
+    while (tick_time(next_tick) < rx.realtime)
+      next_tick++;
+  }
+
+  // Capture frames have their interpolated row, the sample has none
+  row(source, -1, tx.monotonic, rx.monotonic, rx.realtime, frame, tc.is_df);
+
+  has_last = true;
+  last_rx = rx;
+  last_frame = frame;
+  last_df = tc.is_df;
+}
+
+bool parse_frame_rate(const string& text, int64_t& num, int64_t& den) {
+  const auto slash = text.find('/');
+  char* end = nullptr;
+  if (slash != string::npos) {
+    num = strtoll(text.c_str(), &end, 10);
+    if (end != text.c_str() + slash)
+      return false;
+    den = strtoll(text.c_str() + slash + 1, &end, 10);
+    return *end == '\0' && num > 0 && den > 0;
+  }
+
+  const double value = strtod(text.c_str(), &end);
+  if (*end != '\0' || value <= 0)
+    return false;
+  // NTSC-family rates are given as 23.976, 29.97, 59.94...
+  const double ntsc = value * 1001 / 1000;
+  if (fabs(ntsc - llround(ntsc)) < 0.01 && fabs(value - llround(value)) > 0.01) {
+    num = llround(ntsc) * 1000;
+    den = 1001;
+  } else {
+    num = llround(value * 1000);
+    den = 1000;
+  }
+  return true;
+}
@@ -0,0 +1,58 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+#include "clock.h"
+
+// Timecode sidecar track: one interpolated CSV row per tick of the target
+// frame clock between samples, the only rows with a capture_frame, so
+// capture frames join to deck timecode on a unique key, plus one row per
+// deck timecode sample with its request and reply times. Between samples
+// where the deck timecode did not move at play speed nor stand still (a
+// cue, wind or stop in between) the ticks get "gap" rows without a deck
+// timecode instead: the position is not linear there.
+class Sidecar {
+public:
+  ~Sidecar();
+
+  // rate is num/den frames per second of the capture (e.g. 30000/1001);
+  // start is the realtime of capture frame 0, or 0 to use the first
+  // sample; deck_fps is the nominal rate of the tape timecode.
+  bool open(const std::string& path, int64_t rate_num, int64_t rate_den, int64_t start, int deck_fps);
+  bool is_open() const { return file.is_open(); }
+  void close();
+
+  // tx is taken when the request is sent, rx when the last byte of the
+  // reply is read from the port (Link::tx() and rx()).
+  void sample(const char* source, const Stamp& tx, const Stamp& rx, const Sony9PinRemote::TimeCode& tc);
+
+private:
+  int64_t tick_time(int64_t tick) const;
+  void row(const char* source, int64_t tick, int64_t tx, int64_t rx, int64_t realtime, int64_t deck_frame, bool df);
+
+  std::ofstream file;
+  int64_t rate_num = 30000;
+  int64_t rate_den = 1001;
+  int64_t start = 0;
+  int deck_fps = 30;
+  int64_t next_tick = 0;
+  bool has_last = false;
+  Stamp last_rx;
+  int64_t last_frame = 0;
+  bool last_df = false;
+};
+
+// Parses "30000/1001", "29.97", "25"... into a rational frame rate.
+bool parse_frame_rate(const std::string& text, int64_t& num, int64_t& den);
+
+#endif
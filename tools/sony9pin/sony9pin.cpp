@@ -5,11 +5,13 @@
  */
 
 #include <QCoreApplication>
-#include <QRegularExpression>
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QDateTime>
-#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
@@ -21,31 +23,84 @@ const char* version = "1.0";
 
 // #define SONY9PINREMOTE_DEBUGLOG_ENABLE
 #include "Sony9PinRemote/Sony9PinRemote.h"
-
-bool operator!=(const sony9pin::TimeCode& first, const sony9pin::TimeCode& second) {
-  return first.is_cf != second.is_cf ||
-         first.is_df != second.is_df ||
-         first.frame != second.frame ||
-         first.second != second.second ||
-         first.minute != second.minute ||
-         first.hour != second.hour;
-}
-
-struct State {
-  Sony9PinRemote::TimeCode tc;
-  Sony9PinRemote::Status st;
-};
+#include "capture.h"
+#include "format.h"
+#include "gang.h"
+#include "health.h"
+#include "journal.h"
+#include "link.h"
+#include "logsink.h"
+#include "motion.h"
+#include "poller.h"
+#include "profiles.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "sidecar.h"
+#include "stress.h"
+#include "stream.h"
+#include "timecode.h"
+#include "timeline.h"
+#include "trace.h"
 
 Sony9PinRemote::Controller deck;
 QSerialPort serialPort;
+Link<QSerialPort> serialLink(serialPort);
+Poller<QSerialPort> poller(serialPort, serialLink);
 State lastState;
-
-extern map<uint16_t, pair<string, vector<string>>> devices;
+Sidecar sidecar;
+LogSink logSink;
+Timeline timeline;
+Rules rules;
+PollScheduler scheduler;
+Journal journal;
+Health health;
+Capture capture;
+StateStream stateStream;
+DeckProfile profile;
+int64_t lastReplyNs = 0;
+
+extern void device_make_model(uint16_t device_type, string& device_make, string& device_model);
+extern int open_port(QSerialPort& port, const QString& serialPortName, bool verbose);
 
 void options(const char* const prefix = "") {
   std::cerr << prefix << "Options:\n"
     << prefix << "-c, --continuous: report deck state until stop bit is set\n"
+    << prefix << "--log=<file>: write continuous mode output to a rotated log file instead of stdout\n"
+    << prefix << "--log-size=<MiB>: rotate the log when it reaches this size (default 64, 0 for no limit)\n"
+    << prefix << "--log-age=<hours>: rotate the log after this time (default 24, 0 for no limit)\n"
+    << prefix << "--log-compress=<zstd|gzip>: compress rotated log segments in the background\n"
+    << prefix << "--timeline=<file>: record every continuous mode sample to a compact binary timeline\n"
+    << prefix << "    (see sony9pin_timeline for queries)\n"
+    << prefix << "--on=<event>:<action>[,<action>...]: in continuous mode, react to a deck event, repeatable\n"
+    << prefix << "    events: <status field> (set), !<status field> (cleared), tc>=<timecode>\n"
+    << prefix << "    actions: stop, play, eject, rewind, fast_forward, frame_step_forward, frame_step_reverse,\n"
+    << prefix << "    fifo=<path>, signal=<pid>[/<signal>], exit\n"
+    << prefix << "--websocket=[<address>:]<port>: in continuous mode, stream the state to WebSocket clients, one\n"
+    << prefix << "    continuous mode line per poll with the fields changed since the client's previous message\n"
+    << prefix << "--rate=<fps>|auto: in continuous mode, poll on a frame grid (e.g. 30000/1001, 25, 24); auto picks\n"
+    << prefix << "    29.97 for drop-frame timecode, else the frame rate of the deck profile\n"
+    << prefix << "--every=<frames>: poll every N frames of the grid (default 1, implies --rate=auto)\n"
+    << prefix << "--userbits: also poll LTC user bits, in slots with spare line time (implies --rate=auto)\n"
+    << prefix << "--journal=<dir>: keep a per-tape journal of commands and positions in this directory, replayed\n"
+    << prefix << "    on start to resume (e.g. a cue to where the tape already is is skipped)\n"
+    << prefix << "--tape=<id>: tape ID of the journal (default LTC user bits)\n"
+    << prefix << "--health=<dir>: keep transport timings of the deck in this directory (servo lock, cue, spool\n"
+    << prefix << "    speeds from continuous mode polls, NAK rate) and report regressions against its baseline\n"
+    << prefix << "--capture=<command>: capture command of k, started at the in point and terminated at the out\n"
+    << prefix << "    point, %i and %o replaced by their timecodes\n"
+    << prefix << "--capture-signal=<pid>[/<signal>]: instead, signal a running capture program at both points\n"
+    << prefix << "    (USR1 by default)\n"
+    << prefix << "--preroll=<seconds>: pre-roll of k (default 5)\n"
+    << prefix << "--capture-ltc: k follows LTC instead of timer1\n"
     << prefix << "-v, --verbose: verbose mode\n"
+    << prefix << "--stress=<seconds>: hammer the deck with status/timecode requests and report link errors\n"
+    << prefix << "-g, --gang: <SerialPortName> is a comma-separated list of decks driven together\n"
+    << prefix << "    (c, e, f, p, r, s, x, w, 2 commands only)\n"
+    << prefix << "--fps=<fps>: frame rate of gang timecodes (default the rate of the deck profiles)\n"
+    << prefix << "--trace=<file>: write Trace Event Format spans of every command phase (chrome://tracing, Perfetto)\n"
+    << prefix << "--sidecar=<file>: write a CSV timecode track of every timer1/LTC sample\n"
+    << prefix << "--sidecar-rate=<fps>: frame clock of the sidecar track (default 30000/1001)\n"
+    << prefix << "--sidecar-start=<ISO 8601 date>: wall clock time of capture frame 0 (default first sample)\n"
     << prefix << "-V, --version: show version\n"
     << prefix << "-h, --help: show help\n"
     ;
@@ -62,6 +117,9 @@ void commands(const char* const prefix = "") {
     << prefix << "r: rewind\n"
     << prefix << "s: stop\n"
     << prefix << "c <timecode in HH:mm:ss:ff format>: cue_up_with_data\n"
+    << prefix << "m <frames>: step frames, negative for reverse, then correct to the exact count\n"
+    << prefix << "j <rate> <seconds>: jog at rate times play speed (negative for reverse) for a duration\n"
+    << prefix << "k <in timecode> [<out timecode>]: capture from the in point (to the out point), pre-rolled\n"
     << prefix << "0: status\n"
     << prefix << "1: type\n"
     << prefix << "2: timer1\n"
@@ -90,89 +148,96 @@ void usage(const string& commandName) {
 
 void print_timecode_userbits(bool print_userbits)
 {
-  Sony9PinRemote::TimeCode tc = deck.timecode();
-  cerr << "TimeCode: " << dec
-       << setw(2) << setfill('0') << (unsigned int)tc.hour << ':'
-       << setw(2) << setfill('0') << (unsigned int)tc.minute << ':'
-       << setw(2) << setfill('0') << (unsigned int)tc.second << ';'
-       << setw(2) << setfill('0') << (unsigned int)tc.frame << ' '
-       << "CF: " << (unsigned int)tc.is_cf << ' '
-       << "DF: " << (unsigned int)tc.is_df
-       << resetiosflags(std::ios::dec);
+  TraceSpan span("format");
+  const auto ub = deck.userbits();
+  format_timecode_userbits(cerr, deck.timecode(), print_userbits ? &ub : nullptr);
+}
 
-  if (print_userbits) {
-    Sony9PinRemote::UserBits ub = deck.userbits();
-    cerr << " UB: " << hex << uppercase
-         << setw(2) << setfill('0') << (unsigned int)ub.bytes[3] << ':'
-         << setw(2) << setfill('0') << (unsigned int)ub.bytes[2] << ':'
-         << setw(2) << setfill('0') << (unsigned int)ub.bytes[1] << ':'
-         << setw(2) << setfill('0') << (unsigned int)ub.bytes[0]
-         << resetiosflags(std::ios::hex|std::ios::uppercase);
+// Waits for the reply to the command just sent. With tracing on, the
+// wire time, the wait for the reply and the parse are separate spans.
+// A reply that did not come in time is left pending for ready().
+bool receive()
+{
+  const auto timeout_ms = profile.response_timeout_ms;
+  const auto start = stamp_now().monotonic;
+  poller.set_pending(true);
+  // One deadline for the whole reply, wait and parse
+  const auto left_ms = [&]() {
+    return (uint32_t)max<int64_t>((int64_t)timeout_ms - (stamp_now().monotonic - start) / 1000000, 1);
+  };
+  // Written out whether tracing is on or not, so the trace measures the
+  // timing of an untraced run
+  {
+    TraceSpan span("tx");
+    if (serialPort.bytesToWrite())
+      serialPort.waitForBytesWritten(left_ms());
   }
-
-  cerr << '\n';
+  {
+    TraceSpan span("rx_wait");
+    if (!serialLink.wait(left_ms()))
+      return false;
+  }
+  TraceSpan span("parse");
+  if (!deck.parse_until(left_ms()))
+    return false;
+  poller.set_pending(false);
+  lastReplyNs = stamp_now().monotonic - start;
+  return true;
 }
 
-bool test_ack()
+// Poll loop and rule actions: a prebuilt frame out, the reply decoded from
+// the link buffer without the controller, nothing allocated or formatted
+// in between. A reply that did not come in time is left pending for
+// ready().
+bool query(const CommandFrame& command)
 {
-  if (!deck.ack() && (deck.is_nak_unknown_command() ||
-                      deck.is_nak_checksum_error() ||
-                      deck.is_nak_parity_error() ||
-                      deck.is_nak_buffer_overrun() ||
-                      deck.is_nak_framing_error() ||
-                      deck.is_nak_timeout()))
+  if (!poller.query(command))
     return false;
-
+  lastReplyNs = poller.reply_ns();
   return true;
 }
 
-int setup(const QString& serialPortName, bool verbose) {
-  // Config
-  bool portNumberIsOk = false;
-  const auto portNumber = serialPortName.toInt(&portNumberIsOk);
-  if (portNumberIsOk) {
-    const auto portInfos = QSerialPortInfo::availablePorts();
-    if (portNumber >= portInfos.size()) {
-      std::cerr << "Error: wrong port index.\n";
-      return 1;
-    }
-    const auto& portInfo = portInfos[portNumber];
-    serialPort.setPort(portInfo);
-  } else {
-    serialPort.setPortName(serialPortName);
-  }
-  serialPort.setBaudRate(Sony9PinSerial::BAUDRATE);
-  serialPort.setParity(QSerialPort::OddParity);
+bool test_ack()
+{
+  return !is_nak(deck);
+}
 
-  // Open
-  if (verbose) {
-    std::cerr << "Info: open device " << serialPort.portName().toStdString() << ".\n";
-  }
-  if (!serialPort.open(QIODevice::ReadWrite)) {
-    std::cerr << "Error: open device fail.\n";
-    return 1;
+int setup(const QString& serialPortName, bool verbose) {
+  if (auto result = open_port(serialPort, serialPortName, verbose)) {
+    return result;
   }
-  //QThread::msleep(2000);
   deck.attach(serialPort);
-  if (verbose) {
-    std::cerr << "Info: open device OK.\n";
-  }
 
   return 0;
 }
 
 int status(bool verbose){
+  TraceSpan span(__func__);
+
   // Device status
   if (verbose) {
     std::cerr << "Info: get device status.\n";
   }
-  deck.status_sense();
-  if (!deck.parse_until(1000)) {
+  deck.status_sense(0, status_data_size);
+  if (!receive()) {
     std::cerr << "Error: get device status failed.\n";
     return 1;
   }
   deck.print_status();
 
+  // Bits the controller does not decode, if the deck returned them
+  uint8_t data[status_data_size];
+  const auto size = decode_status_data(serialLink.frame(), serialLink.frame_size(), data);
+  if (size) {
+    std::cerr << "Info: extended status:";
+    for (size_t i = 0; i < extended_status_bit_count; i++) {
+      const auto& bit = extended_status_bits[i];
+      if (bit.byte < size)
+        std::cerr << ' ' << bit.name << '=' << ((data[bit.byte] >> bit.bit) & 1);
+    }
+    std::cerr << ".\n";
+  }
+
   // Checks
   if (!deck.is_media_exist()) {
     std::cerr << "Error: there is no media.\n";
@@ -187,47 +252,36 @@ int status(bool verbose){
   return 0;
 }
 
+ int identify(bool verbose) {
+  deck.device_type_request();
+  if (!receive()) {
+    std::cerr << "Error: get device type failed.\n";
+    return 1;
+  }
+  profile = find_profile(deck.device_type());
+  poller.set_timing(profile.response_timeout_ms, profile.typical_latency_ms, profile.settle_ms);
+  if (verbose) {
+    std::cerr << "Info: deck profile \"" << profile.name << "\" (" << profile.source << " figures), " << profile.fps << " fps, timeout " << profile.response_timeout_ms
+              << " ms, settle " << profile.settle_ms << " ms.\n";
+  }
+
+  return 0;
+}
+
  int type(bool verbose) {
+  TraceSpan span(__func__);
+
   if (verbose) {
     std::cerr << "Info: get device type.\n";
   }
-  deck.device_type_request();
-  if (!deck.parse_until(1000)) {
-    std::cerr << "Error: get device type failed.\n";
-    return 1;
+  if (auto result = identify(false)) {
+    return result;
   }
   const auto device_type = deck.device_type();
   std::cerr << "Info: device_type=0x" << hex << setw(4) << setfill('0') << device_type << resetiosflags(std::ios::hex);
   std::string device_make;
   std::string device_model;
-  switch (device_type) {
-    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_NTSC: {
-      device_make = "Blackmagic";
-      device_model = "Hyperdeck Studio Mini, NTSC";
-      break;
-    }
-    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_PAL: {
-      device_make = "Blackmagic";
-      device_model = "Hyperdeck Studio Mini, PAL";
-      break;
-    }
-    case Sony9PinDevice::BLACKMAGIC_HYPERDECK_STUDIO_MINI_24P: {
-      device_make = "Blackmagic";
-      device_model = "Hyperdeck Studio Mini, 24P";
-      break;
-    default:
-      if (devices.find(device_type) != devices.end())
-      {
-        device_make = devices[device_type].first;
-        for (auto model : devices[device_type].second)
-        {
-            if (!device_model.empty())
-              device_model += ", ";
-            device_model += model;
-        }
-      }
-    }
-  }
+  device_make_model(device_type, device_make, device_model);
   if (!device_make.empty())
     std::cerr << ", device_make=\"" << device_make << "\"";
   if (!device_model.empty())
@@ -237,210 +291,293 @@ int status(bool verbose){
   return 0;
 }
 
+// Transport changes are followed by the settle time of the deck profile
+// before the next command is sent
+void settle() {
+  poller.settle();
+}
+
+// Nothing to wait for unless the last reply timed out: each command
+// consumes its own reply. A late reply is waited for with doubling
+// timeouts, starting at the typical latency of the deck, up to twice the
+// response timeout, then dropped.
 int ready(bool verbose) {
-  while (!deck.ready()) {
-    if (verbose) {
-      std::cout << "Info: deck is not ready, waiting." << std::endl;
-    }
-    if (deck.parse_until(1000)) {
-      break;
-    }
+  TraceSpan span("ready");
+  if (verbose && poller.pending()) {
+    std::cerr << "Info: deck is not ready, waiting.\n";
   }
-  return 0;
+  if (poller.ready()) {
+    return 0;
+  }
+  std::cerr << "Error: deck is not ready, no reply within " << 2 * poller.timeout_ms() << " ms.\n";
+  return 1;
 }
 
 int check_status_for_command()
 {
+  TraceSpan span("check_status");
   deck.status_sense();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: get device status failed.\n";
     return 1;
   }
 
-  if (!deck.is_remote_enabled()) {
-    std::cerr << "Error: The device is in local mode. Please switch to remote and try again.\n";
+  if (const auto refusal = command_refusal(deck.status())) {
+    std::cerr << "Error: " << refusal << ".\n";
     return 1;
   }
 
-  if (!deck.is_media_exist()) {
-    std::cerr << "Error: The device does not contain a cassette. Please insert media and try again.\n";
+  return 0;
+}
+
+// Rule actions: the command alone, the poll that fired the rule already
+// checked the deck status
+int send_transport(char command)
+{
+  TraceSpan span("rule_action");
+  journal.command(command);
+  health.command(command, stamp_now().monotonic);
+  const bool received = query(*transport_frame(command));
+  const bool acked = received && is_ack(serialLink.frame());
+  journal.reply(command, acked ? Journal::Ok : received ? Journal::Nak : Journal::Fail, lastReplyNs);
+  if (!acked) {
+    std::cerr << "Error: rule command " << command << " failed.\n";
     return 1;
   }
-
+  settle();
   return 0;
 }
 
+// Transport commands and cues of the command line, in the journal
+template <typename Command>
+int journaled(char command, const Timecode* target, Command run)
+{
+  journal.command(command, target);
+  health.command(command, stamp_now().monotonic);
+  const auto result = run();
+  journal.reply(command, result ? Journal::Fail : deck.ack() ? Journal::Ok : Journal::Nak, lastReplyNs);
+  health.reply(!result, !result && !deck.ack());
+  return result;
+}
+
+// Skips a cue to where the journal says the tape is parked, after one
+// timecode read to check it was not moved in the meantime
+bool is_cued(const Timecode& tc, bool verbose)
+{
+  // The point in the drop-frame mode of the tape, whatever separator was
+  // typed
+  if (!journal.is_parked() || journal.last_position() != tc.in_mode(profile.fps, journal.last_position().is_df())) {
+    return false;
+  }
+  deck.current_time_sense_timer1();
+  if (!receive() || !test_ack()) {
+    return false;
+  }
+  const auto now = deck.timecode();
+  journal.position(now, stamp_now().realtime / 1000000);
+  if (Timecode::from_deck(now, profile.fps) != tc.in_mode(profile.fps, now.is_df)) {
+    return false;
+  }
+  if (verbose) {
+    std::cerr << "Info: tape is parked at the cue point, cue skipped.\n";
+  }
+  return true;
+}
+
 int eject(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: eject." << std::endl;
+    std::cerr << "Info: eject.\n";
   }
   deck.eject();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: eject failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: eject issue.\n";
+    std::cerr << "Info: eject issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int fast_forward(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: fast_forward." << std::endl;
+    std::cerr << "Info: fast_forward.\n";
   }
   deck.fast_forward();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: fast_forward failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: fast_forward issue.\n";
+    std::cerr << "Info: fast_forward issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int play(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: play." << std::endl;
+    std::cerr << "Info: play.\n";
   }
   deck.play();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: play failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: play issue.\n";
+    std::cerr << "Info: play issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int rewind(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: rewind." << std::endl;
+    std::cerr << "Info: rewind.\n";
   }
   deck.rewind();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: rewind failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: rewind issue.\n";
+    std::cerr << "Info: rewind issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int stop(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: stop." << std::endl;
+    std::cerr << "Info: stop.\n";
   }
   deck.stop();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: stop failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: stop issue.\n";
+    std::cerr << "Info: stop issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int frame_step_forward(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: frame_step_forward." << std::endl;
+    std::cerr << "Info: frame_step_forward.\n";
   }
   deck.frame_step_forward();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: frame_step_forward failed.\n";
     return 1;
   }
 
   if (!deck.ack()) {
-    std::cout << "Info: frame_step_forward issue.\n";
+    std::cerr << "Info: frame_step_forward issue.\n";
     deck.print_nak();
   }
 
   return 0;
 }
 
-int cue_up_with_data(uint8_t hh, uint8_t mm, uint8_t ss, uint8_t ff, bool verbose)
+int cue_up_with_data(const Timecode& tc, bool verbose)
 {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: cue_up_with_data." << std::endl;
+    std::cerr << "Info: cue_up_with_data.\n";
   }
-  deck.cue_up_with_data(hh + 6 * (hh / 10), mm + 6 * (mm / 10), ss + 6 * (ss / 10), ff + 6 * (ff / 10));
-  if (!deck.parse_until(1000)) {
+  const auto bcd = tc.bcd();
+  deck.cue_up_with_data(bcd.hour, bcd.minute, bcd.second, bcd.frame);
+  if (!receive()) {
     std::cerr << "Error: cue_up_with_data failed.\n";
     return 1;
   }
 
   if (!deck.ack()) {
-    std::cout << "Info: cue_up_with_data issue.\n";
+    std::cerr << "Info: cue_up_with_data issue.\n";
     deck.print_nak();
   }
 
+  settle();
   return 0;
 }
 
 int frame_step_reverse(bool verbose) {
+  TraceSpan span(__func__);
+
   if (auto result = check_status_for_command()) {
     return result;
   }
 
   if (verbose) {
-    std::cout << "Info: frame_step_reverse." << std::endl;
+    std::cerr << "Info: frame_step_reverse.\n";
   }
   deck.frame_step_reverse();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: frame_step_reverse failed.\n";
     return 1;
   }
 
   if (!deck.ack()) {
-    std::cout << "Info: frame_step_reverse issue.\n";
+    std::cerr << "Info: frame_step_reverse issue.\n";
     deck.print_nak();
   }
 
@@ -448,18 +585,25 @@ int frame_step_reverse(bool verbose) {
 }
 
 int timer1(bool verbose) {
+  TraceSpan span(__func__);
+
   if (verbose) {
-    std::cout << "Info: timer1." << std::endl;
+    std::cerr << "Info: timer1.\n";
   }
+  const auto tx = stamp_now();
   deck.current_time_sense_timer1();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: timer1 failed.\n";
     return 1;
   }
+  const auto rx = serialLink.rx();
 
   if (!test_ack()) {
-    std::cout << "Info: timer1 issue.\n";
+    std::cerr << "Info: timer1 issue.\n";
     deck.print_nak();
+  } else {
+    sidecar.sample("timer1", tx, rx, deck.timecode());
+    journal.position(deck.timecode(), rx.realtime / 1000000);
   }
 
   print_timecode_userbits(false);
@@ -468,17 +612,24 @@ int timer1(bool verbose) {
 }
 
 int timer2(bool verbose) {
+  TraceSpan span(__func__);
+
+  if (!profile.timer2) {
+    std::cerr << "Error: timer2 is not supported by this device.\n";
+    return 1;
+  }
+
   if (verbose) {
-    std::cout << "Info: timer2." << std::endl;
+    std::cerr << "Info: timer2.\n";
   }
   deck.current_time_sense_timer2();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: timer2 failed.\n";
     return 1;
   }
 
   if (!test_ack()) {
-    std::cout << "Info: timer2 issue.\n";
+    std::cerr << "Info: timer2 issue.\n";
     deck.print_nak();
   }
 
@@ -488,18 +639,29 @@ int timer2(bool verbose) {
 }
 
 int ltc_tc_ub(bool verbose) {
+  TraceSpan span(__func__);
+
+  if (!profile.ltc) {
+    std::cerr << "Error: ltc_tc_ub is not supported by this device.\n";
+    return 1;
+  }
+
   if (verbose) {
-    std::cout << "Info: ltc_tc_ub." << std::endl;
+    std::cerr << "Info: ltc_tc_ub.\n";
   }
+  const auto tx = stamp_now();
   deck.current_time_sense_ltc_tc_ub();
-  if (!deck.parse_until(1000)) {
+  if (!receive()) {
     std::cerr << "Error: ltc_tc_ub failed.\n";
     return 1;
   }
+  const auto rx = serialLink.rx();
 
   if (!test_ack()) {
-    std::cout << "Info: ltc_tc_ub issue.\n";
+    std::cerr << "Info: ltc_tc_ub issue.\n";
     deck.print_nak();
+  } else {
+    sidecar.sample("ltc", tx, rx, deck.timecode());
   }
 
   print_timecode_userbits(true);
@@ -508,18 +670,29 @@ int ltc_tc_ub(bool verbose) {
 }
 
 int vitc_tc_ub(bool verbose) {
+  TraceSpan span(__func__);
+
+  if (!profile.vitc) {
+    std::cerr << "Error: vitc_tc_ub is not supported by this device.\n";
+    return 1;
+  }
+
   if (verbose) {
-    std::cout << "Info: vitc_tc_ub." << std::endl;
+    std::cerr << "Info: vitc_tc_ub.\n";
   }
-  deck.current_time_sense_ltc_tc_ub();
-  if (!deck.parse_until(1000)) {
+  const auto tx = stamp_now();
+  deck.current_time_sense_vitc_tc_ub();
+  if (!receive()) {
     std::cerr << "Error: vitc_tc_ub failed.\n";
     return 1;
   }
+  const auto rx = serialLink.rx();
 
   if (!test_ack()) {
-    std::cout << "Info: vitc_tc_ub issue.\n";
+    std::cerr << "Info: vitc_tc_ub issue.\n";
     deck.print_nak();
+  } else {
+    sidecar.sample("vitc", tx, rx, deck.timecode());
   }
 
   print_timecode_userbits(true);
@@ -527,6 +700,335 @@ int vitc_tc_ub(bool verbose) {
   return 0;
 }
 
+// Back-to-back status_sense()/timer1 requests for the given duration,
+// counting every kind of failure, for quantitative cable and link checks
+int stress(int seconds, bool verbose) {
+  TraceSpan span(__func__);
+  if (auto result = check_status_for_command()) {
+    return result;
+  }
+
+  cerr << "Info: stress test for " << seconds << " s.\n";
+  auto result = stress_link(poller, serialLink, seconds, verbose);
+  auto& latencies = result.latencies;
+  const auto requests = result.requests;
+  const double elapsed = result.elapsed_ns * 1e-9;
+  const auto errors = result.errors();
+  sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    if (latencies.empty())
+      return 0.0;
+    return latencies[(size_t)(p * (latencies.size() - 1))] * 1e-6;
+  };
+
+  cerr << "Info: requests=" << requests << " elapsed_s=" << elapsed
+       << " throughput_per_s=" << (elapsed > 0 ? requests / elapsed : 0) << ".\n"
+       << "Info: latency_ms p50=" << percentile(0.5) << " p90=" << percentile(0.9)
+       << " p99=" << percentile(0.99) << " max=" << percentile(1) << ".\n"
+       << "Info: timeouts=" << result.timeouts << " malformed=" << result.malformed
+       << " nak_unknown_command=" << result.unknown << " nak_checksum=" << result.checksum
+       << " nak_parity=" << result.parity << " nak_overrun=" << result.overrun
+       << " nak_framing=" << result.framing << " nak_timeout=" << result.nak_timeout << ".\n";
+  if (errors || !requests) {
+    cerr << "Error: stress test FAILED, " << errors << " errors in " << requests << " requests.\n";
+    return 1;
+  }
+  cerr << "Info: stress test PASSED.\n";
+  return 0;
+}
+
+// One timecode read of a synchronized capture, the tape position with the
+// time it was read at, halfway between request and reply
+bool read_position(bool ltc, Timecode& position, int64_t& at_ns)
+{
+  Sony9PinRemote::TimeCode tc;
+  if (!query(ltc ? command_frames::ltc_tc_ub : command_frames::timer1) ||
+      !decode_timecode(serialLink.frame(), serialLink.frame_size(), tc, nullptr)) {
+    return false;
+  }
+  const auto tx = serialLink.tx();
+  const auto rx = serialLink.rx();
+  sidecar.sample(ltc ? "ltc" : "timer1", tx, rx, tc);
+  journal.position(tc, rx.realtime / 1000000);
+  position = Timecode::from_deck(tc, profile.fps);
+  at_ns = (tx.monotonic + rx.monotonic) / 2;
+  return true;
+}
+
+// Polls back to back while the tape plays up to the target. Each frame
+// change seen dates the start of a frame to within half a poll; the launch
+// waits until the target frame starts by that anchor and the play speed,
+// once less than a poll and a half is left. Returns the launch time.
+int wait_for_frame(const Timecode& target, bool ltc, int64_t& launch_ns)
+{
+  TraceSpan span(__func__);
+  // Play speed of 30 fps timecode is 29.97
+  const int64_t frame_ns = profile.fps == 30 ? 1001000000 / 30 : 1000000000 / profile.fps;
+  const int64_t stall_ns = 5000000000LL;
+  const int max_failures = 10;
+
+  Timecode last, anchor;
+  int64_t lastNs = 0, anchorNs = 0, advanceNs = stamp_now().monotonic;
+  int failures = 0;
+  for (;;) {
+    Timecode position;
+    int64_t at_ns;
+    const auto start = stamp_now().monotonic;
+    if (!read_position(ltc, position, at_ns)) {
+      if (++failures >= max_failures) {
+        std::cerr << "Error: timecode read failed.\n";
+        return 1;
+      }
+      ready(false);
+      continue;
+    }
+    failures = 0;
+    const auto poll_ns = stamp_now().monotonic - start;
+
+    if (position >= target) {
+      // Too late for a prediction, launch now and let the error tell
+      if (position - target > 1) {
+        char text[Timecode::format_size];
+        target.format(text);
+        std::cerr << "Error: tape is past " << text << ", pre-roll too short or tape not cued.\n";
+        return 1;
+      }
+      launch_ns = stamp_now().monotonic;
+      return 0;
+    }
+    if (lastNs && position - last == 1) {
+      anchor = position;
+      anchorNs = (lastNs + at_ns) / 2;
+    }
+    if (position != last) {
+      advanceNs = at_ns;
+    } else if (at_ns - advanceNs > stall_ns) {
+      std::cerr << "Error: tape timecode is not running.\n";
+      return 1;
+    }
+    last = position;
+    lastNs = at_ns;
+
+    const auto predicted = (anchorNs ? anchorNs + (target - anchor) * frame_ns : at_ns + (target - position) * frame_ns);
+    if (predicted - stamp_now().monotonic < poll_ns * 3 / 2) {
+      wait_until(predicted);
+      launch_ns = stamp_now().monotonic;
+      return 0;
+    }
+  }
+}
+
+// Start error in frames: the tape position at launch from the next read
+// and the play speed, against the target
+double start_error(const Timecode& target, bool ltc, int64_t launch_ns)
+{
+  const double frame_ns = profile.fps == 30 ? 1001000000.0 / 30 : 1000000000.0 / profile.fps;
+  Timecode position;
+  int64_t at_ns;
+  if (!read_position(ltc, position, at_ns)) {
+    return NAN;
+  }
+  // A read lands on average halfway through its frame
+  return (position - target) + 0.5 - (at_ns - launch_ns) / frame_ns;
+}
+
+// Cues to the in point less the pre-roll, plays and starts the capture when
+// the in point comes by, then stops it at the out point if any
+int capture_between(Timecode in, const Timecode* out, int preroll_seconds, bool ltc, bool verbose)
+{
+  TraceSpan span(__func__);
+  // Points in the drop-frame mode of the tape, whatever separator was typed
+  Timecode position, outPoint;
+  int64_t at_ns;
+  if (!read_position(ltc, position, at_ns)) {
+    std::cerr << "Error: timecode read failed.\n";
+    return 1;
+  }
+  in = in.in_mode(profile.fps, position.is_df());
+  if (out) {
+    outPoint = out->in_mode(profile.fps, position.is_df());
+    out = &outPoint;
+  }
+  const auto cue = in - (int64_t)preroll_seconds * profile.fps;
+  char inText[Timecode::format_size], outText[Timecode::format_size] = "", cueText[Timecode::format_size];
+  in.format(inText);
+  cue.format(cueText);
+  if (out) {
+    if (*out <= in) {
+      std::cerr << "Error: out point is not after the in point.\n";
+      return 1;
+    }
+    out->format(outText);
+  }
+
+  if (!is_cued(cue, verbose)) {
+    if (const auto result = journaled('c', &cue, [&] { return cue_up_with_data(cue, verbose); })) {
+      return result;
+    }
+    if (verbose) {
+      std::cerr << "Info: cueing to " << cueText << ".\n";
+    }
+    // Cue up is still set from a previous cue until the deck moves, the
+    // tape has to be there and stand still
+    const auto deadline = stamp_now().monotonic + (int64_t)profile.cue_timeout_ms * 1000000;
+    Timecode last;
+    for (;;) {
+      wait_until(stamp_now().monotonic + 100000000);
+      if (ready(verbose)) {
+        return 1;
+      }
+      Sony9PinRemote::Status st;
+      if (query(command_frames::status_sense) && decode_status(serialLink.frame(), serialLink.frame_size(), st)
+          && st.b_cue_up && read_position(ltc, position, at_ns)) {
+        if (position == last && llabs(position - cue) <= profile.fps) {
+          break;
+        }
+        last = position;
+      }
+      if (stamp_now().monotonic > deadline) {
+        std::cerr << "Error: cue to " << cueText << " not complete within " << profile.cue_timeout_ms << " ms.\n";
+        return 1;
+      }
+    }
+  }
+
+  if (const auto result = journaled('p', nullptr, [&] { return play(verbose); })) {
+    return result;
+  }
+  if (const auto result = ready(verbose)) {
+    return result;
+  }
+
+  int64_t launch_ns;
+  if (const auto result = wait_for_frame(in, ltc, launch_ns)) {
+    return result;
+  }
+  string error;
+  if (!capture.start(inText, outText, error)) {
+    std::cerr << "Error: capture start failed, " << error << ".\n";
+    return 1;
+  }
+  char achieved[32];
+  snprintf(achieved, sizeof(achieved), "%+.1f", start_error(in, ltc, launch_ns));
+  std::cerr << "Info: capture started at " << inText << ", start error " << achieved << " frames.\n";
+
+  if (!out) {
+    return 0;
+  }
+  if (const auto result = wait_for_frame(*out, ltc, launch_ns)) {
+    capture.stop(error);
+    return result;
+  }
+  if (!capture.stop(error)) {
+    std::cerr << "Error: capture stop failed, " << error << ".\n";
+    return 1;
+  }
+  snprintf(achieved, sizeof(achieved), "%+.1f", start_error(*out, ltc, launch_ns));
+  std::cerr << "Info: capture stopped at " << outText << ", stop error " << achieved << " frames.\n";
+  return 0;
+}
+
+// Frame steps and jogs of m and j on the serial port, timer1 replies in
+// the journal and the sidecar as any other read
+Motion<QSerialPort> motion()
+{
+  Motion<QSerialPort> motion(poller, serialLink, profile.fps);
+  motion.on_position = [](const Sony9PinRemote::TimeCode& tc, const Stamp& tx, const Stamp& rx) {
+    sidecar.sample("timer1", tx, rx, tc);
+    journal.position(tc, rx.realtime / 1000000);
+  };
+  return motion;
+}
+
+// Relative move of frames, negative for reverse
+int step_frames(int64_t frames, bool verbose)
+{
+  if (auto result = check_status_for_command()) {
+    return result;
+  }
+  return motion().step_frames(frames, verbose);
+}
+
+// Jog at rate times play speed for a duration, then still and corrected
+int jog(double rate, double seconds, bool verbose)
+{
+  if (auto result = check_status_for_command()) {
+    return result;
+  }
+  return motion().jog(rate, seconds, verbose);
+}
+
+// Tape ID from the command line or the LTC user bits, then the journal of
+// this port and tape is replayed and reopened for appending
+int open_journal(const QString& dir, QString tape, bool verbose) {
+  if (tape.isEmpty() && profile.ltc) {
+    deck.current_time_sense_ltc_tc_ub();
+    if (receive() && test_ack()) {
+      tape = QString::fromStdString(Journal::tape_from_userbits(deck.userbits()));
+    }
+  }
+  if (tape.isEmpty()) {
+    std::cerr << "Error: no tape ID in the LTC user bits, use --tape.\n";
+    return 1;
+  }
+  if (!journal.open(dir.toStdString(), serialPort.portName().toStdString(), tape.toStdString(), profile.fps)) {
+    std::cerr << "Error: can not open journal " << journal.file_name() << ".\n";
+    return 1;
+  }
+
+  std::cerr << "Info: journal " << journal.file_name() << ", " << journal.entries() << " entries";
+  if (journal.has_position()) {
+    char text[Timecode::format_size];
+    journal.last_position().format(text);
+    std::cerr << ", last position " << text << (journal.is_parked() ? " (parked)" : "") << " at "
+              << QDateTime::fromMSecsSinceEpoch(journal.position_time_ms()).toString(Qt::ISODateWithMs).toStdString();
+  }
+  if (journal.has_cue()) {
+    char text[Timecode::format_size];
+    journal.last_cue().format(text);
+    std::cerr << ", last cue " << text;
+  }
+  std::cerr << ".\n";
+
+  // Reply times of earlier sessions replace the profile guess
+  if (const auto typical = journal.typical_reply_ms()) {
+    profile.typical_latency_ms = typical;
+    if (verbose) {
+      std::cerr << "Info: typical latency " << typical << " ms from the journal.\n";
+    }
+  }
+
+  return 0;
+}
+
+void report_health() {
+  for (const auto& regression : health.regressions())
+    std::cerr << "Error: deck health regressed, " << regression << ".\n";
+}
+
+// Measurements of earlier sessions of this deck, regressions reported
+// before anything is captured
+int open_health(const QString& dir, bool verbose) {
+  if (!health.open(dir.toStdString(), serialPort.portName().toStdString(), deck.device_type(), profile.fps)) {
+    std::cerr << "Error: can not open health file " << health.file_name() << ".\n";
+    return 1;
+  }
+
+  if (verbose) {
+    std::cerr << "Info: health file " << health.file_name();
+    for (int i = 0; i < Health::metric_count; i++) {
+      const auto metric = (Health::Metric)i;
+      double baseline, recent;
+      std::cerr << ", " << Health::metric_names[i] << ' ' << health.count(metric);
+      if (health.compare(metric, baseline, recent))
+        std::cerr << " (baseline " << baseline << ", recent " << recent << ')';
+    }
+    std::cerr << ".\n";
+  }
+  report_health();
+  return 0;
+}
+
 void interactive(bool& is_interactive) {
   is_interactive = true;
   cerr << "Info: interactive mode.\n";
@@ -536,12 +1038,33 @@ void interactive(bool& is_interactive) {
 int main(int argc, char* argv[]) {
   QCoreApplication coreApplication(argc, argv);
   QStringList argumentList = QCoreApplication::arguments();
+  poller.on_reply = [](bool received, bool nak) { health.reply(received, nak); };
 
   QString commandName;
   if (!argumentList.isEmpty())
     commandName = argumentList.takeFirst();
 
-  bool verbose = false, continuous = false;
+  bool verbose = false, continuous = false, ganged = false;
+  int fps = 0;
+  int stressSeconds = 0;
+  QString sidecarName;
+  QString sidecarRate = "30000/1001";
+  QString sidecarStart;
+  QString logName;
+  uint64_t logSize = 64;
+  int64_t logAge = 24;
+  QString logCompress;
+  QString timelineName;
+  QStringList ruleSpecs;
+  int64_t pollRate = 0, pollRateDen = 1;  // -1 for auto
+  int pollEvery = 1;
+  bool pollUserbits = false;
+  QString journalDir;
+  QString tapeId;
+  QString healthDir;
+  QString webSocket;
+  int preroll = 5;
+  bool captureLtc = false;
   while (!argumentList.isEmpty())
   {
     if (argumentList.first() == "--help" || argumentList.first() == "-h") {
@@ -562,6 +1085,139 @@ int main(int argc, char* argv[]) {
         cerr << "Info: continuous mode.\n";
         argumentList.removeFirst();
     }
+    else if (argumentList.first() == "--gang" || argumentList.first() == "-g") {
+        ganged = true;
+        cerr << "Info: gang mode.\n";
+        argumentList.removeFirst();
+    }
+    else if (argumentList.first().startsWith("--stress=")) {
+        bool ok = false;
+        stressSeconds = argumentList.takeFirst().mid(9).toInt(&ok);
+        if (!ok || stressSeconds <= 0) {
+          cerr << "Error: invalid stress duration.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--fps=")) {
+        bool ok = false;
+        fps = argumentList.takeFirst().mid(6).toInt(&ok);
+        if (!ok || fps <= 0) {
+          cerr << "Error: invalid fps.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--trace=")) {
+        const auto traceName = argumentList.takeFirst().mid(8);
+        if (!trace.open(traceName.toStdString())) {
+          cerr << "Error: can not open trace " << traceName.toStdString() << ".\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--log=")) {
+        logName = argumentList.takeFirst().mid(6);
+    }
+    else if (argumentList.first().startsWith("--log-size=")) {
+        bool ok = false;
+        logSize = argumentList.takeFirst().mid(11).toUInt(&ok);
+        if (!ok) {
+          cerr << "Error: invalid log size.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--log-age=")) {
+        bool ok = false;
+        logAge = argumentList.takeFirst().mid(10).toUInt(&ok);
+        if (!ok) {
+          cerr << "Error: invalid log age.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--log-compress=")) {
+        logCompress = argumentList.takeFirst().mid(15);
+        if (logCompress != "zstd" && logCompress != "gzip") {
+          cerr << "Error: invalid log compression " << logCompress.toStdString() << ".\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--rate=")) {
+        const auto rate = argumentList.takeFirst().mid(7);
+        if (rate == "auto") {
+          pollRate = -1;
+        } else if (!parse_frame_rate(rate.toStdString(), pollRate, pollRateDen)) {
+          cerr << "Error: invalid rate " << rate.toStdString() << ".\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--every=")) {
+        bool ok = false;
+        pollEvery = argumentList.takeFirst().mid(8).toInt(&ok);
+        if (!ok || pollEvery <= 0) {
+          cerr << "Error: invalid frame count.\n";
+          return 1;
+        }
+        if (!pollRate)
+          pollRate = -1;
+    }
+    else if (argumentList.first() == "--userbits") {
+        pollUserbits = true;
+        if (!pollRate)
+          pollRate = -1;
+        argumentList.removeFirst();
+    }
+    else if (argumentList.first().startsWith("--journal=")) {
+        journalDir = argumentList.takeFirst().mid(10);
+    }
+    else if (argumentList.first().startsWith("--tape=")) {
+        tapeId = argumentList.takeFirst().mid(7);
+        if (tapeId.isEmpty()) {
+          cerr << "Error: invalid tape ID.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--health=")) {
+        healthDir = argumentList.takeFirst().mid(9);
+    }
+    else if (argumentList.first().startsWith("--capture=")) {
+        capture.set_command(argumentList.takeFirst().mid(10).toStdString());
+    }
+    else if (argumentList.first().startsWith("--capture-signal=")) {
+        const auto target = argumentList.takeFirst().mid(17);
+        string error;
+        if (!capture.set_signal(target.toStdString(), error)) {
+          cerr << "Error: invalid capture signal " << target.toStdString() << ", " << error << ".\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first().startsWith("--preroll=")) {
+        bool ok = false;
+        preroll = argumentList.takeFirst().mid(10).toInt(&ok);
+        if (!ok || preroll < 0) {
+          cerr << "Error: invalid pre-roll.\n";
+          return 1;
+        }
+    }
+    else if (argumentList.first() == "--capture-ltc") {
+        captureLtc = true;
+        argumentList.removeFirst();
+    }
+    else if (argumentList.first().startsWith("--on=")) {
+        ruleSpecs << argumentList.takeFirst().mid(5);
+    }
+    else if (argumentList.first().startsWith("--websocket=")) {
+        webSocket = argumentList.takeFirst().mid(12);
+    }
+    else if (argumentList.first().startsWith("--timeline=")) {
+        timelineName = argumentList.takeFirst().mid(11);
+    }
+    else if (argumentList.first().startsWith("--sidecar=")) {
+        sidecarName = argumentList.takeFirst().mid(10);
+    }
+    else if (argumentList.first().startsWith("--sidecar-rate=")) {
+        sidecarRate = argumentList.takeFirst().mid(15);
+    }
+    else if (argumentList.first().startsWith("--sidecar-start=")) {
+        sidecarStart = argumentList.takeFirst().mid(16);
+    }
     else
         break;
   }
@@ -571,10 +1227,117 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  int64_t sidecarNum = 0, sidecarDen = 1, sidecarStartNs = 0;
+  if (!sidecarName.isEmpty()) {
+    if (!parse_frame_rate(sidecarRate.toStdString(), sidecarNum, sidecarDen)) {
+      cerr << "Error: invalid sidecar rate " << sidecarRate.toStdString() << ".\n";
+      return 1;
+    }
+    if (!sidecarStart.isEmpty()) {
+      const auto startTime = QDateTime::fromString(sidecarStart, Qt::ISODateWithMs);
+      if (!startTime.isValid()) {
+        cerr << "Error: invalid sidecar start " << sidecarStart.toStdString() << ".\n";
+        return 1;
+      }
+      sidecarStartNs = startTime.toMSecsSinceEpoch() * 1000000;
+    }
+  }
+
+  if (!logName.isEmpty() &&
+      !logSink.open(logName.toStdString(), logSize * 1024 * 1024, logAge * 3600, logCompress.toStdString())) {
+    cerr << "Error: can not open log " << logName.toStdString() << ".\n";
+    return 1;
+  }
+
   const auto& serialPortName = argumentList.takeFirst();
+  if (ganged) {
+    if (!journalDir.isEmpty()) {
+      cerr << "Error: --journal is not supported in gang mode.\n";
+      return 1;
+    }
+    if (!healthDir.isEmpty()) {
+      cerr << "Error: --health is not supported in gang mode.\n";
+      return 1;
+    }
+    if (!webSocket.isEmpty()) {
+      cerr << "Error: --websocket is not supported in gang mode.\n";
+      return 1;
+    }
+    return gang(serialPortName.split(','), argumentList, fps, verbose);
+  }
+
   if (auto result = setup(serialPortName, verbose)) {
     return result;
   }
+  trace.thread_name(0, serialPort.portName().toStdString());
+  // Timeouts, settle times and timecode rate all come from the profile
+  if (auto result = identify(verbose)) {
+    return result;
+  }
+
+  // Deck side of the sidecar at the timecode rate of the deck profile
+  if (!sidecarName.isEmpty() &&
+      !sidecar.open(sidecarName.toStdString(), sidecarNum, sidecarDen, sidecarStartNs, profile.fps)) {
+    cerr << "Error: can not open sidecar " << sidecarName.toStdString() << ".\n";
+    return 1;
+  }
+
+  for (const auto& ruleSpec : ruleSpecs) {
+    string error;
+    if (!continuous) {
+      cerr << "Error: --on needs continuous mode.\n";
+      return 1;
+    }
+    if (!rules.add(ruleSpec.toStdString(), profile.fps, error)) {
+      cerr << "Error: invalid rule " << ruleSpec.toStdString() << ", " << error << ".\n";
+      return 1;
+    }
+  }
+
+  if (!webSocket.isEmpty()) {
+    if (!continuous) {
+      cerr << "Error: --websocket needs continuous mode.\n";
+      return 1;
+    }
+    const auto text = webSocket.toStdString();
+    const auto colon = text.rfind(':');
+    const auto address = colon == string::npos ? string() : text.substr(0, colon);
+    bool ok = false;
+    const auto port = QString::fromStdString(text.substr(colon + 1)).toUShort(&ok);
+    if (!ok) {
+      cerr << "Error: invalid WebSocket port " << text << ".\n";
+      return 1;
+    }
+    string error;
+    if (!stateStream.open(address, port, error)) {
+      cerr << "Error: can not listen on " << text << ", " << error << ".\n";
+      return 1;
+    }
+    if (verbose) {
+      cerr << "Info: WebSocket stream on port " << stateStream.port() << ".\n";
+    }
+  }
+
+  if (!timelineName.isEmpty() && !timeline.open(timelineName.toStdString(), profile.fps)) {
+    cerr << "Error: can not open timeline " << timelineName.toStdString() << ".\n";
+    return 1;
+  }
+
+  if (!journalDir.isEmpty()) {
+    if (auto result = open_journal(journalDir, tapeId, verbose)) {
+      return result;
+    }
+  }
+
+  if (!healthDir.isEmpty()) {
+    if (auto result = open_health(healthDir, verbose)) {
+      return result;
+    }
+  }
+
+  if (stressSeconds) {
+    return stress(stressSeconds, verbose);
+  }
 
   auto is_interactive = false;
   if (!continuous && argumentList.isEmpty()) {
@@ -638,43 +1401,43 @@ int main(int argc, char* argv[]) {
         break;
       }
       case 'e': {
-        if (const auto result = eject(verbose)) {
+        if (const auto result = journaled('e', nullptr, [&] { return eject(verbose); })) {
           return result;
         }
         break;
       }
       case 'f': {
-        if (const auto result = fast_forward(verbose)) {
+        if (const auto result = journaled('f', nullptr, [&] { return fast_forward(verbose); })) {
           return result;
         }
         break;
       }
       case 'x': {
-        if (const auto result = frame_step_forward(verbose)) {
+        if (const auto result = journaled('x', nullptr, [&] { return frame_step_forward(verbose); })) {
           return result;
         }
         break;
       }
       case 'w': {
-        if (const auto result = frame_step_reverse(verbose)) {
+        if (const auto result = journaled('w', nullptr, [&] { return frame_step_reverse(verbose); })) {
           return result;
         }
         break;
       }
       case 'p': {
-        if (const auto result = play(verbose)) {
+        if (const auto result = journaled('p', nullptr, [&] { return play(verbose); })) {
           return result;
         }
         break;
       }
       case 'r': {
-        if (const auto result = rewind(verbose)) {
+        if (const auto result = journaled('r', nullptr, [&] { return rewind(verbose); })) {
           return result;
         }
         break;
       }
       case 's': {
-        if (const auto result = stop(verbose)) {
+        if (const auto result = journaled('s', nullptr, [&] { return stop(verbose); })) {
           return result;
         }
         break;
@@ -687,38 +1450,103 @@ int main(int argc, char* argv[]) {
           param = argumentList.takeFirst();
         }
 
-        QStringList tc = param.split(QRegularExpression("[:;]"));
-        if (tc.size() != 4) {
+        const auto text = param.toLatin1();
+        Timecode tc;
+        if (!Timecode::parse(text.constData(), text.size(), profile.fps, tc)) {
           cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
           return 1;
         }
 
-        bool ok = false;
-        uint8_t hh = tc[0].toUShort(&ok);
-        if (!ok) {
-          cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
-          return 1;
+        if (is_cued(tc, verbose)) {
+          break;
+        }
+        if (const auto result = journaled('c', &tc, [&] { return cue_up_with_data(tc, verbose); })) {
+          return result;
+        }
+        break;
+      }
+      case 'm':
+      case 'j': {
+        QStringList params;
+        if (is_interactive) {
+          params = QString().fromStdString(remains).simplified().split(' ');
+        } else {
+          for (int i = 0; i < (value == 'm' ? 1 : 2) && !argumentList.isEmpty(); i++)
+            params << argumentList.takeFirst();
         }
 
-        uint8_t mm = tc[1].toUShort(&ok);
-        if (!ok) {
-          cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
-          return 1;
+        // Replies of the steps and jogs are checked one by one, the deck
+        // controller does not see them
+        const auto relative = [&](function<int()> move) {
+          journal.command(value);
+          health.command(value, stamp_now().monotonic);
+          const auto result = move();
+          journal.reply(value, result ? Journal::Fail : Journal::Ok, lastReplyNs);
+          return result;
+        };
+        bool ok = params.size() == (value == 'm' ? 1 : 2);
+        if (value == 'm') {
+          const auto frames = ok ? params[0].toLongLong(&ok) : 0;
+          if (!ok || !frames) {
+            cerr << "Error: m needs a frame count.\n";
+            return 1;
+          }
+          if (const auto result = relative([&] { return step_frames(frames, verbose); })) {
+            return result;
+          }
+        } else {
+          bool seconds_ok = false;
+          const auto rate = ok ? params[0].toDouble(&ok) : 0;
+          const auto seconds = ok ? params[1].toDouble(&seconds_ok) : 0;
+          if (!ok || !seconds_ok || fabs(rate) < 0.01 || seconds <= 0) {
+            cerr << "Error: j needs a rate (0.01 to 90 times play speed) and a duration.\n";
+            return 1;
+          }
+          if (const auto result = relative([&] { return jog(rate, seconds, verbose); })) {
+            return result;
+          }
+        }
+        break;
+      }
+      case 'k': {
+        QStringList params;
+        if (is_interactive) {
+          params = QString().fromStdString(remains).simplified().split(' ');
+        } else {
+          if (!argumentList.isEmpty())
+            params << argumentList.takeFirst();
+          // The out point is optional, the next argument may be a command
+          Timecode tc;
+          if (!argumentList.isEmpty()) {
+            const auto text = argumentList.first().toLatin1();
+            if (Timecode::parse(text.constData(), text.size(), profile.fps, tc))
+              params << argumentList.takeFirst();
+          }
         }
 
-        uint8_t ss = tc[2].toUShort(&ok);
-        if (!ok) {
-          cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
+        if (params.isEmpty() || params.first().isEmpty() || params.size() > 2) {
+          cerr << "Error: k needs an in point and an optional out point.\n";
           return 1;
         }
-
-        uint8_t ff = tc[3].toUShort(&ok);
-        if (!ok) {
-          cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
+        Timecode points[2];
+        for (int i = 0; i < params.size(); i++) {
+          const auto text = params[i].toLatin1();
+          if (!Timecode::parse(text.constData(), text.size(), profile.fps, points[i])) {
+            cerr << "Error: invalid timecode " << params[i].toStdString() << ".\n";
+            return 1;
+          }
+        }
+        if (!capture.is_set()) {
+          cerr << "Error: k needs --capture or --capture-signal.\n";
+          return 1;
+        }
+        if (captureLtc && !profile.ltc) {
+          cerr << "Error: the deck has no LTC reader.\n";
           return 1;
         }
 
-        if (const auto result = cue_up_with_data(hh, mm, ss, ff, verbose)) {
+        if (const auto result = capture_between(points[0], params.size() > 1 ? &points[1] : nullptr, preroll,
+                                                captureLtc, verbose)) {
           return result;
         }
         break;
@@ -730,189 +1558,88 @@ int main(int argc, char* argv[]) {
   }
 
   if (continuous) {
-    bool first=true;
-    bool stop = false;
-    while (!stop) {
-      State state;
-      bool print = false;
-
-      deck.status_sense();
-      if (!deck.parse_until(1000))
-        std::cerr << "Error: parse failed.\n";
-
-      if (!test_ack()) {
-        std::cout << "Info: parse issue.\n";
-        deck.print_nak();
+    Sony9PinRemote::UserBits lastUserbits = {};
+    bool hasUserbits = false;
+    poller.run(scheduler, rules, send_transport, [&](const State& state, const State&, const Poll& poll, bool first) {
+      bool stop = false;
+      bool userbitsChanged = false;
+
+      if (poll.dropped) {
+        std::cerr << "Error: deck is not ready, no reply within " << 2 * poller.timeout_ms() << " ms.\n";
       }
-      state.st = deck.status();
-
-      deck.current_time_sense_timer1();
-      if (!deck.parse_until(1000))
+      if (poll.failed) {
         std::cerr << "Error: parse failed.\n";
-
-      if (!test_ack()) {
-        std::cout << "Info: parse issue.\n";
-        deck.print_nak();
       }
-      state.tc = deck.timecode();
-
-      std::stringstream ss;
-      ss << dec << ' '
-         << setw(2) << setfill('0') << (unsigned int)state.tc.hour << ':'
-         << setw(2) << setfill('0') << (unsigned int)state.tc.minute << ':'
-         << setw(2) << setfill('0') << (unsigned int)state.tc.second << ';'
-         << setw(2) << setfill('0') << (unsigned int)state.tc.frame
-         << resetiosflags(std::ios::dec);
-
-      if (first || state.tc != lastState.tc) {
-        print = true;
-      }
-
-      if (first || state.st.b_cassette_out != lastState.st.b_cassette_out) {
-        ss << " cassette_out=" << (unsigned int)state.st.b_cassette_out;
-        print = true;
-      }
-
-      if (first || state.st.b_servo_ref_missing != lastState.st.b_servo_ref_missing) {
-        ss << " servo_ref_missing=" << (unsigned int)state.st.b_servo_ref_missing;
-        print = true;
-      }
-
-      if (first || state.st.b_local != lastState.st.b_local) {
-        ss << " local=" << (unsigned int)state.st.b_local;
-        print = true;
-      }
-
-      if (first || state.st.b_standby != lastState.st.b_standby) {
-        ss << " standby=" << (unsigned int)state.st.b_standby;
-        print = true;
+      if (poll.undecoded) {
+        std::cerr << "Info: parse issue.\n";
       }
-
-      if (first || state.st.b_stop != lastState.st.b_stop) {
-        ss << " stop=" << (unsigned int)state.st.b_stop;
-        print = true;
-
-        if (state.st.b_stop)
-          stop = true;
-      }
-
-      if (first || state.st.b_eject != lastState.st.b_eject) {
-        ss << " eject=" << (unsigned int)state.st.b_eject;
-        print = true;
+      if (poll.timecode) {
+        sidecar.sample("timer1", poll.tx, poll.rx, state.tc);
       }
-
-      if (first || state.st.b_rewind != lastState.st.b_rewind) {
-        ss << " rewind=" << (unsigned int)state.st.b_rewind;
-        print = true;
+      timeline.append(poll.rx.realtime / 1000000, state);
+      if (stateStream.is_open()) {
+        stateStream.publish(state, poll.rx.realtime / 1000000);
       }
-
-      if (first || state.st.b_forward != lastState.st.b_forward) {
-        ss << " forward=" << (unsigned int)state.st.b_forward;
-        print = true;
+      journal.position(state.tc, pack_status(state.st, state.tc), poll.rx.realtime / 1000000);
+      if (health.is_open()) {
+        health.sample(state.st, Timecode::from_deck(state.tc, profile.fps).frames(), poll.rx.monotonic);
       }
-
-      if (first || state.st.b_record != lastState.st.b_record) {
-        ss << " record=" << (unsigned int)state.st.b_record;
-        print = true;
+      if (poll.userbits) {
+        userbitsChanged = !hasUserbits || memcmp(poll.ub.bytes, lastUserbits.bytes, sizeof(poll.ub.bytes));
+        hasUserbits = true;
+        lastUserbits = poll.ub;
       }
 
-      if (first || state.st.b_play != lastState.st.b_play) {
-        ss << " play=" << (unsigned int)state.st.b_play;
-        print = true;
-      }
-
-      if (first || state.st.b_servo_lock != lastState.st.b_servo_lock) {
-        ss << " servo_lock=" << (unsigned int)state.st.b_servo_lock;
-        print = true;
-      }
-
-      if (first || state.st.b_tso_mode != lastState.st.b_tso_mode) {
-        ss << " tso_mode=" << (unsigned int)state.st.b_tso_mode;
-        print = true;
-      }
-
-      if (first || state.st.b_shuttle != lastState.st.b_shuttle) {
-        ss << " shuttle=" << (unsigned int)state.st.b_shuttle;
-        print = true;
-      }
-
-      if (first || state.st.b_jog != lastState.st.b_jog) {
-        ss << " jog=" << (unsigned int)state.st.b_jog;
-        print = true;
-      }
-
-      if (first || state.st.b_var != lastState.st.b_var) {
-        ss << " var=" << (unsigned int)state.st.b_var;
-        print = true;
-      }
-
-      if (first || state.st.b_direction != lastState.st.b_direction) {
-        ss << " direction=" << (unsigned int)state.st.b_direction;
-        print = true;
-      }
-
-      if (first || state.st.b_still != lastState.st.b_still) {
-        ss << " still=" << (unsigned int)state.st.b_still;
-        print = true;
-      }
-
-      if (first || state.st.b_cue_up != lastState.st.b_cue_up) {
-        ss << " cue_up=" << (unsigned int)state.st.b_cue_up;
-        print = true;
-      }
-
-      if (first || state.st.b_lamp_still != lastState.st.b_lamp_still) {
-        ss << " lamp_still=" << (unsigned int)state.st.b_lamp_still;
-        print = true;
-      }
-
-      if (first || state.st.b_lamp_fwd != lastState.st.b_lamp_fwd) {
-        ss << " lamp_fwd=" << (unsigned int)state.st.b_lamp_fwd;
-        print = true;
-      }
-
-      if (first || state.st.b_lamp_rev != lastState.st.b_lamp_rev) {
-        ss << " lamp_rev=" << (unsigned int)state.st.b_lamp_rev;
-        print = true;
-      }
-
-      if (first || state.st.b_near_eot != lastState.st.b_near_eot) {
-        ss << " near_eot=" << (unsigned int)state.st.b_near_eot;
-        print = true;
-      }
-
-      if (first || state.st.b_eot != lastState.st.b_eot) {
-        ss << " eot=" << (unsigned int)state.st.b_eot;
-        print = true;
-      }
-
-      if (first || state.st.b_cf_lock != lastState.st.b_cf_lock) {
-        ss << " cf_lock=" << (unsigned int)state.st.b_cf_lock;
-        print = true;
-      }
-
-      if (first || state.st.b_svo_alarm != lastState.st.b_svo_alarm) {
-        ss << " svo_alarm=" << (unsigned int)state.st.b_svo_alarm;
+      TraceSpan formatSpan("format");
+      std::stringstream ss;
+      bool print = format_state(ss, state, lastState, first);
+      if (userbitsChanged) {
+        ss << " ub=";
+        format_userbits(ss, lastUserbits);
         print = true;
       }
-
-      if (first || state.st.b_sys_alarm != lastState.st.b_sys_alarm) {
-        ss << " sys_alarm=" << (unsigned int)state.st.b_sys_alarm;
-        print = true;
-      }
-
-      if (first || state.st.b_rec_inhib != lastState.st.b_rec_inhib) {
-        ss << " rec_inhib=" << (unsigned int)state.st.b_rec_inhib;
-        print = true;
+      if ((first || state.st.b_stop != lastState.st.b_stop) && state.st.b_stop) {
+        stop = true;
       }
 
       if (print) {
-        cout << QDateTime::currentDateTime().toString(Qt::ISODateWithMs).toStdString() << ss.str() << '\n';
+        TraceSpan span("output");
+        const auto line = QDateTime::fromMSecsSinceEpoch(poll.rx.realtime / 1000000).toString(Qt::ISODateWithMs).toStdString() + ss.str() + '\n';
+        if (logSink.is_open())
+          logSink.write(line);
+        else
+          cout << line;
         lastState=state;
       }
-      first=false;
+
+      // Grid starts after the first sample, which tells drop-frame or not
+      if (first && pollRate) {
+        if (pollRate < 0) {
+          const int fps = state.tc.is_df ? 30 : profile.fps;
+          pollRate = fps == 30 ? 30000 : fps;
+          pollRateDen = fps == 30 ? 1001 : 1;
+        }
+        scheduler.start(pollRate, pollRateDen, pollEvery, pollUserbits && profile.ltc, profile.typical_latency_ms);
+        if (verbose) {
+          std::cerr << "Info: polling at " << pollRate << '/' << pollRateDen << " fps every " << pollEvery << " frames.\n";
+        }
+      }
+      return stop;
+    });
+    scheduler.report();
+    rules.report();
+    if (stateStream.is_open()) {
+      stateStream.close();
+      const auto stats = stateStream.stats();
+      cerr << "Info: WebSocket stream, " << stats.clients << " clients, " << stats.messages << " messages, "
+           << stats.coalesced << " updates coalesced for slow clients.\n";
     }
   }
 
+  journal.close();
+  if (health.is_open()) {
+    health.close();
+    report_health();
+  }
   return 0;
 }
@@ -2,11 +2,53 @@ TEMPLATE = app
 TARGET = sony9pin
 INCLUDEPATH += .
 CONFIG += c++14
-QT += serialport
+QT += serialport websockets
 
 # Lib
 INCLUDEPATH += ./
 
 # Input
+HEADERS += capture.h \
+           clock.h \
+           csv.h \
+           format.h \
+           frame.h \
+           gang.h \
+           health.h \
+           journal.h \
+           link.h \
+           logsink.h \
+           motion.h \
+           poller.h \
+           profiles.h \
+           rules.h \
+           scheduler.h \
+           sidecar.h \
+           stream.h \
+           stress.h \
+           timecode.h \
+           timeline.h \
+           trace.h
+
 SOURCES += sony9pin.cpp \
-           devices.cpp
+           capture.cpp \
+           clock.cpp \
+           csv.cpp \
+           devices.cpp \
+           format.cpp \
+           frame.cpp \
+           gang.cpp \
+           health.cpp \
+           journal.cpp \
+           link.cpp \
+           logsink.cpp \
+           port.cpp \
+           profiles.cpp \
+           rules.cpp \
+           scheduler.cpp \
+           sidecar.cpp \
+           stream.cpp \
+           timeline.cpp \
+           trace.cpp
+
+RESOURCES += profiles.qrc
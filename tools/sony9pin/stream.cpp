@@ -0,0 +1,157 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "stream.h"
+
+#include <QDateTime>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QWebSocket>
+#include <QWebSocketServer>
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+struct StateStream::Client {
+  QWebSocket* socket;
+  State sent;
+  uint64_t sequence;  // 0 until the first message
+};
+
+StateStream::~StateStream() {
+  close();
+}
+
+bool StateStream::open(const string& address, uint16_t port, string& error) {
+  starting = true;
+  server = thread(&StateStream::run, this, address, port);
+  unique_lock<mutex> lock(state_mutex);
+  started.wait(lock, [this] { return !starting; });
+  if (!context) {
+    lock.unlock();
+    server.join();
+    error = listen_error;
+    return false;
+  }
+  return true;
+}
+
+void StateStream::close() {
+  if (!server.joinable())
+    return;
+  if (context) {
+    auto quit = loop;
+    QMetaObject::invokeMethod(context, [quit] { quit->quit(); }, Qt::QueuedConnection);
+  }
+  server.join();
+  context = nullptr;
+}
+
+void StateStream::publish(const State& state, int64_t realtime_ms) {
+  {
+    lock_guard<mutex> lock(state_mutex);
+    latest = state;
+    latest_ms = realtime_ms;
+    sequence++;
+  }
+  // One wake up in flight at most, whatever the poll rate
+  if (!wake_pending.exchange(true))
+    QMetaObject::invokeMethod(context, [this] { wake_pending = false; update_all(); }, Qt::QueuedConnection);
+}
+
+StateStream::Stats StateStream::stats() const {
+  return { client_count, message_count, coalesced_count, backlogged_count, max_backlog };
+}
+
+void StateStream::run(string address, uint16_t port) {
+  QEventLoop eventLoop;
+  QObject wake;
+  QWebSocketServer webSocketServer("sony9pin", QWebSocketServer::NonSecureMode);
+  const bool listening = webSocketServer.listen(
+    address.empty() ? QHostAddress(QHostAddress::Any) : QHostAddress(QString::fromStdString(address)), port);
+  {
+    lock_guard<mutex> lock(state_mutex);
+    if (listening) {
+      context = &wake;
+      loop = &eventLoop;
+      bound_port = webSocketServer.serverPort();
+    } else {
+      listen_error = webSocketServer.errorString().toStdString();
+    }
+    starting = false;
+  }
+  started.notify_all();
+  if (!listening)
+    return;
+
+  QObject::connect(&webSocketServer, &QWebSocketServer::newConnection, &wake, [this, &webSocketServer] {
+    while (auto socket = webSocketServer.nextPendingConnection()) {
+      auto client = new Client { socket, {}, 0 };
+      clients.push_back(client);
+      client_count++;
+      // Written bytes make room for the update a backlog held back
+      QObject::connect(socket, &QWebSocket::bytesWritten, socket, [this, client] { update(*client); });
+      QObject::connect(socket, &QWebSocket::disconnected, socket, [this, client] {
+        clients.erase(find(clients.begin(), clients.end(), client));
+        client->socket->disconnect();
+        client->socket->deleteLater();
+        delete client;
+      });
+      update(*client);
+    }
+  });
+
+  eventLoop.exec();
+
+  webSocketServer.close();
+  for (auto client : clients) {
+    client->socket->disconnect();
+    client->socket->abort();
+    delete client->socket;
+    delete client;
+  }
+  clients.clear();
+}
+
+void StateStream::update_all() {
+  for (auto client : clients)
+    update(*client);
+}
+
+void StateStream::update(Client& client) {
+  if (client.socket->bytesToWrite() > backlog_bytes) {
+    backlogged_count++;
+    return;
+  }
+
+  State state;
+  int64_t realtime_ms;
+  uint64_t current;
+  {
+    lock_guard<mutex> lock(state_mutex);
+    state = latest;
+    realtime_ms = latest_ms;
+    current = sequence;
+  }
+  if (!current || client.sequence == current)
+    return;
+
+  stringstream ss;
+  const bool first = !client.sequence;
+  format_state(ss, state, client.sent, first);
+  const auto message = QDateTime::fromMSecsSinceEpoch(realtime_ms).toString(Qt::ISODateWithMs) + QString::fromStdString(ss.str());
+  client.socket->sendTextMessage(message);
+  if (!first)
+    coalesced_count += current - client.sequence - 1;
+  client.sent = state;
+  client.sequence = current;
+  message_count++;
+
+  const auto backlog = (uint64_t)client.socket->bytesToWrite();
+  for (auto max = max_backlog.load(); backlog > max && !max_backlog.compare_exchange_weak(max, backlog);) {
+  }
+}
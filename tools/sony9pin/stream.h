@@ -0,0 +1,87 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "format.h"
+
+class QEventLoop;
+class QObject;
+
+// WebSocket stream of the continuous mode state, for remote dashboards.
+// One text message per update, the continuous mode line without its
+// newline: "<ISO 8601 date> HH:MM:SS;FF[ <field>=<value>...]" with the
+// status fields changed since the previous message to this client (all
+// of them in its first message). The server has its own thread and Qt
+// event loop; publish() only copies the state and wakes it. A client with
+// more than a backlog of bytes not yet sent is skipped, then gets one
+// message to the latest state once its socket drained: a slow dashboard
+// neither delays the poll loop nor grows the memory.
+class StateStream {
+public:
+  struct Stats {
+    uint64_t clients;     // connected since open
+    uint64_t messages;    // sent, all clients
+    uint64_t coalesced;   // updates a client did not get, merged into a later message
+    uint64_t backlogged;  // updates held back by a client backlog
+    uint64_t max_backlog;
+  };
+
+  ~StateStream();
+
+  // An empty address listens on all interfaces, port 0 on any free port
+  bool open(const std::string& address, uint16_t port, std::string& error);
+  bool is_open() const { return context; }
+  uint16_t port() const { return bound_port; }
+  void close();
+
+  void publish(const State& state, int64_t realtime_ms);
+
+  Stats stats() const;
+
+  static const int64_t backlog_bytes = 64 * 1024;
+
+private:
+  struct Client;
+
+  void run(std::string address, uint16_t port);
+  void update(Client& client);
+  void update_all();
+
+  std::thread server;
+  QObject* context = nullptr;  // in the server thread, target of the wake ups
+  QEventLoop* loop = nullptr;
+  uint16_t bound_port = 0;
+
+  std::mutex state_mutex;
+  std::condition_variable started;
+  bool starting = false;
+  std::string listen_error;
+  State latest = {};
+  int64_t latest_ms = 0;
+  uint64_t sequence = 0;
+  std::atomic<bool> wake_pending { false };
+
+  // Server thread only
+  std::vector<Client*> clients;
+
+  std::atomic<uint64_t> client_count { 0 };
+  std::atomic<uint64_t> message_count { 0 };
+  std::atomic<uint64_t> coalesced_count { 0 };
+  std::atomic<uint64_t> backlogged_count { 0 };
+  std::atomic<uint64_t> max_backlog { 0 };
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "clock.h"
+#include "link.h"
+#include "poller.h"
+
+// Link error counts of --stress
+struct StressResult {
+  uint64_t requests = 0;
+  uint64_t timeouts = 0;
+  uint64_t malformed = 0;  // replies that are neither the data asked for nor a NAK
+  uint64_t unknown = 0;
+  uint64_t checksum = 0;
+  uint64_t parity = 0;
+  uint64_t overrun = 0;
+  uint64_t framing = 0;
+  uint64_t nak_timeout = 0;
+  int64_t elapsed_ns = 0;
+  std::vector<int64_t> latencies;  // request to reply, ns
+
+  uint64_t errors() const {
+    return timeouts + malformed + unknown + checksum + parity + overrun + framing + nak_timeout;
+  }
+};
+
+// Status sense and timer1 requests back to back for the duration. Sense
+// replies are data, not ACKs: a reply counts as an error when it is a NAK
+// (by its error bits) or not the data reply of the request, a timer1 reply
+// also when its timecode is not valid BCD.
+template <typename Port>
+StressResult stress_link(Poller<Port>& poller, Link<Port>& link, int seconds, bool verbose) {
+  StressResult result;
+  result.latencies.reserve(seconds * 200);
+
+  const auto start = stamp_now().monotonic;
+  const auto deadline = start + (int64_t)seconds * 1000000000;
+  auto now = start;
+  while (now < deadline) {
+    const bool status_request = result.requests % 2 == 0;
+    result.requests++;
+    const auto malformedBefore = link.malformed();
+    if (!poller.query(status_request ? command_frames::status_sense : command_frames::timer1)) {
+      if (link.malformed() != malformedBefore)
+        result.malformed++;
+      else
+        result.timeouts++;
+      if (verbose)
+        std::cerr << "Info: request " << result.requests << " timed out.\n";
+      // Drop any partial reply so the next request starts clean
+      poller.drop();
+      now = stamp_now().monotonic;
+      continue;
+    }
+    const auto received = stamp_now().monotonic;
+    result.latencies.push_back(received - now);
+    now = received;
+
+    const auto frame = link.frame();
+    const auto size = link.frame_size();
+    if (is_nak(frame)) {
+      const uint8_t error = size > 3 ? frame[2] : 0;
+      if (error & 0x04)
+        result.checksum++;
+      else if (error & 0x10)
+        result.parity++;
+      else if (error & 0x20)
+        result.overrun++;
+      else if (error & 0x40)
+        result.framing++;
+      else if (error & 0x80)
+        result.nak_timeout++;
+      else
+        result.unknown++;
+      continue;
+    }
+
+    if (status_request) {
+      uint8_t data[status_data_size];
+      if (!decode_status_data(frame, size, data))
+        result.malformed++;
+      continue;
+    }
+    // A timecode that is not valid BCD can only come from corrupted bytes
+    Sony9PinRemote::TimeCode tc;
+    if (frame[0] != 0x74 || frame[1] != 0x04 || !decode_timecode(frame, size, tc, nullptr) || tc.hour > 23 ||
+        tc.minute > 59 || tc.second > 59 || tc.frame > 29)
+      result.malformed++;
+  }
+  result.elapsed_ns = now - start;
+  return result;
+}
+
+#endif
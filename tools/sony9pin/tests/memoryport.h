@@ -0,0 +1,59 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef MEMORYPORT_H
+#define MEMORYPORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "format.h"
+#include "frame.h"
+#include "timecode.h"
+
+// Serial port in memory, answering status sense (playing, servo locked)
+// and timer1 (drop-frame, one frame further each time) at once
+class MemoryPort {
+public:
+  int64_t write(const char* data, int64_t size) {
+    uint8_t frame[FrameDecoder::max_size];
+    size_t length = 0;
+    if (size >= 3 && data[1] == 0x20) {
+      const uint8_t status[status_data_size] = { 0x00, 0x01, 0x80, 0x00, 0x10 };
+      length = encode_frame(frame, 0x70, 0x20, status, sizeof(status));
+    } else if (size >= 3 && data[1] == 0x0C) {
+      const auto i = frames++;
+      const uint8_t time[4] = { (uint8_t)(to_bcd(i % 30) | 0x40), to_bcd(i / 30 % 60), to_bcd(i / 1800 % 60),
+                                to_bcd(i / 108000 % 24) };
+      length = encode_frame(frame, 0x70, 0x00, time, sizeof(time));
+    }
+    memcpy(buffer + used, frame, length);
+    used += length;
+    return size;
+  }
+  int64_t peek(char* data, int64_t size) {
+    const auto count = std::min<int64_t>(size, used);
+    memcpy(data, buffer, count);
+    return count;
+  }
+  int64_t read(char* data, int64_t size) {
+    const auto count = peek(data, size);
+    used -= count;
+    memmove(buffer, buffer + count, used);
+    return count;
+  }
+  bool waitForReadyRead(int) { return used > 0; }
+  void clear() { used = 0; }
+
+private:
+  uint8_t buffer[256];
+  size_t used = 0;
+  uint64_t frames = 0;
+};
+
+#endif
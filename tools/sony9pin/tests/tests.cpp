@@ -0,0 +1,292 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+// Deterministic checks of the poll loop, motion and --stress on simulated
+// decks in virtual time; exits non-zero if one fails. Timings go to
+// sony9pin_bench.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "clock.h"
+#include "format.h"
+#include "link.h"
+#include "memoryport.h"
+#include "motion.h"
+#include "poller.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "stress.h"
+#include "timecode.h"
+#include "virtualdeck.h"
+
+using namespace std;
+
+// Every heap allocation of the process, for the allocation-free checks
+atomic<uint64_t> allocations { 0 };
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* pointer = malloc(size ? size : 1))
+    return pointer;
+  throw bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  free(pointer);
+}
+
+namespace {
+
+int64_t now() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Continuous mode polls through Poller::run(), with what the CLI gives it:
+// the scheduler started at 29.97 fps, an eot rule and its transport
+// callback, the reply counting of on_reply. Polling, decoding and the
+// rules must not allocate. Not covered, and allocating: the QSerialPort
+// send and receive path (the port is in memory) and what the CLI does with
+// a poll in its sample callback, the sidecar, journal, timeline and stream
+// updates and the printed line (a stringstream and a QDateTime string).
+int poll_allocations() {
+  VirtualClock clock;
+  set_clock(&clock);
+  MemoryPort port;
+  Link<MemoryPort> link(port);
+  Poller<MemoryPort> poller(port, link);
+  poller.set_timing(1000, 2, 0);
+  uint64_t replies = 0, naks = 0;
+  poller.on_reply = [&](bool received, bool nak) {
+    replies += received;
+    naks += nak;
+  };
+  uint64_t commands = 0;
+  // Built once, as run() takes it
+  const Rules::Transport transport = [&](char command) {
+    commands++;
+    return poller.query(*transport_frame(command)) && is_ack(link.frame()) ? 0 : 1;
+  };
+  Rules rules;
+  string error;
+  if (!rules.add("eot:rewind", 30, error)) {
+    cerr << "Error: poll/allocations, rule " << error << ".\n";
+    set_clock(nullptr);
+    return 1;
+  }
+  PollScheduler scheduler;
+  scheduler.start(30000, 1001, 1, false, 2);
+
+  const int iterations = 10000;
+  State last = {};
+  uint64_t failed = 0;
+  int polls = 0;
+  const auto sample = [&](const State& state, const State&, const Poll& poll, bool) {
+    failed += poll.failed + poll.undecoded;
+    last = state;
+    return ++polls % iterations == 0;
+  };
+  const uint64_t before = allocations;
+  poller.run(scheduler, rules, transport, sample);
+  const uint64_t count = allocations - before;
+  if (count || failed || naks || commands || !last.st.b_play || !last.st.b_servo_lock || !last.tc.is_df) {
+    cerr << "Error: poll/allocations FAILED, " << count << " allocations, " << failed << " failed polls in "
+         << iterations << " polls.\n";
+    set_clock(nullptr);
+    return 1;
+  }
+  cerr << "Info: poll/allocations PASSED, no allocation in " << iterations << " polls of Poller::run (in-memory port).\n";
+
+  set_clock(nullptr);
+  return 0;
+}
+
+// Continuous mode over hours of simulated deck activity, in virtual time:
+// a tape played to its end, where an eot rule rewinds it, with a deck
+// dropout, a stretch of replies later than the timeout and corrupted
+// replies on the way. The loop is Poller::run() of continuous mode:
+// scheduler slots, status and timer1 through the link, rules, and a late
+// reply drained before the next command.
+int virtual_time(int64_t tape_minutes) {
+  const int64_t second = 1000000000;
+  const int64_t minute = 60 * second;
+  VirtualClock clock(1700000000 * second);
+  set_clock(&clock);
+  const int64_t tape_frames = tape_minutes * 60 * 30000 / 1001;
+  VirtualDeck deck(clock, tape_frames);
+  deck.dropout(tape_minutes / 3 * minute, tape_minutes / 3 * minute + 5 * second);
+  deck.late(tape_minutes * 2 / 3 * minute, tape_minutes * 2 / 3 * minute + 3 * second, 1500000000);
+  deck.corrupt_every(10007);
+  Link<VirtualDeck> link(deck);
+  Poller<VirtualDeck> poller(deck, link);
+  poller.set_timing(1000, 2, 0);
+
+  uint64_t failures = 0, undecoded = 0, backwards = 0, rewinds = 0, polls = 0;
+  const auto transport = [&](char command) {
+    if (command == 'r')
+      rewinds++;
+    return poller.query(*transport_frame(command)) && is_ack(link.frame()) ? 0 : 1;
+  };
+
+  Rules rules;
+  string error;
+  if (!rules.add("eot:rewind", 30, error)) {
+    cerr << "Error: virtual time, rule " << error << ".\n";
+    return 1;
+  }
+  PollScheduler scheduler;
+  const auto start = now();
+  transport('p');
+  scheduler.start(30000, 1001, 1, false, 2);
+
+  bool wound = false;
+  int64_t lastFrames = -1;
+  const auto limit = 2 * tape_minutes * minute;
+  poller.run(scheduler, rules, transport, [&](const State& state, const State&, const Poll& poll, bool) {
+    failures += poll.failed;
+    undecoded += poll.undecoded;
+    // A reply taken for the one of another command shows as time going
+    // back, a spurious frame in a corrupted reply as undecoded
+    const auto frames = Timecode::from_deck(state.tc, 30).frames();
+    if (state.st.b_play && lastFrames >= 0 && frames < lastFrames)
+      backwards++;
+    lastFrames = frames;
+    polls++;
+    wound = wound || (rewinds && state.st.b_rewind);
+    return (wound && state.st.b_stop) || stamp_now().monotonic >= limit;
+  });
+  const auto elapsed = now() - start;
+  const auto simulated = stamp_now().monotonic;
+  set_clock(nullptr);
+  scheduler.report();
+  rules.report();
+
+  // Played then wound back, at the simulated speeds
+  const auto expected = tape_minutes * minute + tape_minutes * minute / VirtualDeck::wind_speed;
+  const string name = "virtual/tape_" + to_string(tape_minutes) + "min";
+  cerr << "Info: " << name << ": " << simulated / second << " s simulated in " << elapsed / 1000000 << " ms, " << polls
+       << " polls, " << failures << " failed queries (" << deck.replies_dropped() << " dropped, "
+       << deck.replies_corrupted() << " corrupted replies), " << poller.drained() << " late replies drained.\n";
+  if (rewinds != 1 || !deck.is_stopped() || deck.position() || undecoded > deck.replies_corrupted() || backwards ||
+      !poller.drained() || failures > deck.replies_dropped() + deck.replies_corrupted() + poller.drained() ||
+      llabs(simulated - expected) > minute) {
+    cerr << "Error: " << name << " FAILED, rewinds=" << rewinds << " position=" << deck.position()
+         << " undecoded=" << undecoded << " backwards=" << backwards << ".\n";
+    return 1;
+  }
+  cerr << "Info: " << name << " PASSED.\n";
+  return 0;
+}
+
+// Frame steps and jogs of m and j on the simulated deck, in virtual time:
+// Motion corrects the steps the deck acknowledged without moving and a jog
+// that ran past or stopped short of its point, and fails a jog more than a
+// second off instead of stepping it back.
+int motion_corrections() {
+  struct Case {
+    const char* name;
+    uint64_t miss_every;
+    int64_t overrun;
+    int64_t frames;  // m, 0 for j
+    double rate;
+    double seconds;
+    int result;
+  };
+  const Case cases[] = {
+    { "motion/steps_missed", 7, 0, 100, 0, 0, 0 },
+    { "motion/reverse_steps_missed", 5, 0, -40, 0, 0, 0 },
+    { "motion/jog_overshoot", 0, 12, 0, 2, 2, 0 },
+    { "motion/reverse_jog_undershoot", 0, -9, 0, -0.5, 4, 0 },
+    { "motion/jog_off_by_seconds", 0, 45, 0, 1, 1, 1 },
+  };
+  const int64_t second = 1000000000;
+  const int64_t start = 30000;
+  int failed = 0;
+  for (const auto& test : cases) {
+    VirtualClock clock(1700000000 * second);
+    set_clock(&clock);
+    VirtualDeck deck(clock, 60 * 60 * 30000 / 1001);
+    deck.park(start);
+    deck.miss_step_every(test.miss_every);
+    deck.jog_overrun(test.overrun);
+    Link<VirtualDeck> link(deck);
+    Poller<VirtualDeck> poller(deck, link);
+    poller.set_timing(1000, 2, 0);
+    Motion<VirtualDeck> motion(poller, link, 30);
+
+    const auto result = test.frames ? motion.step_frames(test.frames, false) : motion.jog(test.rate, test.seconds, false);
+    set_clock(nullptr);
+    // Landed on the point, or left where the jog stopped when it failed
+    const auto expected = test.frames ? test.frames : (int64_t)floor(test.rate * 30000 / 1001 * test.seconds + 0.5);
+    const auto moved = deck.position() - start;
+    const bool landed = moved == expected;
+    if (result != test.result || landed == (bool)test.result) {
+      cerr << "Error: " << test.name << " FAILED, result " << result << ", moved " << moved << " frames for " << expected
+           << ".\n";
+      failed++;
+      continue;
+    }
+    cerr << "Info: " << test.name << " PASSED.\n";
+  }
+  return failed ? 1 : 0;
+}
+
+// --stress on a clean link, in virtual time: every status and timer1 data
+// reply must count as good, none as malformed or NAK.
+int stress_clean() {
+  const char* name = "stress/clean_link";
+  const int64_t second = 1000000000;
+  VirtualClock clock(1700000000 * second);
+  set_clock(&clock);
+  VirtualDeck deck(clock, 60 * 60 * 30000 / 1001);
+  Link<VirtualDeck> link(deck);
+  Poller<VirtualDeck> poller(deck, link);
+  poller.set_timing(1000, 2, 0);
+  const auto result = stress_link(poller, link, 10, false);
+  set_clock(nullptr);
+  if (result.errors() || result.requests < 1000) {
+    cerr << "Error: " << name << " FAILED, " << result.errors() << " errors in " << result.requests << " requests (timeouts="
+         << result.timeouts << " malformed=" << result.malformed << ").\n";
+    return 1;
+  }
+  cerr << "Info: " << name << " PASSED, " << result.requests << " requests.\n";
+  return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  int64_t tapeMinutes = 180;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--virtual=", 10) && atoi(argv[i] + 10) > 0) {
+      tapeMinutes = atoi(argv[i] + 10);
+    } else {
+      cerr << "Usage: sony9pin_tests [--virtual=<simulated tape minutes, default 180>]\n";
+      return 1;
+    }
+  }
+
+  int failed = 0;
+  failed += poll_allocations();
+  failed += virtual_time(tapeMinutes);
+  failed += motion_corrections();
+  failed += stress_clean();
+  if (failed) {
+    cerr << "Error: " << failed << " checks FAILED.\n";
+    return 1;
+  }
+  return 0;
+}
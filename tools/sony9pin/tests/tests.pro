@@ -0,0 +1,36 @@
+TEMPLATE = app
+TARGET = sony9pin_tests
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QT -= gui
+
+# Lib
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += memoryport.h \
+           virtualdeck.h \
+           ../clock.h \
+           ../format.h \
+           ../frame.h \
+           ../link.h \
+           ../motion.h \
+           ../poller.h \
+           ../rules.h \
+           ../scheduler.h \
+           ../stress.h \
+           ../timecode.h \
+           ../timeline.h \
+           ../trace.h
+
+SOURCES += tests.cpp \
+           virtualdeck.cpp \
+           ../clock.cpp \
+           ../devices.cpp \
+           ../format.cpp \
+           ../frame.cpp \
+           ../link.cpp \
+           ../rules.cpp \
+           ../scheduler.cpp \
+           ../timeline.cpp \
+           ../trace.cpp
@@ -0,0 +1,214 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "virtualdeck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "frame.h"
+#include "timecode.h"
+
+using namespace std;
+
+namespace {
+
+// 38.4 kbaud, start + 8 data + parity + stop bits
+const int64_t byte_ns = 11 * 1000000000LL / 38400;
+const int64_t latency_ns = 2000000;
+const int64_t lock_ns = 800000000;
+const double play_frames_per_ns = 30000.0 / 1001 / 1e9;
+
+}
+
+VirtualDeck::VirtualDeck(VirtualClock& clock, int64_t tape_frames) : clock(clock), tape_frames(tape_frames) {
+  moved = clock.now().monotonic;
+}
+
+void VirtualDeck::dropout(int64_t from, int64_t to) {
+  dropouts.push_back({ from, to, 0 });
+}
+
+void VirtualDeck::late(int64_t from, int64_t to, int64_t delay_ns) {
+  delays.push_back({ from, to, delay_ns });
+}
+
+void VirtualDeck::park(int64_t frame) {
+  run_to(clock.now().monotonic);
+  mode = Stop;
+  frames = (double)frame;
+}
+
+void VirtualDeck::run_to(int64_t now) {
+  const auto elapsed = now - moved;
+  moved = now;
+  switch (mode) {
+    case Play: frames += elapsed * play_frames_per_ns; break;
+    case Forward: frames += elapsed * play_frames_per_ns * wind_speed; break;
+    case Rewind: frames -= elapsed * play_frames_per_ns * wind_speed; break;
+    case Jog: frames += elapsed * play_frames_per_ns * jog_speed; break;
+    case Stop: break;
+  }
+  if (frames >= tape_frames) {
+    frames = tape_frames;
+    eot = true;
+    mode = Stop;
+  } else if (frames <= 0 && (mode == Rewind || mode == Jog)) {
+    frames = 0;
+    mode = Stop;
+  }
+}
+
+void VirtualDeck::reply(uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t size) {
+  const auto now = clock.now().monotonic;
+  for (const auto& window : dropouts) {
+    if (now >= window.from && now < window.to) {
+      dropped++;
+      return;
+    }
+  }
+  Reply reply;
+  reply.bytes.resize(FrameDecoder::max_size);
+  reply.bytes.resize(encode_frame(reply.bytes.data(), cmd1, cmd2, data, size));
+  if (corrupt_period && ++reply_count % corrupt_period == 0) {
+    reply.bytes.back() ^= 0x55;
+    corrupted++;
+  }
+  reply.arrival = now + latency_ns + (int64_t)reply.bytes.size() * byte_ns;
+  for (const auto& window : delays) {
+    if (now >= window.from && now < window.to)
+      reply.arrival += window.delay;
+  }
+  // One line, a reply does not overtake a late one
+  if (!replies.empty())
+    reply.arrival = max(reply.arrival, replies.back().arrival + (int64_t)reply.bytes.size() * byte_ns);
+  replies.push_back(reply);
+}
+
+int64_t VirtualDeck::write(const char* data, int64_t size) {
+  received.insert(received.end(), data, data + size);
+  while (received.size() >= 3) {
+    const auto length = (size_t)(received[0] & 0x0F) + 3;
+    if (received.size() < length)
+      break;
+    const uint8_t cmd1 = received[0] & 0xF0, cmd2 = received[1];
+    run_to(clock.now().monotonic);
+    if (cmd1 == 0x20) {
+      switch (cmd2) {
+        case 0x00: mode = Stop; break;
+        case 0x01: mode = Play; lock_at = moved + lock_ns; break;
+        case 0x10: mode = Forward; break;
+        case 0x20: mode = Rewind; eot = false; break;
+        case 0x14:
+        case 0x24: {
+          // The tape is still after a step, on a whole frame
+          mode = Stop;
+          frames = floor(frames + 0.5);
+          if (!miss_period || ++step_count % miss_period)
+            frames = min<double>(max<double>(frames + (cmd2 == 0x14 ? 1 : -1), 0), tape_frames);
+          break;
+        }
+        case 0x11:
+        case 0x21: {
+          // Speed data N is 10^(N/32 - 2) times play speed, 0 still
+          const auto data = length > 3 ? received[2] : 0;
+          if (data) {
+            jog_speed = pow(10, data / 32.0 - 2) * (cmd2 == 0x21 ? -1 : 1);
+            mode = Jog;
+            eot = false;
+          } else if (mode == Jog) {
+            mode = Stop;
+            frames = min<double>(max<double>(floor(frames + 0.5) + (jog_speed < 0 ? -overrun : overrun), 0), tape_frames);
+          }
+          break;
+        }
+      }
+      reply(0x10, 0x01, nullptr, 0);
+    } else if (cmd1 == 0x60 && cmd2 == 0x20) {
+      uint8_t status[10] = {};
+      status[1] = mode == Play ? 0x01 : mode == Forward ? 0x04 : mode == Rewind ? 0x08 : 0x20;
+      status[2] = mode == Play && moved >= lock_at ? 0x80 : 0x00;
+      status[8] = (eot ? 0x08 : 0x00) | (tape_frames - frames < 2 * 60 * 30 ? 0x10 : 0x00);
+      reply(0x70, 0x20, status, sizeof(status));
+    } else if (cmd1 == 0x60 && cmd2 == 0x0C) {
+      const auto bcd = Timecode((int64_t)frames, 30, true).bcd();
+      const uint8_t time[4] = { (uint8_t)(bcd.frame | 0x40), bcd.second, bcd.minute, bcd.hour };
+      reply(0x70, 0x04, time, sizeof(time));
+    } else {
+      // Not simulated: NAK, unknown command
+      const uint8_t nak[] = { 0x01 };
+      reply(0x10, 0x12, nak, sizeof(nak));
+    }
+    received.erase(received.begin(), received.begin() + length);
+  }
+  return size;
+}
+
+size_t VirtualDeck::available() const {
+  size_t count = 0;
+  const auto now = clock.now().monotonic;
+  for (const auto& reply : replies) {
+    if (reply.arrival > now)
+      break;
+    count += reply.bytes.size();
+  }
+  return count;
+}
+
+int64_t VirtualDeck::peek(char* data, int64_t size) {
+  int64_t count = 0;
+  const auto now = clock.now().monotonic;
+  for (const auto& reply : replies) {
+    if (reply.arrival > now || count >= size)
+      break;
+    const auto part = min<int64_t>(size - count, reply.bytes.size());
+    memcpy(data + count, reply.bytes.data(), part);
+    count += part;
+  }
+  return count;
+}
+
+int64_t VirtualDeck::read(char* data, int64_t size) {
+  const auto count = peek(data, size);
+  auto remaining = count;
+  while (remaining && !replies.empty()) {
+    auto& bytes = replies.front().bytes;
+    const auto part = min<int64_t>(remaining, bytes.size());
+    bytes.erase(bytes.begin(), bytes.begin() + part);
+    remaining -= part;
+    if (bytes.empty())
+      replies.pop_front();
+  }
+  return count;
+}
+
+bool VirtualDeck::waitForReadyRead(int timeout_ms) {
+  const auto now = clock.now().monotonic;
+  const auto deadline = now + (int64_t)timeout_ms * 1000000;
+  // Next reply not arrived yet, replies arrive in order
+  const auto visible = available();
+  size_t seen = 0;
+  for (const auto& reply : replies) {
+    seen += reply.bytes.size();
+    if (seen <= visible)
+      continue;
+    if (reply.arrival <= deadline) {
+      clock.wait_until(reply.arrival);
+      return true;
+    }
+    break;
+  }
+  clock.wait_until(deadline);
+  return false;
+}
+
+bool VirtualDeck::clear() {
+  const auto now = clock.now().monotonic;
+  while (!replies.empty() && replies.front().arrival <= now)
+    replies.pop_front();
+  return true;
+}
@@ -0,0 +1,98 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef VIRTUALDECK_H
+#define VIRTUALDECK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "clock.h"
+
+// Sony 9-pin deck simulated on virtual time, as a port for Link (write,
+// peek, read, waitForReadyRead). Replies arrive after the deck latency
+// plus their line time; waiting for one advances the clock to its arrival
+// or to the end of the timeout. The tape moves with the transport mode in
+// between: play at 29.97 fps, winds at wind_speed times that, jogs at the
+// speed of the command, stopping at either end (end of tape sets EOT).
+// Frame steps move one frame. Faults are scheduled in virtual time, the
+// transport errors of steps and jogs set up front.
+class VirtualDeck {
+public:
+  VirtualDeck(VirtualClock& clock, int64_t tape_frames);
+
+  // No reply to commands received in [from, to)
+  void dropout(int64_t from, int64_t to);
+  // Replies to commands received in [from, to) are sent delay_ns late
+  void late(int64_t from, int64_t to, int64_t delay_ns);
+  // Every n-th reply has a corrupted checksum
+  void corrupt_every(uint64_t n) { corrupt_period = n; }
+  // Every n-th frame step is acknowledged but the tape does not move
+  void miss_step_every(uint64_t n) { miss_period = n; }
+  // A jog still stops this many frames past the point of the command in
+  // the direction of the jog, short of it if negative
+  void jog_overrun(int64_t frames) { overrun = frames; }
+  // Tape still at the frame
+  void park(int64_t frame);
+
+  int64_t write(const char* data, int64_t size);
+  int64_t peek(char* data, int64_t size);
+  int64_t read(char* data, int64_t size);
+  bool waitForReadyRead(int timeout_ms);
+  // Drops the replies already arrived, as QSerialPort::clear()
+  bool clear();
+
+  int64_t position() const { return (int64_t)frames; }
+  bool is_stopped() const { return mode == Stop; }
+  bool is_eot() const { return eot; }
+  uint64_t replies_dropped() const { return dropped; }
+  uint64_t replies_corrupted() const { return corrupted; }
+
+  static const int wind_speed = 30;
+
+private:
+  enum Mode { Stop, Play, Rewind, Forward, Jog };
+
+  struct Window {
+    int64_t from;
+    int64_t to;
+    int64_t delay;
+  };
+
+  struct Reply {
+    int64_t arrival;
+    std::vector<uint8_t> bytes;
+  };
+
+  void run_to(int64_t now);
+  void reply(uint8_t cmd1, uint8_t cmd2, const uint8_t* data, size_t size);
+  size_t available() const;
+
+  VirtualClock& clock;
+  int64_t tape_frames;
+  Mode mode = Stop;
+  double frames = 0;
+  bool eot = false;
+  int64_t moved = 0;
+  int64_t lock_at = 0;
+  double jog_speed = 0;
+  uint64_t miss_period = 0;
+  uint64_t step_count = 0;
+  int64_t overrun = 0;
+
+  std::vector<Window> dropouts;
+  std::vector<Window> delays;
+  uint64_t corrupt_period = 0;
+  uint64_t reply_count = 0;
+  uint64_t dropped = 0;
+  uint64_t corrupted = 0;
+  std::deque<Reply> replies;
+  std::vector<uint8_t> received;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef TIMECODE_H
+#define TIMECODE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Sony9PinRemote/Sony9PinRemote.h"
+
+// Decimal to binary-coded decimal, 0 to 99
+constexpr uint8_t to_bcd(uint8_t value) {
+  return value + 6 * (value / 10);
+}
+
+constexpr uint8_t from_bcd(uint8_t value) {
+  return value - 6 * (value >> 4);
+}
+
+// Timecode as a frame count at a nominal rate of 24, 25 or 30 fps, the
+// latter SMPTE drop-frame (29.97 DF) or not (29.97 NDF, 30). Comparisons
+// and arithmetic are plain integer operations between values of the same
+// rate and drop-frame mode; a value of another mode is first re-expressed
+// with the same label in this one (in_mode()), fields are otherwise only
+// computed when encoding.
+class Timecode {
+public:
+  struct Bcd {
+    uint8_t frame;
+    uint8_t second;
+    uint8_t minute;
+    uint8_t hour;
+  };
+
+  constexpr Timecode() = default;
+  constexpr Timecode(int64_t frames, uint8_t fps, bool df = false)
+    : count(frames), rate(fps), drop(df && fps == 30) {}
+
+  static constexpr Timecode from_fields(unsigned hour, unsigned minute, unsigned second, unsigned frame,
+                                        uint8_t fps, bool df = false) {
+    const int64_t minutes = hour * 60 + minute;
+    int64_t frames = (minutes * 60 + second) * fps + frame;
+    if (df && fps == 30)
+      frames -= 2 * (minutes - minutes / 10);
+    return Timecode(frames, fps, df);
+  }
+
+  static constexpr Timecode from_bcd(const Bcd& bcd, uint8_t fps, bool df = false) {
+    return from_fields(::from_bcd(bcd.hour), ::from_bcd(bcd.minute), ::from_bcd(bcd.second), ::from_bcd(bcd.frame), fps, df);
+  }
+
+  // Fields as decoded by the controller, drop-frame from the deck flag
+  static constexpr Timecode from_deck(const Sony9PinRemote::TimeCode& tc, uint8_t fps) {
+    return from_fields(tc.hour, tc.minute, tc.second, tc.frame, fps, tc.is_df);
+  }
+
+  // "HH:MM:SS:FF", 1 or 2 digits per field, ':' or ';' separators, ';' or
+  // '.' before the frames meaning drop-frame at 30 fps. Out of range fields
+  // and the labels drop-frame skips are rejected. The mode is the one
+  // typed, in_mode() gives the point on a tape of the other one.
+  static constexpr bool parse(const char* text, size_t size, uint8_t fps, Timecode& out) {
+    unsigned fields[4] = {};
+    size_t field = 0, digits = 0;
+    bool df = false;
+    for (size_t i = 0; i < size; i++) {
+      const char c = text[i];
+      if (c >= '0' && c <= '9') {
+        if (++digits > 2)
+          return false;
+        fields[field] = fields[field] * 10 + (c - '0');
+      } else if ((c == ':' || c == ';' || c == '.') && digits && field < 3) {
+        df = c != ':' && field == 2;
+        field++;
+        digits = 0;
+      } else {
+        return false;
+      }
+    }
+    if (field != 3 || !digits)
+      return false;
+    if (fields[0] > 23 || fields[1] > 59 || fields[2] > 59 || fields[3] >= fps)
+      return false;
+    if (df && fps == 30 && fields[2] == 0 && fields[3] < 2 && fields[1] % 10)
+      return false;
+    out = from_fields(fields[0], fields[1], fields[2], fields[3], fps, df);
+    return true;
+  }
+
+  constexpr int64_t frames() const { return count; }
+  constexpr uint8_t fps() const { return rate; }
+  constexpr bool is_df() const { return drop; }
+
+  // Same label at another rate or drop-frame mode, e.g. a point typed with
+  // ':' on a drop-frame tape. A label drop-frame skips becomes the next
+  // frame.
+  constexpr Timecode in_mode(uint8_t fps, bool df) const {
+    if (fps == rate && (df && fps == 30) == drop)
+      return *this;
+    const auto f = fields();
+    unsigned frame = f.frame < fps ? f.frame : fps - 1;
+    if (df && fps == 30 && f.second == 0 && frame < 2 && f.minute % 10)
+      frame = 2;
+    return from_fields(f.hour, f.minute, f.second, frame, fps, df);
+  }
+
+  // Fields, wrapping at 24 hours
+  constexpr Bcd fields() const {
+    int64_t frames = count % ((int64_t)rate * 86400 - (drop ? 2 * 1296 : 0));
+    if (frames < 0)
+      frames += (int64_t)rate * 86400 - (drop ? 2 * 1296 : 0);
+    if (drop) {
+      const int64_t per_10min = 30 * 600 - 2 * 9;
+      const int64_t per_min = 30 * 60 - 2;
+      const int64_t rest = frames % per_10min;
+      frames += 2 * 9 * (frames / per_10min);
+      if (rest > 2)
+        frames += 2 * ((rest - 2) / per_min);
+    }
+    return {
+      (uint8_t)(frames % rate),
+      (uint8_t)(frames / rate % 60),
+      (uint8_t)(frames / (rate * 60) % 60),
+      (uint8_t)(frames / (rate * 3600) % 24),
+    };
+  }
+
+  constexpr Bcd bcd() const {
+    const auto f = fields();
+    return { to_bcd(f.frame), to_bcd(f.second), to_bcd(f.minute), to_bcd(f.hour) };
+  }
+
+  // "HH:MM:SS:FF" (';' before the frames if drop-frame), out must hold
+  // format_size bytes, returns the length without the terminating null
+  static constexpr size_t format_size = 12;
+  size_t format(char* out) const {
+    const auto f = fields();
+    const uint8_t values[4] = { f.hour, f.minute, f.second, f.frame };
+    for (int i = 0; i < 4; i++) {
+      out[i * 3] = '0' + values[i] / 10;
+      out[i * 3 + 1] = '0' + values[i] % 10;
+      out[i * 3 + 2] = i == 3 ? '\0' : (i == 2 && drop ? ';' : ':');
+    }
+    return format_size - 1;
+  }
+
+  constexpr Timecode operator+(int64_t frames) const { return Timecode(count + frames, rate, drop); }
+  constexpr Timecode operator-(int64_t frames) const { return Timecode(count - frames, rate, drop); }
+  constexpr int64_t operator-(const Timecode& other) const { return count - other.in_mode(rate, drop).count; }
+  Timecode& operator+=(int64_t frames) { count += frames; return *this; }
+  Timecode& operator-=(int64_t frames) { count -= frames; return *this; }
+
+  constexpr bool operator==(const Timecode& other) const { return count == other.in_mode(rate, drop).count; }
+  constexpr bool operator!=(const Timecode& other) const { return count != other.in_mode(rate, drop).count; }
+  constexpr bool operator<(const Timecode& other) const { return count < other.in_mode(rate, drop).count; }
+  constexpr bool operator<=(const Timecode& other) const { return count <= other.in_mode(rate, drop).count; }
+  constexpr bool operator>(const Timecode& other) const { return count > other.in_mode(rate, drop).count; }
+  constexpr bool operator>=(const Timecode& other) const { return count >= other.in_mode(rate, drop).count; }
+
+private:
+  int64_t count = 0;
+  uint8_t rate = 30;
+  bool drop = false;
+};
+
+static_assert(Timecode::from_fields(0, 1, 0, 2, 30, true).frames() == 1800, "first frame after a drop");
+static_assert(Timecode::from_fields(0, 10, 0, 0, 30, true).frames() == 17982, "no drop on tenth minutes");
+static_assert(Timecode(1800, 30, true).fields().frame == 2, "drop-frame fields");
+static_assert(Timecode::from_fields(12, 34, 56, 7, 25).bcd().minute == 0x34, "BCD encoding");
+static_assert(Timecode::from_fields(1, 0, 0, 0, 30, true) == Timecode::from_fields(1, 0, 0, 0, 30), "label across modes");
+static_assert(Timecode::from_fields(1, 0, 0, 0, 30, true) - Timecode::from_fields(0, 59, 59, 29, 30) == 1, "difference across modes");
+static_assert(Timecode::from_fields(0, 1, 0, 0, 30).in_mode(30, true) == Timecode::from_fields(0, 1, 0, 2, 30, true), "dropped label");
+static_assert(Timecode::from_bcd({ 0x07, 0x56, 0x34, 0x12 }, 25) == Timecode::from_fields(12, 34, 56, 7, 25), "BCD decoding");
+
+#endif
@@ -0,0 +1,371 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "timeline.h"
+#include "timecode.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+const uint8_t version = 1;
+const size_t header_size = 8;
+const size_t footer_size = 16;
+const size_t entry_size = 68;
+const uint32_t block_samples = 1024;
+const int64_t block_ms = 60000;
+
+enum : uint8_t {
+  record_delta = 0x00,
+  record_keyframe = 0x01,
+};
+
+bool Sony9PinRemote::Status::* const status_bits[] = {
+  &Sony9PinRemote::Status::b_cassette_out,
+  &Sony9PinRemote::Status::b_servo_ref_missing,
+  &Sony9PinRemote::Status::b_local,
+  &Sony9PinRemote::Status::b_standby,
+  &Sony9PinRemote::Status::b_stop,
+  &Sony9PinRemote::Status::b_eject,
+  &Sony9PinRemote::Status::b_rewind,
+  &Sony9PinRemote::Status::b_forward,
+  &Sony9PinRemote::Status::b_record,
+  &Sony9PinRemote::Status::b_play,
+  &Sony9PinRemote::Status::b_servo_lock,
+  &Sony9PinRemote::Status::b_tso_mode,
+  &Sony9PinRemote::Status::b_shuttle,
+  &Sony9PinRemote::Status::b_jog,
+  &Sony9PinRemote::Status::b_var,
+  &Sony9PinRemote::Status::b_direction,
+  &Sony9PinRemote::Status::b_still,
+  &Sony9PinRemote::Status::b_cue_up,
+  &Sony9PinRemote::Status::b_lamp_still,
+  &Sony9PinRemote::Status::b_lamp_fwd,
+  &Sony9PinRemote::Status::b_lamp_rev,
+  &Sony9PinRemote::Status::b_near_eot,
+  &Sony9PinRemote::Status::b_eot,
+  &Sony9PinRemote::Status::b_cf_lock,
+  &Sony9PinRemote::Status::b_svo_alarm,
+  &Sony9PinRemote::Status::b_sys_alarm,
+  &Sony9PinRemote::Status::b_rec_inhib,
+};
+
+void put_u32(uint8_t*& out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    *out++ = value >> (i * 8);
+}
+
+void put_i64(uint8_t*& out, int64_t value) {
+  for (int i = 0; i < 8; i++)
+    *out++ = (uint64_t)value >> (i * 8);
+}
+
+void put_varint(uint8_t*& out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+}
+
+void put_zigzag(uint8_t*& out, int64_t value) {
+  put_varint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+uint32_t get_u32(const uint8_t*& in) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++)
+    value |= (uint32_t)*in++ << (i * 8);
+  return value;
+}
+
+int64_t get_i64(const uint8_t*& in) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++)
+    value |= (uint64_t)*in++ << (i * 8);
+  return (int64_t)value;
+}
+
+bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in == end)
+      return false;
+    const uint8_t byte = *in++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool get_zigzag(const uint8_t*& in, const uint8_t* end, int64_t& value) {
+  uint64_t raw;
+  if (!get_varint(in, end, raw))
+    return false;
+  value = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+  return true;
+}
+
+// One record, sample holds the previous one on input
+bool decode(const uint8_t*& in, const uint8_t* end, TimelineSample& sample, bool& key) {
+  if (in == end)
+    return false;
+  const uint8_t tag = *in++;
+  if (tag == record_keyframe) {
+    if (end - in < 20)
+      return false;
+    sample.realtime_ms = get_i64(in);
+    sample.frames = get_i64(in);
+    sample.status = get_u32(in);
+    key = true;
+    return true;
+  }
+  if (tag != record_delta)
+    return false;
+  int64_t ms, frames;
+  uint64_t status;
+  if (!get_zigzag(in, end, ms) || !get_zigzag(in, end, frames) || !get_varint(in, end, status))
+    return false;
+  sample.realtime_ms += ms;
+  sample.frames += frames;
+  sample.status ^= (uint32_t)status;
+  key = false;
+  return true;
+}
+
+void new_block(vector<TimelineBlock>& blocks, uint64_t offset, const TimelineSample& sample) {
+  blocks.push_back({ offset, 0, sample.realtime_ms, sample.realtime_ms, sample.frames, sample.frames, 0, sample });
+}
+
+void add_to_block(TimelineBlock& block, const TimelineSample& sample) {
+  block.count++;
+  block.last_ms = sample.realtime_ms;
+  block.min_frames = min(block.min_frames, sample.frames);
+  block.max_frames = max(block.max_frames, sample.frames);
+  block.any_status |= sample.status;
+  block.last = sample;
+}
+
+}
+
+const char* const status_bit_names[] = {
+  "cassette_out", "servo_ref_missing", "local", "standby", "stop", "eject", "rewind", "forward", "record", "play",
+  "servo_lock", "tso_mode", "shuttle", "jog", "var", "direction", "still", "cue_up", "lamp_still", "lamp_fwd",
+  "lamp_rev", "near_eot", "eot", "cf_lock", "svo_alarm", "sys_alarm", "rec_inhib",
+};
+const size_t status_bit_count = sizeof(status_bit_names) / sizeof(*status_bit_names);
+static_assert(sizeof(status_bits) / sizeof(*status_bits) == sizeof(status_bit_names) / sizeof(*status_bit_names), "status bit table");
+
+uint32_t pack_status(const Sony9PinRemote::Status& st, const Sony9PinRemote::TimeCode& tc) {
+  uint32_t word = 0;
+  for (size_t i = 0; i < status_bit_count; i++)
+    word |= (uint32_t)(st.*status_bits[i]) << i;
+  if (tc.is_df)
+    word |= status_df;
+  if (tc.is_cf)
+    word |= status_cf;
+  return word;
+}
+
+void unpack_status(uint32_t word, Sony9PinRemote::Status& st) {
+  for (size_t i = 0; i < status_bit_count; i++)
+    st.*status_bits[i] = (word >> i) & 1;
+}
+
+int status_bit(const string& name) {
+  for (size_t i = 0; i < status_bit_count; i++)
+    if (name == status_bit_names[i])
+      return (int)i;
+  return -1;
+}
+
+Timeline::~Timeline() {
+  close();
+}
+
+bool Timeline::open(const string& path, uint8_t fps) {
+  file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  rate = fps;
+  const uint8_t header[header_size] = { 'S', '9', 'T', 'L', version, fps, 0, 0 };
+  fwrite(header, 1, sizeof(header), file);
+  offset = header_size;
+  blocks.clear();
+  return true;
+}
+
+void Timeline::close() {
+  if (!file)
+    return;
+
+  const uint64_t index_offset = offset;
+  uint8_t entry[entry_size];
+  for (const auto& block : blocks) {
+    uint8_t* out = entry;
+    put_i64(out, block.offset);
+    put_u32(out, block.count);
+    put_i64(out, block.first_ms);
+    put_i64(out, block.last_ms);
+    put_i64(out, block.min_frames);
+    put_i64(out, block.max_frames);
+    put_u32(out, block.any_status);
+    put_i64(out, block.last.realtime_ms);
+    put_i64(out, block.last.frames);
+    put_u32(out, block.last.status);
+    fwrite(entry, 1, sizeof(entry), file);
+  }
+
+  uint8_t footer[footer_size];
+  uint8_t* out = footer;
+  put_i64(out, index_offset);
+  put_u32(out, blocks.size());
+  memcpy(out, "S9TI", 4);
+  fwrite(footer, 1, sizeof(footer), file);
+  fclose(file);
+  file = nullptr;
+}
+
+void Timeline::keyframe(const TimelineSample& sample) {
+  new_block(blocks, offset, sample);
+  uint8_t record[21];
+  uint8_t* out = record;
+  *out++ = record_keyframe;
+  put_i64(out, sample.realtime_ms);
+  put_i64(out, sample.frames);
+  put_u32(out, sample.status);
+  fwrite(record, 1, sizeof(record), file);
+  offset += sizeof(record);
+}
+
+void Timeline::append(int64_t realtime_ms, const State& state) {
+  if (!file)
+    return;
+
+  const TimelineSample sample = { realtime_ms, Timecode::from_deck(state.tc, rate).frames(), pack_status(state.st, state.tc) };
+  if (blocks.empty() || blocks.back().count >= block_samples || realtime_ms - blocks.back().first_ms >= block_ms) {
+    keyframe(sample);
+  } else {
+    // Typically 4 bytes: tag, poll interval, 1 or 0 frames, no status change
+    uint8_t record[1 + 10 + 10 + 5];
+    uint8_t* out = record;
+    *out++ = record_delta;
+    put_zigzag(out, sample.realtime_ms - last.realtime_ms);
+    put_zigzag(out, sample.frames - last.frames);
+    put_varint(out, sample.status ^ last.status);
+    fwrite(record, 1, out - record, file);
+    offset += out - record;
+  }
+  add_to_block(blocks.back(), sample);
+  last = sample;
+}
+
+TimelineReader::~TimelineReader() {
+  if (file)
+    fclose(file);
+}
+
+bool TimelineReader::open(const string& path) {
+  file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+
+  uint8_t header[header_size];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, "S9TL", 4) || header[4] != version)
+    return false;
+  rate = header[5];
+
+  fseek(file, 0, SEEK_END);
+  const uint64_t size = ftell(file);
+  return read_index(size) || rebuild_index(size);
+}
+
+bool TimelineReader::read_index(uint64_t size) {
+  if (size < header_size + footer_size)
+    return false;
+
+  uint8_t footer[footer_size];
+  fseek(file, size - footer_size, SEEK_SET);
+  if (fread(footer, 1, sizeof(footer), file) != sizeof(footer) || memcmp(footer + 12, "S9TI", 4))
+    return false;
+  const uint8_t* in = footer;
+  const uint64_t index_offset = get_i64(in);
+  const uint32_t count = get_u32(in);
+  if (index_offset < header_size || index_offset + (uint64_t)count * entry_size + footer_size != size)
+    return false;
+
+  vector<uint8_t> entries(count * entry_size);
+  fseek(file, index_offset, SEEK_SET);
+  if (fread(entries.data(), 1, entries.size(), file) != entries.size())
+    return false;
+  in = entries.data();
+  index.resize(count);
+  for (auto& block : index) {
+    block.offset = get_i64(in);
+    block.count = get_u32(in);
+    block.first_ms = get_i64(in);
+    block.last_ms = get_i64(in);
+    block.min_frames = get_i64(in);
+    block.max_frames = get_i64(in);
+    block.any_status = get_u32(in);
+    block.last.realtime_ms = get_i64(in);
+    block.last.frames = get_i64(in);
+    block.last.status = get_u32(in);
+  }
+  end = index_offset;
+  return true;
+}
+
+// No footer, the writer was interrupted: one pass over the records, up to
+// the last complete one
+bool TimelineReader::rebuild_index(uint64_t size) {
+  vector<uint8_t> data(size - header_size);
+  fseek(file, header_size, SEEK_SET);
+  if (fread(data.data(), 1, data.size(), file) != data.size())
+    return false;
+
+  index.clear();
+  TimelineSample sample = {};
+  const uint8_t* in = data.data();
+  const uint8_t* const stop = in + data.size();
+  while (in < stop) {
+    const auto record = in;
+    bool key;
+    if (!decode(in, stop, sample, key) || (!key && index.empty()))
+      break;
+    if (key)
+      new_block(index, header_size + (record - data.data()), sample);
+    add_to_block(index.back(), sample);
+    end = header_size + (in - data.data());
+  }
+  return !index.empty();
+}
+
+bool TimelineReader::read_block(size_t block, vector<TimelineSample>& samples) const {
+  const uint64_t begin = index[block].offset;
+  const uint64_t stop = block + 1 < index.size() ? index[block + 1].offset : end;
+  vector<uint8_t> data(stop - begin);
+  fseek(file, begin, SEEK_SET);
+  if (fread(data.data(), 1, data.size(), file) != data.size())
+    return false;
+
+  samples.clear();
+  samples.reserve(index[block].count);
+  TimelineSample sample = {};
+  const uint8_t* in = data.data();
+  const uint8_t* const last = in + data.size();
+  while (in < last) {
+    bool key;
+    if (!decode(in, last, sample, key))
+      return false;
+    samples.push_back(sample);
+  }
+  return true;
+}
@@ -0,0 +1,99 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "format.h"
+
+// Binary deck state timeline. After an 8-byte header ("S9TL", version,
+// fps), samples are stored as records:
+//   0x01 keyframe: realtime ms (i64), frame count (i64), status word (u32)
+//   0x00 delta:    varint ms since previous, zigzag varint frame delta,
+//                  varint status XOR previous
+// A keyframe starts every block (1024 samples or 60 s). On close, an index
+// of every block (offset, time and frame range, OR of status words, last
+// sample) is appended with a 16-byte footer ("S9TI"), so queries can skip
+// to the blocks of interest. A file without footer (interrupted run) is
+// still readable, the index is then rebuilt from the keyframes.
+
+// Status word: bit i is status_bit_names[i], then drop-frame and color
+// frame flags
+extern const char* const status_bit_names[];
+extern const size_t status_bit_count;
+const uint32_t status_df = 1u << 27;
+const uint32_t status_cf = 1u << 28;
+
+uint32_t pack_status(const Sony9PinRemote::Status& st, const Sony9PinRemote::TimeCode& tc);
+void unpack_status(uint32_t word, Sony9PinRemote::Status& st);
+int status_bit(const std::string& name);
+
+struct TimelineSample {
+  int64_t realtime_ms;
+  int64_t frames;
+  uint32_t status;
+};
+
+struct TimelineBlock {
+  uint64_t offset;
+  uint32_t count;
+  int64_t first_ms;
+  int64_t last_ms;
+  int64_t min_frames;
+  int64_t max_frames;
+  uint32_t any_status;
+  TimelineSample last;
+};
+
+class Timeline {
+public:
+  ~Timeline();
+
+  bool open(const std::string& path, uint8_t fps);
+  bool is_open() const { return file != nullptr; }
+  void close();
+
+  void append(int64_t realtime_ms, const State& state);
+
+private:
+  void keyframe(const TimelineSample& sample);
+
+  FILE* file = nullptr;
+  uint8_t rate = 30;
+  uint64_t offset = 0;
+  std::vector<TimelineBlock> blocks;
+  TimelineSample last = {};
+};
+
+class TimelineReader {
+public:
+  ~TimelineReader();
+
+  bool open(const std::string& path);
+
+  uint8_t fps() const { return rate; }
+  const std::vector<TimelineBlock>& blocks() const { return index; }
+
+  // Decodes the samples of one block in order, returns false on a
+  // truncated or corrupted record
+  bool read_block(size_t block, std::vector<TimelineSample>& samples) const;
+
+private:
+  bool read_index(uint64_t size);
+  bool rebuild_index(uint64_t size);
+
+  FILE* file = nullptr;
+  uint64_t end = 0;
+  uint8_t rate = 30;
+  std::vector<TimelineBlock> index;
+};
+
+#endif
@@ -0,0 +1,224 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <algorithm>
+#include <iostream>
+
+#include "format.h"
+#include "timecode.h"
+#include "timeline.h"
+
+using namespace std;
+
+namespace {
+
+TimelineReader timeline;
+size_t blocksRead = 0;
+
+bool read_block(size_t block, vector<TimelineSample>& samples) {
+  blocksRead++;
+  if (!timeline.read_block(block, samples)) {
+    cerr << "Error: corrupted block " << block << ".\n";
+    return false;
+  }
+  return true;
+}
+
+string format_time(int64_t realtime_ms) {
+  return QDateTime::fromMSecsSinceEpoch(realtime_ms).toString(Qt::ISODateWithMs).toStdString();
+}
+
+// Same line as continuous mode, every status field
+void print_sample(const TimelineSample& sample) {
+  State state = {};
+  const auto fields = Timecode(sample.frames, timeline.fps(), sample.status & status_df).fields();
+  state.tc.hour = fields.hour;
+  state.tc.minute = fields.minute;
+  state.tc.second = fields.second;
+  state.tc.frame = fields.frame;
+  state.tc.is_df = sample.status & status_df;
+  state.tc.is_cf = sample.status & status_cf;
+  unpack_status(sample.status, state.st);
+  cout << format_time(sample.realtime_ms);
+  format_state(cout, state, state, true);
+  cout << '\n';
+}
+
+int query_at(const QString& param) {
+  const auto time = QDateTime::fromString(param, Qt::ISODateWithMs);
+  if (!time.isValid()) {
+    cerr << "Error: invalid time " << param.toStdString() << ".\n";
+    return 1;
+  }
+  const int64_t at = time.toMSecsSinceEpoch();
+
+  const auto& blocks = timeline.blocks();
+  const auto block = upper_bound(blocks.begin(), blocks.end(), at,
+                                 [](int64_t value, const TimelineBlock& b) { return value < b.first_ms; });
+  if (block == blocks.begin()) {
+    cerr << "Error: " << param.toStdString() << " is before the first sample.\n";
+    return 1;
+  }
+
+  vector<TimelineSample> samples;
+  if (!read_block(block - blocks.begin() - 1, samples))
+    return 1;
+  auto sample = samples.front();
+  for (const auto& s : samples) {
+    if (s.realtime_ms > at)
+      break;
+    sample = s;
+  }
+  print_sample(sample);
+  return 0;
+}
+
+// Blocks where the bit was never set are skipped without reading them
+int query_intervals(const QString& param) {
+  const auto bit = status_bit(param.toStdString());
+  if (bit < 0) {
+    cerr << "Error: unknown status field " << param.toStdString() << ".\n";
+    return 1;
+  }
+  const uint32_t mask = 1u << bit;
+
+  bool open = false;
+  int64_t begin = 0, last = 0;
+  const auto close = [&](int64_t end) {
+    cout << format_time(begin) << ' ' << format_time(end) << ' ' << (end - begin) / 1000.0 << "s\n";
+    open = false;
+  };
+
+  const auto& blocks = timeline.blocks();
+  vector<TimelineSample> samples;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (!(blocks[i].any_status & mask)) {
+      if (open)
+        close(blocks[i].first_ms);
+      continue;
+    }
+    if (!read_block(i, samples))
+      return 1;
+    for (const auto& sample : samples) {
+      if (!open && (sample.status & mask)) {
+        open = true;
+        begin = sample.realtime_ms;
+      } else if (open && !(sample.status & mask)) {
+        close(sample.realtime_ms);
+      }
+      last = sample.realtime_ms;
+    }
+  }
+  if (open)
+    close(last);
+  return 0;
+}
+
+// Every time the deck went through the timecode with the bit set, the
+// index frame range limits the blocks that are read
+int query_tc(const QString& param, const QString& field) {
+  const auto text = param.toLatin1();
+  Timecode tc;
+  if (!Timecode::parse(text.constData(), text.size(), timeline.fps(), tc)) {
+    cerr << "Error: invalid timecode " << param.toStdString() << ".\n";
+    return 1;
+  }
+  const auto fields = tc.fields();
+  const auto bit = status_bit(field.toStdString());
+  if (bit < 0) {
+    cerr << "Error: unknown status field " << field.toStdString() << ".\n";
+    return 1;
+  }
+  const uint32_t mask = 1u << bit;
+
+  const auto& blocks = timeline.blocks();
+  vector<TimelineSample> samples;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    // Frame count as the deck reported it, drop-frame or not
+    const auto target = Timecode::from_fields(fields.hour, fields.minute, fields.second, fields.frame,
+                                              timeline.fps(), blocks[i].last.status & status_df).frames();
+    auto previous = i ? blocks[i - 1].last : TimelineSample{ blocks[i].first_ms, blocks[i].min_frames, 0 };
+    if (!((blocks[i].any_status | previous.status) & mask) ||
+        target < min(blocks[i].min_frames, previous.frames) || target > max(blocks[i].max_frames, previous.frames))
+      continue;
+    if (!read_block(i, samples))
+      return 1;
+    for (const auto& sample : samples) {
+      const bool forward = previous.frames < target && target <= sample.frames;
+      const bool reverse = previous.frames > target && target >= sample.frames;
+      if ((previous.status & mask) && (sample.status & mask) && (forward || reverse)) {
+        const int64_t at = previous.realtime_ms + (sample.realtime_ms - previous.realtime_ms) *
+                           (target - previous.frames) / (sample.frames - previous.frames);
+        cout << format_time(at) << (forward ? " forward" : " reverse") << '\n';
+      }
+      previous = sample;
+    }
+  }
+  return 0;
+}
+
+int query_dump() {
+  vector<TimelineSample> samples;
+  for (size_t i = 0; i < timeline.blocks().size(); i++) {
+    if (!read_block(i, samples))
+      return 1;
+    for (const auto& sample : samples)
+      print_sample(sample);
+  }
+  return 0;
+}
+
+void usage(const string& commandName) {
+  cerr << "Usage: " << commandName << " <timeline file> <query>\n"
+       << "Queries:\n"
+       << "at <ISO 8601 date>: deck state at this time\n"
+       << "intervals <status field>: time intervals with this status field set (e.g. svo_alarm)\n"
+       << "tc <HH:mm:ss:ff> [<status field>]: times the deck went through this timecode with the status\n"
+       << "    field set (default play)\n"
+       << "dump: every sample\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  QCoreApplication coreApplication(argc, argv);
+  QStringList argumentList = QCoreApplication::arguments();
+
+  QString commandName;
+  if (!argumentList.isEmpty())
+    commandName = argumentList.takeFirst();
+
+  if (argumentList.size() < 2) {
+    usage(commandName.toStdString());
+    return 1;
+  }
+
+  const auto fileName = argumentList.takeFirst();
+  if (!timeline.open(fileName.toStdString())) {
+    cerr << "Error: can not read timeline " << fileName.toStdString() << ".\n";
+    return 1;
+  }
+
+  const auto query = argumentList.takeFirst();
+  int result;
+  if (query == "at" && argumentList.size() == 1) {
+    result = query_at(argumentList[0]);
+  } else if (query == "intervals" && argumentList.size() == 1) {
+    result = query_intervals(argumentList[0]);
+  } else if (query == "tc" && (argumentList.size() == 1 || argumentList.size() == 2)) {
+    result = query_tc(argumentList[0], argumentList.size() == 2 ? argumentList[1] : QString("play"));
+  } else if (query == "dump" && argumentList.isEmpty()) {
+    result = query_dump();
+  } else {
+    usage(commandName.toStdString());
+    return 1;
+  }
+
+  cerr << "Info: " << blocksRead << " of " << timeline.blocks().size() << " blocks read.\n";
+  return result;
+}
@@ -0,0 +1,17 @@
+TEMPLATE = app
+TARGET = sony9pin_timeline
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QT -= gui
+
+# Lib
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../format.h \
+           ../timecode.h \
+           ../timeline.h
+
+SOURCES += query.cpp \
+           ../format.cpp \
+           ../timeline.cpp
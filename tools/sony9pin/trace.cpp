@@ -0,0 +1,77 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#include "trace.h"
+
+#include "clock.h"
+
+using namespace std;
+
+Trace trace;
+
+namespace {
+const size_t trace_buffer_size = 4096;
+}
+
+int64_t trace_now() {
+  return stamp_now().monotonic;
+}
+
+Trace::~Trace() {
+  close();
+}
+
+bool Trace::open(const string& path) {
+  file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+  events.reserve(trace_buffer_size);
+  // The JSON array form may be left unterminated, so a killed session still
+  // produces a loadable trace
+  fputs("[\n", file);
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"sony9pin\"}}");
+  return true;
+}
+
+void Trace::close() {
+  if (!file)
+    return;
+  flush();
+  fputs("\n]\n", file);
+  fclose(file);
+  file = nullptr;
+}
+
+void Trace::span(const char* name, int64_t begin, int64_t end, int tid) {
+  events.push_back({ name, begin, end, tid });
+  if (events.size() >= trace_buffer_size)
+    flush();
+}
+
+void Trace::thread_name(int tid, const string& name) {
+  if (!file)
+    return;
+  string escaped;
+  for (auto c : name) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", tid, escaped.c_str());
+}
+
+void Trace::flush() {
+  if (!file)
+    return;
+  for (const auto& event : events) {
+    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld.%03d,\"dur\":%lld.%03d}",
+            event.name, event.tid,
+            (long long)(event.begin / 1000), (int)(event.begin % 1000),
+            (long long)((event.end - event.begin) / 1000), (int)((event.end - event.begin) % 1000));
+  }
+  events.clear();
+  fflush(file);
+}
@@ -0,0 +1,67 @@
+/*  Copyright (c) MIPoPS. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-3-Clause license that can
+ *  be found in the LICENSE.txt file in the same directory.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Trace Event Format (chrome://tracing, ui.perfetto.dev) writer.
+// Spans are kept in a preallocated buffer of POD records pointing to
+// string literals and only formatted when the buffer is flushed, so the
+// cost per span is two clock reads and a store.
+class Trace {
+public:
+  ~Trace();
+
+  bool open(const std::string& path);
+  void close();
+  bool enabled() const { return file != nullptr; }
+
+  // name must have static storage duration
+  void span(const char* name, int64_t begin, int64_t end, int tid);
+  void thread_name(int tid, const std::string& name);
+  void flush();
+
+private:
+  struct Event {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+    int tid;
+  };
+
+  FILE* file = nullptr;
+  std::vector<Event> events;
+};
+
+extern Trace trace;
+
+int64_t trace_now();
+
+// Records a complete event covering its own lifetime when tracing is on
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* name, int tid = 0)
+    : name(name), tid(tid), begin(trace.enabled() ? trace_now() : 0) {}
+  ~TraceSpan() {
+    if (begin)
+      trace.span(name, begin, trace_now(), tid);
+  }
+
+private:
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  const char* name;
+  int tid;
+  int64_t begin;
+};
+
+#endif